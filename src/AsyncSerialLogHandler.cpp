@@ -0,0 +1,120 @@
+#include "AsyncSerialLogHandler.h"
+
+AsyncSerialLogHandler::AsyncSerialLogHandler(USARTSerial &serial, int baud, LogLevel level, LogCategoryFilters filters) :
+	StreamLogHandler(serial, level, filters), serial(serial), head(0), tail(0), dropped(0), truncated(0) {
+	serial.begin(baud);
+	LogManager::instance()->addHandler(this);
+}
+
+AsyncSerialLogHandler::~AsyncSerialLogHandler() {
+	LogManager::instance()->removeHandler(this);
+}
+
+void AsyncSerialLogHandler::logMessage(const char *msg, LogLevel level, const char *category, const LogAttributes &attr) {
+	messageLen = 0;
+	messageTruncated = false;
+
+	// Formats the message through write(), which only stages it
+	formatting = true;
+	StreamLogHandler::logMessage(msg, level, category, attr);
+	formatting = false;
+
+	if (messageTruncated) {
+		// Keep the line ending so the next message starts on its own line
+		message[MESSAGE_SIZE - 2] = '\r';
+		message[MESSAGE_SIZE - 1] = '\n';
+	}
+	commit();
+}
+
+void AsyncSerialLogHandler::write(const char *data, size_t size) {
+	if (!formatting) {
+		// Raw output from Log.write(), Log.print() or Log.dump() is committed as it comes
+		messageLen = 0;
+		messageTruncated = false;
+		stage(data, size);
+		commit();
+		return;
+	}
+	stage(data, size);
+}
+
+void AsyncSerialLogHandler::stage(const char *data, size_t size) {
+	if (size > MESSAGE_SIZE - messageLen) {
+		size = MESSAGE_SIZE - messageLen;
+		messageTruncated = true;
+	}
+	memcpy(&message[messageLen], data, size);
+	messageLen += size;
+}
+
+void AsyncSerialLogHandler::commit() {
+	if (messageTruncated) {
+		truncated.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	uint32_t h = head.load(std::memory_order_relaxed);
+	size_t used = h - tail.load(std::memory_order_acquire);
+	if (messageLen > BUFFER_SIZE - used) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	size_t offset = h % BUFFER_SIZE;
+	size_t first = BUFFER_SIZE - offset;
+	if (first > messageLen) {
+		first = messageLen;
+	}
+	memcpy(&ring[offset], message, first);
+	memcpy(ring, &message[first], messageLen - first);
+
+	head.store(h + messageLen, std::memory_order_release);
+
+	if (used + messageLen > highWaterMark) {
+		highWaterMark = used + messageLen;
+	}
+}
+
+void AsyncSerialLogHandler::drain() {
+	uint32_t t = tail.load(std::memory_order_relaxed);
+	size_t used = head.load(std::memory_order_acquire) - t;
+
+	while(used > 0) {
+		int avail = serial.availableForWrite();
+		if (avail <= 0) {
+			return;
+		}
+
+		size_t offset = t % BUFFER_SIZE;
+		size_t count = BUFFER_SIZE - offset;
+		if (count > used) {
+			count = used;
+		}
+		if (count > (size_t)avail) {
+			count = avail;
+		}
+
+		serial.write((const uint8_t *)&ring[offset], count);
+		t += count;
+		used -= count;
+		tail.store(t, std::memory_order_release);
+	}
+
+	uint32_t d = dropped.load(std::memory_order_relaxed);
+	if (d != droppedReported) {
+		char notice[48];
+		int len = snprintf(notice, sizeof(notice), "[%lu log messages dropped]\r\n", (unsigned long)(d - droppedReported));
+		if (serial.availableForWrite() >= len) {
+			serial.write((const uint8_t *)notice, len);
+			droppedReported = d;
+		}
+	}
+}
+
+void AsyncSerialLogHandler::flush() {
+	while(head.load(std::memory_order_acquire) != tail.load(std::memory_order_relaxed) || getDropped() != droppedReported) {
+		drain();
+		delay(1);
+	}
+	serial.flush();
+}
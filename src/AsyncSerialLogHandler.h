@@ -0,0 +1,82 @@
+#ifndef __ASYNCSERIALLOGHANDLER_H
+#define __ASYNCSERIALLOGHANDLER_H
+
+#include "Particle.h"
+
+#include <atomic>
+
+// Size of the ring buffer for formatted log output, must be a power of 2
+#ifndef ASYNCSERIALLOGHANDLER_BUFFER_SIZE
+#define ASYNCSERIALLOGHANDLER_BUFFER_SIZE 2048
+#endif
+
+// Longest single formatted message; longer messages are truncated
+#ifndef ASYNCSERIALLOGHANDLER_MESSAGE_SIZE
+#define ASYNCSERIALLOGHANDLER_MESSAGE_SIZE 256
+#endif
+
+/**
+ * Log handler for a hardware serial port that does not block the logging thread.
+ *
+ * Drop-in replacement for Serial1LogHandler. Messages are formatted the same way as
+ * StreamLogHandler formats them, into a staging buffer, and then committed whole to a ring
+ * buffer. Call drain() from loop() to move data from the ring to the serial port; it only
+ * writes as much as the port's TX buffer can take, so it never waits for the UART either.
+ *
+ * If a message does not fit in the ring it is dropped whole and counted, and drain() prints
+ * the number of dropped messages once the ring has emptied.
+ *
+ * The log system calls handlers with its lock held, so there is one producer at a time. The
+ * ring is single producer, single consumer, with the consumer being the thread calling drain().
+ */
+class AsyncSerialLogHandler : public StreamLogHandler {
+public:
+	AsyncSerialLogHandler(USARTSerial &serial, int baud, LogLevel level = LOG_LEVEL_INFO, LogCategoryFilters filters = {});
+	virtual ~AsyncSerialLogHandler();
+
+	/**
+	 * Writes buffered output to the serial port without blocking. Call from loop().
+	 */
+	void drain();
+
+	/**
+	 * Writes all buffered output, waiting for the serial port. Use before sleep or reset,
+	 * or before writing to the serial port directly.
+	 */
+	void flush();
+
+	uint32_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+	uint32_t getTruncated() const { return truncated.load(std::memory_order_relaxed); }
+
+	// Most bytes waiting in the ring at once
+	size_t getHighWaterMark() const { return highWaterMark; }
+
+protected:
+	virtual void logMessage(const char *msg, LogLevel level, const char *category, const LogAttributes &attr) override;
+	virtual void write(const char *data, size_t size) override;
+
+	void stage(const char *data, size_t size);
+	void commit();
+
+	static const size_t BUFFER_SIZE = ASYNCSERIALLOGHANDLER_BUFFER_SIZE;
+	static const size_t MESSAGE_SIZE = ASYNCSERIALLOGHANDLER_MESSAGE_SIZE;
+
+	USARTSerial &serial;
+
+	char ring[BUFFER_SIZE];
+	std::atomic<uint32_t> head;		// Total bytes committed, written by the producer
+	std::atomic<uint32_t> tail;		// Total bytes sent, written by drain()
+
+	// Message being formatted, producer only
+	char message[MESSAGE_SIZE];
+	size_t messageLen = 0;
+	bool messageTruncated = false;
+	bool formatting = false;
+
+	std::atomic<uint32_t> dropped;
+	std::atomic<uint32_t> truncated;
+	uint32_t droppedReported = 0;
+	size_t highWaterMark = 0;
+};
+
+#endif /* __ASYNCSERIALLOGHANDLER_H */
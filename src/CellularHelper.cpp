@@ -27,8 +27,171 @@ static LogClass Log;
 
 CellularHelperClass CellularHelper;
 
+// static
+bool CellularHelperFields::scanInt(const char *&p, const char *end, int &value) {
+	bool negative = (p < end && *p == '-');
+	const char *start = negative ? p + 1 : p;
+	const char *cur = start;
+	int result = 0;
+	while(cur < end && *cur >= '0' && *cur <= '9') {
+		result = result * 10 + (*cur++ - '0');
+	}
+	if (cur == start) {
+		return false;
+	}
+	value = negative ? -result : result;
+	p = cur;
+	if (p < end && *p == ',') {
+		p++;
+	}
+	return true;
+}
+
+// static
+bool CellularHelperFields::scanQuoted(const char *&p, const char *end, const char *&str, size_t &len) {
+	if (p >= end || *p != '"') {
+		return false;
+	}
+	const char *close = (const char *)memchr(p + 1, '"', end - p - 1);
+	if (!close) {
+		return false;
+	}
+	str = p + 1;
+	len = close - str;
+	p = close + 1;
+	if (p < end && *p == ',') {
+		p++;
+	}
+	return true;
+}
+
+// static
+bool CellularHelperFields::scanQuoted(const char *&p, const char *end, char *buf, size_t bufSize) {
+	const char *str;
+	size_t len;
+	if (!scanQuoted(p, end, str, len)) {
+		return false;
+	}
+	if (bufSize > 0) {
+		if (len > bufSize - 1) {
+			len = bufSize - 1;
+		}
+		memcpy(buf, str, len);
+		buf[len] = 0;
+	}
+	return true;
+}
+
+bool CellularHelperIntField::scan(const char *&p) const {
+	char *end;
+	long result = strtol(p, &end, 10);
+	if (end == p) {
+		return false;
+	}
+	value = (int) result;
+	p = end;
+	return true;
+}
+
+bool CellularHelperHexQuotedField::scan(const char *&p) const {
+	if (*p != '"') {
+		return false;
+	}
+	char *end;
+	unsigned long result = strtoul(p + 1, &end, 16);
+	if (end == p + 1 || *end != '"') {
+		return false;
+	}
+	value = (int) result;
+	p = end + 1;
+	return true;
+}
+
+bool CellularHelperStringField::scan(const char *&p) const {
+	const char *start = p;
+	const char *end;
+
+	if (*p == '"') {
+		start++;
+		end = strchr(start, '"');
+		if (!end) {
+			return false;
+		}
+		p = end + 1;
+	}
+	else {
+		end = strchr(start, ',');
+		if (!end) {
+			end = start + strlen(start);
+		}
+		p = end;
+	}
+
+	if (bufSize > 0) {
+		size_t len = end - start;
+		if (len > bufSize - 1) {
+			len = bufSize - 1;
+		}
+		memcpy(buf, start, len);
+		buf[len] = 0;
+	}
+	return true;
+}
+
+bool CellularHelperSkipField::scan(const char *&p) const {
+	bool inQuoted = false;
+	while(*p && (inQuoted || *p != ',')) {
+		if (*p == '"') {
+			inQuoted = !inQuoted;
+		}
+		p++;
+	}
+	return true;
+}
+
+CellularHelperLineScanner::CellularHelperLineScanner(const char *buf, size_t len) : cur(buf), end(buf + len) {
+}
+
+bool CellularHelperLineScanner::next(const char *&line, size_t &lineLen) {
+	while(cur < end) {
+		// A line ends at the first \r or \n, the same split strtok_r(..., "\r\n", ...) makes.
+		// The \r search is limited to the current line so each byte is only examined once.
+		const char *nl = (const char *) memchr(cur, '\n', end - cur);
+		const char *lineEnd = (nl != NULL) ? nl : end;
+		const char *cr = (const char *) memchr(cur, '\r', lineEnd - cur);
+		if (cr != NULL) {
+			lineEnd = cr;
+		}
+
+		const char *start = cur;
+		cur = (lineEnd < end) ? lineEnd + 1 : end;
+
+		if (lineEnd > start) {
+			// Not an empty line
+			line = start;
+			lineLen = lineEnd - start;
+			return true;
+		}
+	}
+	return false;
+}
+
+// static
+bool CellularHelperLineScanner::skipPlusPrefix(const char *&line, size_t &lineLen, const char *command, size_t commandLen) {
+	// "+" command ": "
+	if (lineLen < commandLen + 3 || line[0] != '+' || memcmp(&line[1], command, commandLen) != 0 ||
+		line[commandLen + 1] != ':' || line[commandLen + 2] != ' ') {
+		return false;
+	}
+	line += commandLen + 3;
+	lineLen -= commandLen + 3;
+	return true;
+}
+
 void CellularHelperCommonResponse::logCellularDebug(int type, const char *buf, int len) const {
-	String typeStr;
+	const char *typeStr;
+	char typeBuf[16];
+
 	switch(type) {
 	case TYPE_UNKNOWN:
 		typeStr = "TYPE_UNKNOWN";
@@ -83,34 +246,49 @@ void CellularHelperCommonResponse::logCellularDebug(int type, const char *buf, i
 		break;
 
 	default:
-		typeStr = String::format("type=0x%x", type);
+		snprintf(typeBuf, sizeof(typeBuf), "type=0x%x", type);
+		typeStr = typeBuf;
 		break;
 	}
 
-	Log.info("cellular response type=%s len=%d", typeStr.c_str(), len);
-	String out;
+	Log.info("cellular response type=%s len=%d", typeStr, len);
+
+	// Each input byte expands to at most 4 characters ("0x1f"). Build the escaped output in a
+	// small stack buffer and log long lines in pieces.
+	char out[64];
+	const size_t outSize = sizeof(out);
+	size_t outLen = 0;
+
 	for(int ii = 0; ii < len; ii++) {
+		if (outLen + 5 > outSize) {
+			out[outLen] = 0;
+			Log.info("%s", out);
+			outLen = 0;
+		}
+
 		if (buf[ii] == '\n') {
-			out += "\\n";
-			Log.info(out);
-			out = "";
+			out[outLen++] = '\\';
+			out[outLen++] = 'n';
+			out[outLen] = 0;
+			Log.info("%s", out);
+			outLen = 0;
 		}
 		else
 		if (buf[ii] == '\r') {
-			out += "\\r";
+			out[outLen++] = '\\';
+			out[outLen++] = 'r';
 		}
 		else
 		if (buf[ii] < ' ' || buf[ii] >= 127) {
-			char hex[10];
-			snprintf(hex, sizeof(hex), "0x%02x", buf[ii]);
-			out.concat(hex);
+			outLen += snprintf(&out[outLen], 5, "0x%02x", (uint8_t)buf[ii]);
 		}
 		else {
-			out.concat(buf[ii]);
+			out[outLen++] = buf[ii];
 		}
 	}
-	if (out.length() > 0) {
-		Log.info(out);
+	if (outLen > 0) {
+		out[outLen] = 0;
+		Log.info("%s", out);
 	}
 }
 
@@ -133,36 +311,106 @@ int CellularHelperPlusStringResponse::parse(int type, const char *buf, int len)
 		logCellularDebug(type, buf, len);
 	}
 	if (type == TYPE_PLUS) {
-		// Copy to temporary string to make processing easier
-		char *copy = (char *) malloc(len + 1);
-		if (copy) {
-			strncpy(copy, buf, len);
-			copy[len] = 0;
-
-			// We return the parts of the + response corresponding to the command we requested
-			char searchFor[32];
-			snprintf(searchFor, sizeof(searchFor), "\n+%s: ", command.c_str());
+		// We return the parts of the + response corresponding to the command we requested
+		CellularHelperLineScanner scanner(buf, len);
+		const char *line;
+		size_t lineLen;
+
+		while(scanner.next(line, lineLen)) {
+			if (CellularHelperLineScanner::skipPlusPrefix(line, lineLen, command.c_str(), command.length())) {
+				CellularHelper.appendBufferToString(string, line, lineLen);
+				break;
+			}
+		}
+	}
+	return WAIT;
+}
 
-			//Log.info("searching for: +%s:", command.c_str());
+CellularHelperBufferResponse::CellularHelperBufferResponse(char *buf, size_t bufSize) : buf(buf), bufSize(bufSize) {
+	if (bufSize > 0) {
+		buf[0] = 0;
+	}
+}
 
-			char *start = strstr(copy, searchFor);
-			if (start) {
-				start += strlen(searchFor);
+int CellularHelperBufferResponse::parse(int type, const char *buf, int len) {
+	if (enableDebug) {
+		logCellularDebug(type, buf, len);
+	}
+	if (type == TYPE_UNKNOWN) {
+		append(buf, len, true);
+	}
+	return WAIT;
+}
 
-				char *end = strchr(start, '\r');
-				CellularHelper.appendBufferToString(string, start, end - start);
-				//Log.info("found %s", string.c_str());
-			}
-			else {
-				//Log.info("not found");
+void CellularHelperBufferResponse::append(const char *data, size_t len, bool noEOL) {
+	for(size_t ii = 0; ii < len; ii++) {
+		if (!noEOL || (data[ii] != '\r' && data[ii] != '\n')) {
+			if (length + 1 < bufSize) {
+				buf[length] = data[ii];
+				buf[length + 1] = 0;
 			}
+			// Keep counting past the end so the caller can tell how much space was needed
+			length++;
+		}
+	}
+}
+
+CellularHelperPlusBufferResponse::CellularHelperPlusBufferResponse(char *buf, size_t bufSize, const char *command) :
+	CellularHelperBufferResponse(buf, bufSize), command(command) {
+}
 
-			free(copy);
+int CellularHelperPlusBufferResponse::parse(int type, const char *buf, int len) {
+	if (enableDebug) {
+		logCellularDebug(type, buf, len);
+	}
+	if (type == TYPE_PLUS) {
+		// Same matching as CellularHelperPlusStringResponse::parse
+		CellularHelperLineScanner scanner(buf, len);
+		const char *line;
+		size_t lineLen;
+
+		while(scanner.next(line, lineLen)) {
+			if (CellularHelperLineScanner::skipPlusPrefix(line, lineLen, command, strlen(command))) {
+				append(line, lineLen);
+				break;
+			}
 		}
 	}
 	return WAIT;
 }
 
+size_t CellularHelperPlusBufferResponse::keepDoubleQuotedPart(bool onlyFirst) {
+	if (bufSize == 0) {
+		return 0;
+	}
+
+	// The quoted part is never longer than the whole string, so this can be done in place
+	bool inQuoted = false;
+	size_t out = 0;
+	for(size_t ii = 0; buf[ii]; ii++) {
+		char ch = buf[ii];
+		if (ch == '"') {
+			inQuoted = !inQuoted;
+			if (!inQuoted && onlyFirst) {
+				break;
+			}
+		}
+		else {
+			if (inQuoted) {
+				buf[out++] = ch;
+			}
+		}
+	}
+	buf[out] = 0;
+
+	if (!isTruncated()) {
+		length = out;
+	}
+	// Otherwise leave length as is, since the quoted part may have been cut off
+
+	return length;
+}
+
 String CellularHelperPlusStringResponse::getDoubleQuotedPart(bool onlyFirst) const {
 	String result;
 	bool inQuoted = false;
@@ -189,7 +437,7 @@ String CellularHelperPlusStringResponse::getDoubleQuotedPart(bool onlyFirst) con
 
 
 void CellularHelperRSSIQualResponse::postProcess() {
-	if (sscanf(string.c_str(), "%d,%d", &rssi, &qual) == 2) {
+	if (scan(CellularHelperIntField(rssi), CellularHelperIntField(qual)) == 2) {
 
 		// The range is the following:
 		// 0: -113 dBm or less
@@ -212,13 +460,10 @@ void CellularHelperRSSIQualResponse::postProcess() {
 	}
 }
 
-/*
 CellularHelperEnvironmentResponse::CellularHelperEnvironmentResponse(CellularHelperEnvironmentCellData *neighbors, size_t numNeighbors) :
 	neighbors(neighbors), numNeighbors(numNeighbors) {
-
-
 }
-*/
+
 int CellularHelperEnvironmentResponse::parse(int type, const char *buf, int len) {
 	if (enableDebug) {
 		logCellularDebug(type, buf, len);
@@ -226,82 +471,83 @@ int CellularHelperEnvironmentResponse::parse(int type, const char *buf, int len)
 
 	if (type == TYPE_UNKNOWN || type == TYPE_PLUS) {
 		// We get this for AT+CGED=5
-		// Copy to temporary string to make processing easier
-		char *copy = (char *) malloc(len + 1);
-		if (copy) {
-			strncpy(copy, buf, len);
-			copy[len] = 0;
-
-			// This is used for skipping over the +CGED: part of the response
-			char searchFor[32];
-			size_t searchForLen = snprintf(searchFor, sizeof(searchFor), "+%s: ", command.c_str());
-
-			char *endStr;
-
-			char *line = strtok_r(copy, "\r\n", &endStr);
-			while(line) {
-				if (line[0]) {
-					// Not an empty line
-
-					if (type == TYPE_PLUS && strncmp(line, searchFor, searchForLen) == 0) {
-						line += searchForLen;
-					}
-
-					if (strncmp(line, "MCC:", 4) == 0) {
-						// Line begins with MCC:
-						// This happens for 2G and 3G
-						if (curDataIndex < 0) {
-							service.parse(line);
-							curDataIndex++;
-						}
-						else
-						if (neighbors && (size_t)curDataIndex < numNeighbors) {
-							neighbors[curDataIndex++].parse(line);
-						}
-					}
-					else
-					if (strncmp(line, "RAT:", 4) == 0) {
-						// Line begins with RAT:
-						// This happens for 3G in the + response so you know whether
-						// the response is for a 2G or 3G tower
-						service.parse(line);
-					}
-				}
-				line = strtok_r(NULL, "\r\n", &endStr);
+		CellularHelperLineScanner scanner(buf, len);
+		const char *line;
+		size_t lineLen;
+
+		while(scanner.next(line, lineLen)) {
+			if (type == TYPE_PLUS) {
+				// Skip over the +CGED: part of the response
+				CellularHelperLineScanner::skipPlusPrefix(line, lineLen, command.c_str(), command.length());
 			}
 
-			free(copy);
+			if (lineLen >= 4 && strncmp(line, "MCC:", 4) == 0) {
+				// Line begins with MCC:
+				// This happens for 2G and 3G
+				if (curDataIndex < 0) {
+					service.parse(line, lineLen);
+					curDataIndex++;
+				}
+				else
+				if (neighbors && (size_t)curDataIndex < numNeighbors) {
+					neighbors[curDataIndex++].parse(line, lineLen);
+				}
+			}
+			else
+			if (lineLen >= 4 && strncmp(line, "RAT:", 4) == 0) {
+				// Line begins with RAT:
+				// This happens for 3G in the + response so you know whether
+				// the response is for a 2G or 3G tower
+				service.parse(line, lineLen);
+			}
 		}
 	}
 	return WAIT;
 }
 
 void CellularHelperEnvironmentCellData::parse(const char *str) {
-	char *mutableCopy = strdup(str);
+	parse(str, strlen(str));
+}
+
+void CellularHelperEnvironmentCellData::parse(const char *str, size_t len) {
+	const char *end = str + len;
 
-	char *endStr;
+	while(str < end) {
+		const char *comma = (const char *) memchr(str, ',', end - str);
+		const char *pairEnd = (comma != NULL) ? comma : end;
 
-	char *pair = strtok_r(mutableCopy, ",", &endStr);
-	while(pair) {
 		// Remove leading spaces caused by ", " combination
-		while(*pair == ' ') {
-			pair++;
+		while(str < pairEnd && *str == ' ') {
+			str++;
 		}
 
-		char *colon = strchr(pair, ':');
+		const char *colon = (const char *) memchr(str, ':', pairEnd - str);
 		if (colon != NULL) {
-			*colon = 0;
-			const char *key = pair;
-			const char *value = ++colon;
+			// Keys and values are short; anything longer than these is truncated and the
+			// key is reported as unknown by addKeyValue
+			char key[24];
+			char value[24];
+
+			size_t keyLen = colon - str;
+			if (keyLen > sizeof(key) - 1) {
+				keyLen = sizeof(key) - 1;
+			}
+			memcpy(key, str, keyLen);
+			key[keyLen] = 0;
+
+			colon++;
+			size_t valueLen = pairEnd - colon;
+			if (valueLen > sizeof(value) - 1) {
+				valueLen = sizeof(value) - 1;
+			}
+			memcpy(value, colon, valueLen);
+			value[valueLen] = 0;
 
 			addKeyValue(key, value);
 		}
 
-		pair = strtok_r(NULL, ",", &endStr);
+		str = (comma != NULL) ? comma + 1 : end;
 	}
-
-
-	free(mutableCopy);
 }
 
 bool CellularHelperEnvironmentCellData::isValid(bool ignoreCI) const {
@@ -593,45 +839,40 @@ size_t CellularHelperEnvironmentResponse::getNumNeighbors() const {
 // +UULOC: <date>,<time>,<lat>,<long>,<alt>,<uncertainty>
 
 void CellularHelperLocationResponse::postProcess() {
-	char *mutableCopy = strdup(string.c_str());
-	if (mutableCopy) {
-		char *part, *endStr;
-
-		part = strtok_r(mutableCopy, ",", &endStr);
-		if (part) {
-			// part is date
-			part = strtok_r(NULL, ",", &endStr);
-			if (part) {
-				// part is time
-				part = strtok_r(NULL, ",", &endStr);
-				if (part) {
-					// part is lat
-					lat = atof(part);
-
-					part = strtok_r(NULL, ",", &endStr);
-					if (part) {
-						// part is lon
-						lon = atof(part);
-
-						part = strtok_r(NULL, ",", &endStr);
-						if (part) {
-							// part is alt
-							alt = atoi(part);
-
-							part = strtok_r(NULL, ",", &endStr);
-							if (part) {
-								// part is uncertainty
-								uncertainty = atoi(part);
-								valid = true;
-								resp = RESP_OK;
-							}
-						}
-					}
-				}
-			}
+	// Find the start of each field in place. Like strtok_r, empty fields are skipped.
+	const char *fields[6];
+	size_t numFields = 0;
+
+	const char *part = string.c_str();
+	while(numFields < 6) {
+		while(*part == ',') {
+			part++;
+		}
+		if (!*part) {
+			break;
 		}
+		fields[numFields++] = part;
+
+		part = strchr(part, ',');
+		if (!part) {
+			break;
+		}
+	}
 
-		free(mutableCopy);
+	// fields[0] is date, fields[1] is time; atof/atoi stop at the next comma
+	if (numFields > 2) {
+		lat = atof(fields[2]);
+	}
+	if (numFields > 3) {
+		lon = atof(fields[3]);
+	}
+	if (numFields > 4) {
+		alt = atoi(fields[4]);
+	}
+	if (numFields > 5) {
+		uncertainty = atoi(fields[5]);
+		valid = true;
+		resp = RESP_OK;
 	}
 }
 
@@ -648,12 +889,14 @@ void CellularHelperCREGResponse::postProcess() {
 	// "\r\n+CREG: 2,1,\"FFFE\",\"C45C010\",8\r\n"
 	int n;
 
-	if (sscanf(string.c_str(), "%d,%d,\"%x\",\"%x\",%d", &n, &stat, &lac, &ci, &rat) == 5) {
+	if (scan(CellularHelperIntField(n), CellularHelperIntField(stat), CellularHelperHexQuotedField(lac),
+			CellularHelperHexQuotedField(ci), CellularHelperIntField(rat)) == 5) {
 		// SARA-R4 does include the n (5 parameters)
 		valid = true;
 	}
 	else
-	if (sscanf(string.c_str(), "%d,\"%x\",\"%x\",%d", &stat, &lac, &ci, &rat) == 4) {
+	if (scan(CellularHelperIntField(stat), CellularHelperHexQuotedField(lac),
+			CellularHelperHexQuotedField(ci), CellularHelperIntField(rat)) == 4) {
 		// SARA-U and SARA-G don't include the n (4 parameters)
 		valid = true;
 	}
@@ -674,17 +917,19 @@ void CellularHelperCEREGResponse::postProcess() {
 	// "\r\n+CEREG: 2,1,"3a9b","0000c33d",7\r\n"
 	//int n;
 
-	if (sscanf(string.c_str(), "%d,%d,\"%x\",\"%x\",%d", &n, &stat, &lac, &ci, &rat) == 5) {
+	if (scan(CellularHelperIntField(n), CellularHelperIntField(stat), CellularHelperHexQuotedField(lac),
+			CellularHelperHexQuotedField(ci), CellularHelperIntField(rat)) == 5) {
 		// SARA-R4 does include the n (5 parameters)
 		valid = true;
 	}
 	else
-	if (sscanf(string.c_str(), "%d,\"%x\",\"%x\",%d", &stat, &lac, &ci, &rat) == 4) {
+	if (scan(CellularHelperIntField(stat), CellularHelperHexQuotedField(lac),
+			CellularHelperHexQuotedField(ci), CellularHelperIntField(rat)) == 4) {
 		// SARA-U and SARA-G don't include the n (4 parameters)
 		valid = true;
 	}
 	else
-	if (sscanf(string.c_str(), "%d,%d", &n, &stat) == 2) {
+	if (scan(CellularHelperIntField(n), CellularHelperIntField(stat)) == 2) {
 		// in case n=0
 		valid = true;
 	}
@@ -701,16 +946,13 @@ String CellularHelperCEREGResponse::toString() const {
 
 void CellularHelperPsmStatusResponse::postProcess() 
 {
-	if (string.endsWith("0"))
-	{
-		valid = true;
-		stat = 0;
-	}
-	else
-	if (string.endsWith("1"))
+	// +UUPSMR: <state>[,<param1>]
+	int state;
+
+	if (scan(CellularHelperIntField(state), CellularHelperFields::optional(CellularHelperSkipField())) >= 1 && (state == 0 || state == 1))
 	{
 		valid = true;
-		stat = 1;
+		stat = state;
 	}
 	else{
 		valid = false;
@@ -729,69 +971,304 @@ String CellularHelperPsmStatusResponse::toString() const {
 	}
 }
 
+String CellularHelperSignalSample::toString() const {
+	if (!valid) {
+		return "valid=false";
+	}
+	String result = String::format("rsrp=%d rsrq=%s%d.%d", rsrp, (rsrq < 0) ? "-" : "", abs(rsrq) / 10, abs(rsrq) % 10);
+	if (hasSinr) {
+		result += String::format(" sinr=%s%d.%d", (sinr < 0) ? "-" : "", abs(sinr) / 10, abs(sinr) % 10);
+	}
+	return result;
+}
+
+// Parses a decimal like "-3.40" or "13" into tenths, ignoring further digits
+static bool parseTenths(const char *str, const char *end, int &value, bool &hasPoint) {
+	const char *p = str;
+	bool negative = false;
+	int result = 0;
+	int digits = 0;
+
+	hasPoint = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+	while(p < end && *p >= '0' && *p <= '9') {
+		result = result * 10 + (*p++ - '0');
+		digits++;
+	}
+	result *= 10;
+	if (p < end && *p == '.') {
+		hasPoint = true;
+		p++;
+		if (p < end && *p >= '0' && *p <= '9') {
+			result += *p - '0';
+		}
+	}
+	if (digits == 0) {
+		return false;
+	}
+	value = negative ? -result : result;
+	return true;
+}
+
+int CellularHelperUCGEDResponse::parse(int type, const char *buf, int len) {
+	if (enableDebug) {
+		logCellularDebug(type, buf, len);
+	}
+
+	CellularHelperLineScanner scanner(buf, len);
+	const char *line;
+	size_t lineLen;
+
+	while(scanner.next(line, lineLen)) {
+		if (type == TYPE_PLUS) {
+			// +UCGED: 2 for LTE
+			if (CellularHelperLineScanner::skipPlusPrefix(line, lineLen, "UCGED", 5)) {
+				lte = (lineLen >= 1 && line[0] == '2');
+			}
+			continue;
+		}
+		if (type != TYPE_UNKNOWN || !lte) {
+			continue;
+		}
+
+		// Find fields BAND_FIELD and SINR_FIELD in the serving cell line, which is the only line that long
+		const char *end = line + lineLen;
+		const char *field = line;
+		const char *bandField = NULL;
+		for(int ii = 0; ii < SINR_FIELD && field; ii++) {
+			field = (const char *)memchr(field, ',', end - field);
+			if (field) {
+				field++;
+				if (ii + 1 == BAND_FIELD) {
+					bandField = field;
+				}
+			}
+		}
+		if (field) {
+			// Only trust the band if the line is long enough to be the serving cell
+			if (bandField) {
+				band = atoi(bandField);
+			}
+			const char *fieldEnd = (const char *)memchr(field, ',', end - field);
+			bool hasPoint;
+			int value;
+			if (parseTenths(field, fieldEnd ? fieldEnd : end, value, hasPoint) && hasPoint) {
+				sinr = value;
+				hasSinr = true;
+			}
+		}
+	}
+	return WAIT;
+}
+
+bool CellularHelperBandMask::has(int band) const {
+	if (band < 1 || band > MAX_BAND) {
+		return false;
+	}
+	return (band <= 64) ? ((mask1 >> (band - 1)) & 1) : ((mask2 >> (band - 65)) & 1);
+}
+
+void CellularHelperBandMask::add(int band) {
+	if (band >= 1 && band <= 64) {
+		mask1 |= (uint64_t)1 << (band - 1);
+	}
+	else
+	if (band >= 65 && band <= MAX_BAND) {
+		mask2 |= (uint64_t)1 << (band - 65);
+	}
+}
+
+void CellularHelperBandMask::remove(int band) {
+	if (band >= 1 && band <= 64) {
+		mask1 &= ~((uint64_t)1 << (band - 1));
+	}
+	else
+	if (band >= 65 && band <= MAX_BAND) {
+		mask2 &= ~((uint64_t)1 << (band - 65));
+	}
+}
+
+int CellularHelperBandMask::count() const {
+	int result = 0;
+	for(int band = 1; band <= MAX_BAND; band++) {
+		if (has(band)) {
+			result++;
+		}
+	}
+	return result;
+}
+
+CellularHelperBandMask CellularHelperBandMask::intersect(const CellularHelperBandMask &other) const {
+	CellularHelperBandMask result;
+	result.mask1 = mask1 & other.mask1;
+	result.mask2 = mask2 & other.mask2;
+	return result;
+}
+
+bool CellularHelperBandMask::parseList(const char *str) {
+	CellularHelperBandMask result;
+	const char *p = str;
+	while(*p) {
+		char *end;
+		long band = strtol(p, &end, 10);
+		if (end == p || band < 1 || band > MAX_BAND) {
+			return false;
+		}
+		result.add((int)band);
+		p = end;
+		if (*p == ',') {
+			p++;
+		}
+	}
+	*this = result;
+	return true;
+}
+
+String CellularHelperBandMask::toString() const {
+	String result;
+	for(int band = 1; band <= MAX_BAND; band++) {
+		if (has(band)) {
+			if (result.length() > 0) {
+				result += ",";
+			}
+			result += String(band);
+		}
+	}
+	return result;
+}
+
+// Formats value in decimal into buf (at least 21 bytes). The printf in newlib nano does not do %llu.
+static const char *formatU64(uint64_t value, char *buf) {
+	char *p = &buf[20];
+	*p = 0;
+	do {
+		*--p = (char)('0' + value % 10);
+		value /= 10;
+	} while(value != 0);
+	return p;
+}
+
 String CellularHelperClass::getManufacturer() const {
-	CellularHelperStringResponse resp;
+	char buf[STRING_RESULT_SIZE];
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CGMI\r\n");
+	getManufacturer(buf, sizeof(buf));
 
-	return resp.string;
+	return buf;
+}
+
+size_t CellularHelperClass::getManufacturer(char *buf, size_t bufSize) const {
+	CellularHelperBufferResponse resp(buf, bufSize);
+
+	command(&resp, DEFAULT_TIMEOUT, "AT+CGMI\r\n");
+
+	return resp.length;
 }
 
 String CellularHelperClass::getModel() const {
-	CellularHelperStringResponse resp;
+	char buf[STRING_RESULT_SIZE];
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CGMM\r\n");
+	getModel(buf, sizeof(buf));
 
-	return resp.string;
+	return buf;
+}
+
+size_t CellularHelperClass::getModel(char *buf, size_t bufSize) const {
+	CellularHelperBufferResponse resp(buf, bufSize);
+
+	command(&resp, DEFAULT_TIMEOUT, "AT+CGMM\r\n");
+
+	return resp.length;
 }
 
 String CellularHelperClass::getOrderingCode() const {
-	CellularHelperStringResponse resp;
+	char buf[STRING_RESULT_SIZE];
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "ATI0\r\n");
+	getOrderingCode(buf, sizeof(buf));
 
-	return resp.string;
+	return buf;
+}
+
+size_t CellularHelperClass::getOrderingCode(char *buf, size_t bufSize) const {
+	CellularHelperBufferResponse resp(buf, bufSize);
+
+	command(&resp, DEFAULT_TIMEOUT, "ATI0\r\n");
+
+	return resp.length;
 }
 
 String CellularHelperClass::getFirmwareVersion() const {
-	CellularHelperStringResponse resp;
+	char buf[STRING_RESULT_SIZE];
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CGMR\r\n");
+	getFirmwareVersion(buf, sizeof(buf));
 
-	return resp.string;
+	return buf;
+}
+
+size_t CellularHelperClass::getFirmwareVersion(char *buf, size_t bufSize) const {
+	CellularHelperBufferResponse resp(buf, bufSize);
+
+	command(&resp, DEFAULT_TIMEOUT, "AT+CGMR\r\n");
+
+	return resp.length;
 }
 
 String CellularHelperClass::getIMEI() const {
-	CellularHelperStringResponse resp;
+	char buf[STRING_RESULT_SIZE];
+
+	getIMEI(buf, sizeof(buf));
+
+	return buf;
+}
+
+size_t CellularHelperClass::getIMEI(char *buf, size_t bufSize) const {
+	CellularHelperBufferResponse resp(buf, bufSize);
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CGSN\r\n");
+	command(&resp, DEFAULT_TIMEOUT, "AT+CGSN\r\n");
 
-	return resp.string;
+	return resp.length;
 }
 
 String CellularHelperClass::getIMSI() const {
-	CellularHelperStringResponse resp;
+	char buf[STRING_RESULT_SIZE];
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CGMI\r\n");
+	getIMSI(buf, sizeof(buf));
 
-	return resp.string;
+	return buf;
+}
+
+size_t CellularHelperClass::getIMSI(char *buf, size_t bufSize) const {
+	CellularHelperBufferResponse resp(buf, bufSize);
+
+	command(&resp, DEFAULT_TIMEOUT, "AT+CGMI\r\n");
+
+	return resp.length;
 }
 
 String CellularHelperClass::getICCID() const {
-	CellularHelperPlusStringResponse resp;
-	resp.command = "CCID";
+	char buf[STRING_RESULT_SIZE];
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CCID\r\n");
+	getICCID(buf, sizeof(buf));
 
-	return resp.string;
+	return buf;
+}
+
+size_t CellularHelperClass::getICCID(char *buf, size_t bufSize) const {
+	CellularHelperPlusBufferResponse resp(buf, bufSize, "CCID");
+
+	command(&resp, DEFAULT_TIMEOUT, "AT+CCID\r\n");
+
+	return resp.length;
 }
 
 bool CellularHelperClass::isLTE() const {
-	String model;
+	char model[32];
 
-	model = getModel();
+	getModel(model, sizeof(model));
 
-	if(model.indexOf("SARA-R4") >= 0)
+	if(strstr(model, "SARA-R4") != NULL)
 		return true;
 	else
 		return false;
@@ -799,23 +1276,31 @@ bool CellularHelperClass::isLTE() const {
 
 
 String CellularHelperClass::getOperatorName(int operatorNameType) const {
-	String result;
+	char buf[STRING_RESULT_SIZE];
+
+	getOperatorName(buf, sizeof(buf), operatorNameType);
 
+	return buf;
+}
+
+size_t CellularHelperClass::getOperatorName(char *buf, size_t bufSize, int operatorNameType) const {
 	// The default is OPERATOR_NAME_LONG_EONS (9).
 	// If the EONS name is not available, then the other things tried in order are:
 	// NITZ, CPHS, ROM
 	// So basically, something will be returned
 
-	CellularHelperPlusStringResponse resp;
-	resp.command = "UDOPN";
+	CellularHelperPlusBufferResponse resp(buf, bufSize, "UDOPN");
 
-	int respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+UDOPN=%d\r\n", operatorNameType);
+	int respCode = command(&resp, DEFAULT_TIMEOUT, "AT+UDOPN=%d\r\n", operatorNameType);
 
-	if (respCode == RESP_OK) {
-		result = resp.getDoubleQuotedPart();
+	if (respCode != RESP_OK) {
+		if (bufSize > 0) {
+			buf[0] = 0;
+		}
+		return 0;
 	}
 
-	return result;
+	return resp.keepDoubleQuotedPart();
 }
 
 /**
@@ -827,7 +1312,7 @@ CellularHelperRSSIQualResponse CellularHelperClass::getRSSIQual() const {
 	CellularHelperRSSIQualResponse resp;
 	resp.command = "CSQ";
 
-	resp.resp = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CSQ\r\n");
+	resp.resp = command(&resp, DEFAULT_TIMEOUT, "AT+CSQ\r\n");
 
 	if (resp.resp == RESP_OK) {
 		resp.postProcess();
@@ -835,50 +1320,170 @@ CellularHelperRSSIQualResponse CellularHelperClass::getRSSIQual() const {
 
 	return resp;
 }
-/*
-bool CellularHelperClass::selectOperator(const char *mccMnc) const {
-	CellularHelperStringResponse resp;
+bool CellularHelperClass::getSignalSample(CellularHelperSignalSample &sample, bool includeSinr) const {
+	CellularHelperPlusFixedResponse<48> resp("CESQ");
+	int rxlev, ber, rscp, ecno, rsrq, rsrp;
+
+	sample.valid = false;
+	sample.hasSinr = false;
+	sample.timestamp = millis();
+
+	// +CESQ: <rxlev>,<ber>,<rscp>,<ecno>,<rsrq>,<rsrp>
+	resp.resp = command(&resp, DEFAULT_TIMEOUT, "AT+CESQ\r\n");
+	if (resp.resp == RESP_OK &&
+		resp.scan(CellularHelperIntField(rxlev), CellularHelperIntField(ber), CellularHelperIntField(rscp),
+			CellularHelperIntField(ecno), CellularHelperIntField(rsrq), CellularHelperIntField(rsrp)) == 6) {
+
+		// rsrq 0: less than -19.5 dB, 1..33 from -19.5 to -3.5 dB in 0.5 dB steps, 34: -3 dB or more
+		// rsrp 0: less than -140 dBm, 1..96 from -140 to -45 dBm, 97: -44 dBm or more
+		// 255 is not known or not detectable
+		if (rsrq <= 34 && rsrp <= 97) {
+			sample.rsrq = rsrq * 5 - 200;
+			sample.rsrp = rsrp - 141;
+			sample.valid = true;
+		}
+	}
+
+	if (includeSinr && sample.valid && enableUCGED()) {
+		CellularHelperUCGEDResponse ucged;
+		if (command(&ucged, DEFAULT_TIMEOUT, "AT+UCGED?\r\n") == RESP_OK && ucged.hasSinr) {
+			sample.sinr = ucged.sinr;
+			sample.hasSinr = true;
+		}
+	}
+
+	return sample.valid;
+}
+
+bool CellularHelperClass::getBandMask(int rat, CellularHelperBandMask &mask) const {
+	CellularHelperPlusStringResponse resp;
+	resp.command = "UBANDMASK";
+
+	if (command(&resp, DEFAULT_TIMEOUT, "AT+UBANDMASK?\r\n") != RESP_OK) {
+		return false;
+	}
+
+	// +UBANDMASK: <rat>,<bitmask1>[,<bitmask2>],<rat>,<bitmask1>[,<bitmask2>]
+	// Whether bitmask2 is present depends on the firmware version, so go by the number of values
+	uint64_t values[6];
+	size_t numValues = 0;
+	const char *p = resp.string.c_str();
+	while(*p && numValues < sizeof(values) / sizeof(values[0])) {
+		char *end;
+		values[numValues] = strtoull(p, &end, 10);
+		if (end == p) {
+			break;
+		}
+		numValues++;
+		p = end;
+		while(*p == ',' || *p == ' ') {
+			p++;
+		}
+	}
+
+	size_t stride;
+	if (numValues == 6 || numValues == 3) {
+		stride = 3;
+	}
+	else
+	if (numValues == 4 || numValues == 2) {
+		stride = 2;
+	}
+	else {
+		return false;
+	}
+
+	for(size_t ii = 0; ii + stride <= numValues; ii += stride) {
+		if ((int)values[ii] == rat) {
+			mask.mask1 = values[ii + 1];
+			mask.mask2 = (stride == 3) ? values[ii + 2] : 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool CellularHelperClass::setBandMask(int rat, const CellularHelperBandMask &mask) const {
+	char buf1[21], buf2[21];
+	int respCode;
+
+	if (mask.isEmpty()) {
+		// The modem rejects a mask with no bands
+		return false;
+	}
+
+	if (mask.mask2 != 0) {
+		respCode = command(NULL, DEFAULT_TIMEOUT, "AT+UBANDMASK=%d,%s,%s\r\n", rat,
+			formatU64(mask.mask1, buf1), formatU64(mask.mask2, buf2));
+	}
+	else {
+		respCode = command(NULL, DEFAULT_TIMEOUT, "AT+UBANDMASK=%d,%s\r\n", rat, formatU64(mask.mask1, buf1));
+	}
+	return (respCode == RESP_OK);
+}
+
+bool CellularHelperClass::enableUCGED() const {
+	if (ucgedMode == 0) {
+		ucgedMode = (command(NULL, DEFAULT_TIMEOUT, "AT+UCGED=5\r\n") == RESP_OK) ? 1 : -1;
+	}
+	return ucgedMode > 0;
+}
+
+int CellularHelperClass::getServingBand() const {
+	CellularHelperUCGEDResponse ucged;
+	if (!enableUCGED() || command(&ucged, DEFAULT_TIMEOUT, "AT+UCGED?\r\n") != RESP_OK || !ucged.lte) {
+		return 0;
+	}
+	return ucged.band;
+}
 
+bool CellularHelperClass::selectOperator(const char *mccMnc, int act) const {
 	int respCode;
 
 	if (mccMnc == NULL) {
 		// Reset back to automatic mode
-		respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+COPS=0\r\n");
+		respCode = command(NULL, DEFAULT_TIMEOUT, "AT+COPS=0\r\n");
 		return (respCode == RESP_OK);
 	}
 
-	String curMccMnc = CellularHelper.getOperatorName(0); // 0 = MCC/MNC
-	if (strcmp(mccMnc, curMccMnc.c_str()) == 0) {
+	char curMccMnc[16];
+	getOperatorName(curMccMnc, sizeof(curMccMnc), OPERATOR_NAME_NUMERIC);
+	if (strcmp(mccMnc, curMccMnc) == 0) {
 		// Operator already selected; nothing to do
 		Log.info("operator already %s", mccMnc);
 		return true;
 	}
 
-	if (curMccMnc.length() != 0) {
+	if (curMccMnc[0] != 0) {
 		// Disconnect from the current operator if there is an operator set.
 		// On cold boot there won't be a name set and the string will be empty
-		respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+COPS=2\r\n");
+		respCode = command(NULL, DEFAULT_TIMEOUT, "AT+COPS=2\r\n");
 	}
 
-	// Connect
-	respCode = Cellular.command(responseCallback, (void *)&resp, 60000, "AT+COPS=4,2,\"%s\"\r\n", mccMnc);
+	// Connect. Mode 4 is manual with automatic fallback, done by the modem if mccMnc is not found.
+	if (act >= 0) {
+		respCode = command(NULL, 60000, "AT+COPS=4,2,\"%s\",%d\r\n", mccMnc, act);
+	}
+	else {
+		respCode = command(NULL, 60000, "AT+COPS=4,2,\"%s\"\r\n", mccMnc);
+	}
 
 	return (respCode == RESP_OK);
 }
-*/
+
 bool CellularHelperClass::setRAT(int primary, int secondary) const {
 	CellularHelperStringResponse resp;
 
 	int respCode;
 
 	// deregister first
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+COPS=2\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+COPS=2\r\n");
 
 	// set RAT mode
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+URAT=%d,%d\r\n", primary, secondary);
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+URAT=%d,%d\r\n", primary, secondary);
 
 	// reregister
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+COPS=0\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+COPS=0\r\n");
 
 	return (respCode == RESP_OK);
 }
@@ -889,24 +1494,31 @@ bool CellularHelperClass::setRAT(int primary) const {
 	int respCode;
 
 	// deregister first
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+COPS=2\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+COPS=2\r\n");
 
 	// set RAT mode
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+URAT=%d\r\n", primary);
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+URAT=%d\r\n", primary);
 
 	// reregister
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+COPS=0\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+COPS=0\r\n");
 
 	return (respCode == RESP_OK);
 }
 
 String CellularHelperClass::getRAT() const {
-	CellularHelperPlusStringResponse resp;
-	resp.command = "URAT";
+	char buf[STRING_RESULT_SIZE];
+
+	getRAT(buf, sizeof(buf));
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+URAT?\r\n");
+	return buf;
+}
+
+size_t CellularHelperClass::getRAT(char *buf, size_t bufSize) const {
+	CellularHelperPlusBufferResponse resp(buf, bufSize, "URAT");
 
-	return resp.string;
+	command(&resp, DEFAULT_TIMEOUT, "AT+URAT?\r\n");
+
+	return resp.length;
 }
 
 bool CellularHelperClass::setMNO(int profile) const {
@@ -915,77 +1527,117 @@ bool CellularHelperClass::setMNO(int profile) const {
 	int respCode;
 
 	// deregister first
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+COPS=2\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+COPS=2\r\n");
 
 	// set RAT mode
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+UMNOPROF=%d\r\n", profile);
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+UMNOPROF=%d\r\n", profile);
 
 	// reregister
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
 
 	// turn off echo again, seems to reset with changing the mno?
-	//respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "ATE0\r\n");
+	//respCode = command(&resp, DEFAULT_TIMEOUT, "ATE0\r\n");
 
 	return (respCode == RESP_OK);
 }
 
 int CellularHelperClass::getMNO() const {
-	CellularHelperPlusStringResponse resp;
-	resp.command = "UMNOPROF";
+	char buf[16];
+	CellularHelperPlusBufferResponse resp(buf, sizeof(buf), "UMNOPROF");
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+UMNOPROF?\r\n");
+	command(&resp, DEFAULT_TIMEOUT, "AT+UMNOPROF?\r\n");
 
-	return atoi(resp.string);
+	return atoi(buf);
 }
 
 String CellularHelperClass::getCOPS() const
 {
-	CellularHelperPlusStringResponse resp;
-	resp.command = "COPS";
+	char buf[STRING_RESULT_SIZE];
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+COPS?\r\n");
-	
-	return resp.string;
+	getCOPS(buf, sizeof(buf));
+
+	return buf;
+}
+
+size_t CellularHelperClass::getCOPS(char *buf, size_t bufSize) const
+{
+	CellularHelperPlusBufferResponse resp(buf, bufSize, "COPS");
+
+	command(&resp, DEFAULT_TIMEOUT, "AT+COPS?\r\n");
+
+	return resp.length;
 }
 
 String CellularHelperClass::getCEREG() const
 {
-	CellularHelperPlusStringResponse resp;
-	resp.command = "CEREG";
+	char buf[STRING_RESULT_SIZE];
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CEREG?\r\n");
-	
-	return resp.string;
+	getCEREG(buf, sizeof(buf));
+
+	return buf;
+}
+
+size_t CellularHelperClass::getCEREG(char *buf, size_t bufSize) const
+{
+	CellularHelperPlusBufferResponse resp(buf, bufSize, "CEREG");
+
+	command(&resp, DEFAULT_TIMEOUT, "AT+CEREG?\r\n");
+
+	return resp.length;
 }
 
 String CellularHelperClass::getCREG() const
 {
-	CellularHelperPlusStringResponse resp;
-	resp.command = "CREG";
+	char buf[STRING_RESULT_SIZE];
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CREG?\r\n");
-	
-	return resp.string;
+	getCREG(buf, sizeof(buf));
+
+	return buf;
+}
+
+size_t CellularHelperClass::getCREG(char *buf, size_t bufSize) const
+{
+	CellularHelperPlusBufferResponse resp(buf, bufSize, "CREG");
+
+	command(&resp, DEFAULT_TIMEOUT, "AT+CREG?\r\n");
+
+	return resp.length;
 }
 
 String CellularHelperClass::getLocalPSMSettings() const
 {
-	CellularHelperPlusStringResponse resp;
-	resp.command = "CPSMS";
+	char buf[STRING_RESULT_SIZE];
+
+	getLocalPSMSettings(buf, sizeof(buf));
+
+	return buf;
+}
+
+size_t CellularHelperClass::getLocalPSMSettings(char *buf, size_t bufSize) const
+{
+	CellularHelperPlusBufferResponse resp(buf, bufSize, "CPSMS");
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CPSMS?\r\n");
+	command(&resp, DEFAULT_TIMEOUT, "AT+CPSMS?\r\n");
 
-	return resp.string;	
+	return resp.length;
 }
 
 String CellularHelperClass::getNetworkPSMSettings() const
 {
-	CellularHelperPlusStringResponse resp;
-	resp.command = "UCPSMS";
+	char buf[STRING_RESULT_SIZE];
 
-	Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+UCPSMS?\r\n");
-	
-	return resp.string;	
+	getNetworkPSMSettings(buf, sizeof(buf));
+
+	return buf;
+}
+
+size_t CellularHelperClass::getNetworkPSMSettings(char *buf, size_t bufSize) const
+{
+	CellularHelperPlusBufferResponse resp(buf, bufSize, "UCPSMS");
+
+	command(&resp, DEFAULT_TIMEOUT, "AT+UCPSMS?\r\n");
+
+	return resp.length;
 }
 
 bool CellularHelperClass::enterPSM() const
@@ -998,38 +1650,38 @@ bool CellularHelperClass::enterPSM() const
 		return false;
 
 	// set psm mode to network coordination mode only
-	tempResp = Cellular.command(DEFAULT_TIMEOUT, "AT+UPSMVER=4\r\n");
+	tempResp = command(NULL, DEFAULT_TIMEOUT, "AT+UPSMVER=4\r\n");
 
 	// reboot to enable psm mode
-	tempResp = Cellular.command(DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
+	tempResp = command(NULL, DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
 
 	// check psm mode
-	tempResp = Cellular.command(DEFAULT_TIMEOUT, "AT+UPSMVER?\r\n");
+	tempResp = command(NULL, DEFAULT_TIMEOUT, "AT+UPSMVER?\r\n");
 
 	// enable psm
 	// AT+CPSMS=1,,,"00100110","00000101"
 	// 6 hours for TAU
 	// 10 seconds for active time
-	tempResp = Cellular.command(DEFAULT_TIMEOUT, "AT+CPSMS=1,,,\"00100110\",\"00000101\"\r\n");
+	tempResp = command(NULL, DEFAULT_TIMEOUT, "AT+CPSMS=1,,,\"00100110\",\"00000101\"\r\n");
 
 	// enable radio connection status indication
-	tempResp = Cellular.command(DEFAULT_TIMEOUT, "AT+CSCON=1\r\n");
+	tempResp = command(NULL, DEFAULT_TIMEOUT, "AT+CSCON=1\r\n");
 
 	// enable psm indication
-	tempResp = Cellular.command(DEFAULT_TIMEOUT, "AT+UPSMR=1\r\n");
+	tempResp = command(NULL, DEFAULT_TIMEOUT, "AT+UPSMR=1\r\n");
 
 	// reboot
-	tempResp = Cellular.command(DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
+	tempResp = command(NULL, DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
 
 	// look for when the modem goes into psm mode, by looking for the +UUPSMR = 1 message
 	unsigned long startTime = millis();
 
-	while(millis() - startTime < 60000) 
+	while(millis() - startTime < 60000 && !abortRequested) 
 	{
 		delay(100);
 
 		// May have not received a response yet. Send an empty command so we can get responses
-		Cellular.command(responseCallback, (void *)&psm_resp, 500, "");
+		command(&psm_resp, 500, "");
 		psm_resp.postProcess();
 
 		if (psm_resp.valid && psm_resp.stat == 1)
@@ -1047,10 +1699,10 @@ bool CellularHelperClass::disablePSM() const
 	int respCode;
 
 	// turn off PSM functionality
-	resp.resp = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CPSMS=0\r\n");
+	resp.resp = command(&resp, DEFAULT_TIMEOUT, "AT+CPSMS=0\r\n");
 
 	// reboot
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
 
 	return (respCode == RESP_OK);	
 }
@@ -1068,12 +1720,12 @@ bool CellularHelperClass::exitPSM() const
 	// look for when the modem goes out of psm mode, by looking for the +UUPSMR = 0 message
 	unsigned long startTime = millis();
 
-	while(millis() - startTime < 30000) 
+	while(millis() - startTime < 30000 && !abortRequested) 
 	{
 		delay(100);
 
 		// May have not received a response yet. Send an empty command so we can get responses
-		Cellular.command(responseCallback, (void *)&resp, 500, "");
+		command(&resp, 500, "");
 		resp.postProcess();
 
 		if (resp.valid && resp.stat == 0)
@@ -1089,7 +1741,7 @@ bool CellularHelperClass::isModemRegistered() const
 	CellularHelperCEREGResponse reg;
 	getCEREG(reg);
 
-	Log.info("CEREG %s", reg.toString());
+	Log.info("CEREG %s", reg.toString().c_str());
 	
 	// check eps registration
 	if (!(reg.stat == 1 || reg.stat == 5))
@@ -1109,29 +1761,29 @@ bool CellularHelperClass::configureLTE() const
 		return(false);
 
 	// deregister first
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+COPS=2\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+COPS=2\r\n");
 
 	// set MNO mode
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+UMNOPROF=100\r\n");	// EU only!
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+UMNOPROF=100\r\n");	// EU only!
 
 	// reboot
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
 
 	// set RAT mode
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+URAT=7\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+URAT=7\r\n");
 
 	// reboot
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+CFUN=15\r\n");
 
 	// set PSM mode
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CPSMS=0\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+CPSMS=0\r\n");
 
 	// set EDRX mode
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CEDRXS=0\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+CEDRXS=0\r\n");
 
 
 	// reregister
-	respCode = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+COPS=0\r\n");
+	respCode = command(&resp, DEFAULT_TIMEOUT, "AT+COPS=0\r\n");
 
 	return (respCode == RESP_OK);	
 }
@@ -1140,7 +1792,7 @@ void CellularHelperClass::getEnvironment(int mode, CellularHelperEnvironmentResp
 	resp.command = "CGED";
 	// resp.enableDebug = true;
 
-	resp.resp = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CGED=%d\r\n", mode);
+	resp.resp = command(&resp, DEFAULT_TIMEOUT, "AT+CGED=%d\r\n", mode);
 	if (resp.resp == RESP_OK) {
 		resp.postProcess();
 	}
@@ -1154,11 +1806,11 @@ CellularHelperLocationResponse CellularHelperClass::getLocation(unsigned long ti
 	// resp.enableDebug = true;
 
 	// Initialize the mode
-	resp.resp = Cellular.command(5000, "AT+ULOCCELL=0\r\n");
+	resp.resp = command(NULL, 5000, "AT+ULOCCELL=0\r\n");
 	if (resp.resp == RESP_OK) {
 		unsigned long startTime = millis();
 
-		resp.resp = Cellular.command(responseCallback, (void *)&resp, timeoutMs, "AT+ULOC=2,2,0,%d,5000\r\n", timeoutMs / 1000);
+		resp.resp = command(&resp, timeoutMs, "AT+ULOC=2,2,0,%d,5000\r\n", timeoutMs / 1000);
 
 		// This command is weird because it returns an OK, and theoretically could return +UULOC response right away,
 		// but usually does not.
@@ -1167,14 +1819,14 @@ CellularHelperLocationResponse CellularHelperClass::getLocation(unsigned long ti
 
 			// In the case where we don't get an immediate response, we send empty commands to the
 			// modem to pick up the late +UULOC response
-			while(!resp.valid && millis() - startTime < timeoutMs) {
+			while(!resp.valid && millis() - startTime < timeoutMs && !abortRequested) {
 			//while(millis() - startTime < timeoutMs) {
 				// Allow for some cloud processing before checking again
 				delay(10);
 
 				// Have not received a response yet. Send an empty command so we can get responses that
 				// come afte the OK due to the weird structure of this command
-				Cellular.command(responseCallback, (void *)&resp, 500, "");
+				command(&resp, 500, "");
 				resp.postProcess();
 			}
 		}
@@ -1186,24 +1838,29 @@ CellularHelperLocationResponse CellularHelperClass::getLocation(unsigned long ti
 void CellularHelperClass::getCREG(CellularHelperCREGResponse &resp) const {
 	int tempResp;
 
-	tempResp = Cellular.command(DEFAULT_TIMEOUT, "AT+CREG=2\r\n");
+	tempResp = command(NULL, DEFAULT_TIMEOUT, "AT+CREG=2\r\n");
 	if (tempResp == RESP_OK) {
 		resp.command = "CREG";
-		resp.resp = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CREG?\r\n");
+		resp.resp = command(&resp, DEFAULT_TIMEOUT, "AT+CREG?\r\n");
 		if (resp.resp == RESP_OK) {
 			resp.postProcess();
 
 			// Set back to default
-			tempResp = Cellular.command(DEFAULT_TIMEOUT, "AT+CREG=0\r\n");
+			tempResp = command(NULL, DEFAULT_TIMEOUT, "AT+CREG=0\r\n");
 		}
 	}
 }
 
-void CellularHelperClass::getCEREG(CellularHelperCEREGResponse &resp) const {
-	int tempResp;
+void CellularHelperClass::getCEREG(CellularHelperCEREGResponse &resp, bool fresh) const {
+	CellularHelperCommandRequest req;
+
+	req.command = "AT+CEREG?\r\n";
+	req.resp = &resp;
+	req.timeoutMs = DEFAULT_TIMEOUT;
+	req.noCache = fresh;
 
 	resp.command = "CEREG";
-	resp.resp = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+CEREG?\r\n");
+	resp.resp = queue.submit(req);
 	if (resp.resp == RESP_OK) {
 		resp.postProcess();
 	}
@@ -1212,7 +1869,7 @@ void CellularHelperClass::getCEREG(CellularHelperCEREGResponse &resp) const {
 bool CellularHelperClass::ping(const char *addr) const {
 	CellularHelperStringResponse resp;
 
-	resp.resp = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+UPING=\"%s\"\r\n", addr);
+	resp.resp = command(&resp, DEFAULT_TIMEOUT, "AT+UPING=\"%s\"\r\n", addr);
 
 	return resp.resp == RESP_OK;
 }
@@ -1220,14 +1877,14 @@ bool CellularHelperClass::ping(const char *addr) const {
 IPAddress CellularHelperClass::dnsLookup(const char *hostname) const {
 	IPAddress result;
 
-	CellularHelperPlusStringResponse resp;
-	resp.command = "UDNSRN";
+	char buf[64];
+	CellularHelperPlusBufferResponse resp(buf, sizeof(buf), "UDNSRN");
 
-	resp.resp = Cellular.command(responseCallback, (void *)&resp, DEFAULT_TIMEOUT, "AT+UDNSRN=0,\"%s\"\r\n", hostname);
+	resp.resp = command(&resp, DEFAULT_TIMEOUT, "AT+UDNSRN=0,\"%s\"\r\n", hostname);
 	if (resp.resp == RESP_OK) {
-		String quotedPart = resp.getDoubleQuotedPart();
+		resp.keepDoubleQuotedPart();
 		int addr[4];
-		if (sscanf(quotedPart.c_str(), "%u.%u.%u.%u", &addr[0], &addr[1], &addr[2], &addr[3]) == 4) {
+		if (sscanf(buf, "%u.%u.%u.%u", &addr[0], &addr[1], &addr[2], &addr[3]) == 4) {
 			result = IPAddress(addr[0], addr[1], addr[2], addr[3]);
 		}
 	}
@@ -1238,6 +1895,137 @@ IPAddress CellularHelperClass::dnsLookup(const char *hostname) const {
 
 
 
+int CellularHelperClass::command(CellularHelperCommonResponse *resp, system_tick_t timeoutMs, const char *format, ...) const {
+	va_list ap;
+	va_start(ap, format);
+	int result = vcommand(resp, timeoutMs, format, ap);
+	va_end(ap);
+
+	return result;
+}
+
+int CellularHelperClass::vcommand(CellularHelperCommonResponse *resp, system_tick_t timeoutMs, const char *format, va_list ap) const {
+	CellularHelperCommandRequest req;
+
+	va_list apCopy;
+	va_copy(apCopy, ap);
+	int len = vsnprintf(req.cmd, sizeof(req.cmd), format, ap);
+	req.resp = resp;
+	req.timeoutMs = timeoutMs;
+
+	char *longCmd = NULL;
+	if (len >= (int)sizeof(req.cmd)) {
+		// A truncated command would lose its \r\n and leave the modem waiting for the rest of the
+		// line, so format long commands such as AT+UDNSRN with a long hostname on the heap
+		longCmd = (char *)malloc(len + 1);
+		if (longCmd) {
+			vsnprintf(longCmd, len + 1, format, apCopy);
+			req.command = longCmd;
+		}
+	}
+	va_end(apCopy);
+
+	int result = RESP_ERROR;
+	if (len >= 0 && (len < (int)sizeof(req.cmd) || longCmd)) {
+		result = queue.submit(req);
+	}
+	free(longCmd);
+
+	return result;
+}
+
+int CellularHelperClass::rawCommand(CellularHelperCommonResponse *resp, system_tick_t timeoutMs, const char *cmd, bool whileReserved) const {
+	CellularHelperCommandRequest req;
+
+	req.command = cmd;
+	req.resp = resp;
+	req.timeoutMs = timeoutMs;
+	req.whileReserved = whileReserved;
+
+	return queue.submit(req);
+}
+
+int CellularHelperClass::pollURCs(system_tick_t timeoutMs) const {
+	// An empty command lets the modem parser pass any URCs received since the last command to
+	// responseCallback
+	return command(NULL, timeoutMs, "");
+}
+
+bool CellularHelperClass::addURCHandler(const char *prefix, URCHandler fn, void *context) const {
+	for(size_t ii = 0; ii < MAX_URC_HANDLERS; ii++) {
+		URCHandlerEntry &entry = urcHandlers[ii];
+		if (entry.fn == NULL || (entry.fn == fn && entry.context == context && strcmp(entry.prefix, prefix) == 0)) {
+			entry.prefix = prefix;
+			entry.prefixLen = strlen(prefix);
+			entry.context = context;
+			// Set last, responseCallback skips entries without fn
+			entry.fn = fn;
+			return true;
+		}
+	}
+	return false;
+}
+
+void CellularHelperClass::removeURCHandler(const char *prefix, URCHandler fn, void *context) const {
+	for(size_t ii = 0; ii < MAX_URC_HANDLERS; ii++) {
+		URCHandlerEntry &entry = urcHandlers[ii];
+		if (entry.fn == fn && entry.context == context && strcmp(entry.prefix, prefix) == 0) {
+			entry.fn = NULL;
+		}
+	}
+}
+
+void CellularHelperClass::dispatchURCs(const char *buf, int len) const {
+	CellularHelperLineScanner scanner(buf, len);
+	const char *line;
+	size_t lineLen;
+
+	while(scanner.next(line, lineLen)) {
+		for(size_t ii = 0; ii < MAX_URC_HANDLERS; ii++) {
+			const URCHandlerEntry &entry = urcHandlers[ii];
+			URCHandler fn = entry.fn;
+			if (fn == NULL) {
+				continue;
+			}
+			const char *value = line;
+			size_t valueLen = lineLen;
+			if (CellularHelperLineScanner::skipPlusPrefix(value, valueLen, entry.prefix, entry.prefixLen)) {
+				fn(value, valueLen, entry.context);
+			}
+		}
+	}
+}
+
+int CellularHelperClass::execute(CellularHelperCommandRequest &req) const {
+	int result;
+
+	bool cacheable = CellularHelperCommandQueue::isCacheable(req.command);
+	if (cacheable && !req.noCache && queue.replayCached(req.command, req.resp, result)) {
+		// Answered from a recent identical query, possibly one that was in flight when this was submitted
+		return result;
+	}
+	if (queue.refuseWhileReserved(req)) {
+		// Sending anything now would abort the command the modem is reserved for
+		return RESP_ABORTED;
+	}
+	if (CellularHelperCommandQueue::isSetCommand(req.command)) {
+		// Modem state, or the format of later query answers, is about to change
+		queue.invalidateCache();
+	}
+
+	if (transcript.isEnabled() && req.command[0]) {
+		transcript.addCommand(req.command, strlen(req.command));
+	}
+
+	queue.beginCapture(cacheable ? req.command : NULL);
+
+	result = Cellular.command(responseCallback, (void *)req.resp, req.timeoutMs, "%s", req.command);
+
+	queue.endCapture(result);
+
+	return result;
+}
+
 // There isn't an overload of String that takes a buffer and length, but that's what comes back from
 // the Cellular.command callback, so that's why this method exists.
 void CellularHelperClass::appendBufferToString(String &str, const char *buf, int len, bool noEOL) const {
@@ -1267,6 +2055,19 @@ int CellularHelperClass::rssiToBars(int rssi) {
 int CellularHelperClass::responseCallback(int type, const char* buf, int len, void *param) {
 	CellularHelperCommonResponse *presp = (CellularHelperCommonResponse *)param;
 
+	if (CellularHelper.transcript.isEnabled()) {
+		CellularHelper.transcript.addResponse(type, buf, len);
+	}
+	CellularHelper.queue.capture(type, buf, len);
+
+	if (type == TYPE_PLUS) {
+		CellularHelper.dispatchURCs(buf, len);
+	}
+
+	if (!presp) {
+		// Caller only wants the result code
+		return WAIT;
+	}
 	return presp->parse(type, buf, len);
 }
 
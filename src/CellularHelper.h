@@ -2,12 +2,162 @@
 #define __CELLULARHELPER_H
 
 #include "Particle.h"
+#include "CellularHelperTranscript.h"
+#include "CellularHelperCommandQueue.h"
 
 #if Wiring_Cellular
 
 
 // Class for quering infromation directly from the ublox SARA modem
 
+/**
+ * Walks the \r\n separated lines in a buffer passed to a Cellular.command callback without
+ * copying or modifying it. Empty lines are skipped.
+ *
+ * Line ends are located with memchr, which newlib implements a word at a time, instead of
+ * testing every byte against the delimiter set like strtok_r does.
+ */
+class CellularHelperLineScanner {
+public:
+	CellularHelperLineScanner(const char *buf, size_t len);
+
+	/**
+	 * Returns the next non-empty line, or false if there are no more. The line is not
+	 * null terminated; use lineLen.
+	 */
+	bool next(const char *&line, size_t &lineLen);
+
+	/**
+	 * Returns true if line starts with the +CMD: prefix for command, for example "+CSQ: ".
+	 * If it does, line and lineLen are advanced past the prefix.
+	 */
+	static bool skipPlusPrefix(const char *&line, size_t &lineLen, const char *command, size_t commandLen);
+
+protected:
+	const char *cur;
+	const char *end;
+};
+
+/**
+ * Field descriptors for CellularHelperFields::scan(). Each holds a reference to where the
+ * value is stored and knows how to parse one comma-separated field of a + response.
+ */
+
+// Decimal integer: 17
+class CellularHelperIntField {
+public:
+	explicit CellularHelperIntField(int &value) : value(value) {}
+	bool scan(const char *&p) const;
+	static const bool optional = false;
+	int &value;
+};
+
+// Hex integer in double quotes: "3a9b". Values up to 0xFFFFFFFF are stored as int.
+class CellularHelperHexQuotedField {
+public:
+	explicit CellularHelperHexQuotedField(int &value) : value(value) {}
+	bool scan(const char *&p) const;
+	static const bool optional = false;
+	int &value;
+};
+
+// String, with or without double quotes: "Telenor" or 24201. Truncated to fit buf.
+class CellularHelperStringField {
+public:
+	CellularHelperStringField(char *buf, size_t bufSize) : buf(buf), bufSize(bufSize) {}
+	bool scan(const char *&p) const;
+	static const bool optional = false;
+	char *buf;
+	size_t bufSize;
+};
+
+// Field whose value is not needed
+class CellularHelperSkipField {
+public:
+	bool scan(const char *&p) const;
+	static const bool optional = false;
+};
+
+// Field that may be empty (two commas in a row) or missing from the end of the response.
+// The value is left unchanged if it's not there.
+template<class F>
+class CellularHelperOptionalField {
+public:
+	explicit CellularHelperOptionalField(const F &field) : field(field) {}
+	bool scan(const char *&p) const {
+		if (*p == ',' || *p == 0) {
+			return true;
+		}
+		return field.scan(p);
+	}
+	static const bool optional = true;
+	F field;
+};
+
+/**
+ * Parses the comma-separated fields of a + response, for example the "2,1,\"3a9b\",\"0000c33d\",7"
+ * part of a +CEREG response, into typed values:
+ *
+ * int n, stat, lac, ci, rat;
+ * CellularHelperFields::scan(str, CellularHelperIntField(n), CellularHelperIntField(stat),
+ *     CellularHelperHexQuotedField(lac), CellularHelperHexQuotedField(ci), CellularHelperIntField(rat));
+ *
+ * The field list is expanded at compile time into a straight sequence of field parsers, with no
+ * format string to interpret and no allocation. Returns the number of fields parsed, stopping
+ * at the first one that does not match, like sscanf.
+ */
+class CellularHelperFields {
+public:
+	template<class... Fields>
+	static int scan(const char *str, const Fields&... fields) {
+		const char *p = str;
+		return scanNext(p, true, fields...);
+	}
+
+	template<class F>
+	static CellularHelperOptionalField<F> optional(const F &field) {
+		return CellularHelperOptionalField<F>(field);
+	}
+
+	/**
+	 * Bounded scanners for values that are not null terminated, such as the value passed to a
+	 * URCHandler. Each reads one field at p, stopping at end, and skips the comma after it.
+	 */
+	static bool scanInt(const char *&p, const char *end, int &value);
+
+	// Double quoted string; str and len are set to the part between the quotes
+	static bool scanQuoted(const char *&p, const char *end, const char *&str, size_t &len);
+
+	// Double quoted string copied into buf, truncated to fit
+	static bool scanQuoted(const char *&p, const char *end, char *buf, size_t bufSize);
+
+protected:
+	static int scanNext(const char *&, bool) {
+		return 0;
+	}
+
+	template<class F, class... Rest>
+	static int scanNext(const char *&p, bool first, const F &field, const Rest&... rest) {
+		if (!first) {
+			if (*p == ',') {
+				p++;
+			}
+			else
+			if (F::optional && *p == 0) {
+				// Optional field missing from the end
+				return 1 + scanNext(p, false, rest...);
+			}
+			else {
+				return 0;
+			}
+		}
+		if (!field.scan(p)) {
+			return 0;
+		}
+		return 1 + scanNext(p, false, rest...);
+	}
+};
+
 /**
  * All response objects inherit from this, so the parse() method can be called
  * in the subclass, and also the resp and enableDebug members are always available.
@@ -35,6 +185,74 @@ public:
 	virtual int parse(int type, const char *buf, int len);
 };
 
+/**
+ * Like CellularHelperStringResponse, but the result is stored in a caller-provided buffer
+ * instead of a String, so no heap allocation is done.
+ *
+ * The buffer is always null terminated. length is the length of the complete result, even
+ * if it did not fit; if length >= bufSize the result was truncated.
+ */
+class CellularHelperBufferResponse : public CellularHelperCommonResponse {
+public:
+	CellularHelperBufferResponse(char *buf, size_t bufSize);
+
+	char *buf;
+	size_t bufSize;
+	size_t length = 0;
+
+	virtual int parse(int type, const char *buf, int len);
+
+	void append(const char *data, size_t len, bool noEOL = true);
+	bool isTruncated() const { return length >= bufSize; }
+};
+
+/**
+ * Like CellularHelperPlusStringResponse, but the result is stored in a caller-provided buffer.
+ * command is the part between the + and the :, for example "CSQ", and must remain valid
+ * until the command completes.
+ */
+class CellularHelperPlusBufferResponse : public CellularHelperBufferResponse {
+public:
+	CellularHelperPlusBufferResponse(char *buf, size_t bufSize, const char *command);
+
+	const char *command;
+
+	virtual int parse(int type, const char *buf, int len);
+
+	/**
+	 * Replaces the contents of the buffer with the double quoted part, like
+	 * CellularHelperPlusStringResponse::getDoubleQuotedPart(). Returns the new length.
+	 */
+	size_t keepDoubleQuotedPart(bool onlyFirst = true);
+};
+
+/**
+ * A + response held in a fixed-size buffer inside the object, for commands that are parsed
+ * into typed fields. Adding a new command is a declaration plus a scan() call:
+ *
+ * CellularHelperPlusFixedResponse<32> resp("CSQ");
+ * CellularHelper.command(&resp, CellularHelperClass::DEFAULT_TIMEOUT, "AT+CSQ\r\n");
+ * resp.scan(CellularHelperIntField(rssi), CellularHelperIntField(qual));
+ */
+template<size_t N>
+class CellularHelperPlusFixedResponse : public CellularHelperPlusBufferResponse {
+public:
+	explicit CellularHelperPlusFixedResponse(const char *command) : CellularHelperPlusBufferResponse(storage, N, command) {
+	}
+
+	// buf points at storage, so copies would share it
+	CellularHelperPlusFixedResponse(const CellularHelperPlusFixedResponse &) = delete;
+	CellularHelperPlusFixedResponse &operator=(const CellularHelperPlusFixedResponse &) = delete;
+
+	template<class... Fields>
+	int scan(const Fields&... fields) const {
+		return CellularHelperFields::scan(storage, fields...);
+	}
+
+protected:
+	char storage[N];
+};
+
 /**
  * Things that return a + response and a string use this.
  *
@@ -48,6 +266,14 @@ public:
 
 	virtual int parse(int type, const char *buf, int len);
 	String getDoubleQuotedPart(bool onlyFirst = true) const;
+
+	/**
+	 * Parses string into typed fields, see CellularHelperFields::scan()
+	 */
+	template<class... Fields>
+	int scan(const Fields&... fields) const {
+		return CellularHelperFields::scan(string.c_str(), fields...);
+	}
 };
 
 /**
@@ -88,6 +314,7 @@ public:
 
 	bool isValid(bool ignoreCI = false) const;
 	void parse(const char *str);
+	void parse(const char *str, size_t len);
 	void addKeyValue(const char *key, const char *value);
 	String toString() const;
 
@@ -183,8 +410,86 @@ public:
 	String toString() const;
 };
 
+/**
+ * One LTE signal measurement from AT+CESQ, plus SINR from AT+UCGED when the modem reports it.
+ *
+ * rsrp is in dBm. rsrq and sinr are in tenths of a dB, so -105 is -10.5 dB.
+ */
+class CellularHelperSignalSample {
+public:
+	bool valid = false;			// rsrp and rsrq are set
+	int rsrp = 0;
+	int rsrq = 0;
+	bool hasSinr = false;
+	int sinr = 0;
+	system_tick_t timestamp = 0;	// millis() when measured
+
+	String toString() const;
+};
+
+/**
+ * Picks the SINR and band out of the AT+UCGED? response in mode 5 (SARA-R4, LTE). Best effort:
+ * the field layout differs between modem firmware versions, so hasSinr is only set if the LTE
+ * serving cell line has a value with a decimal point in the Lsinr position.
+ */
+class CellularHelperUCGEDResponse : public CellularHelperCommonResponse {
+public:
+	bool lte = false;
+	bool hasSinr = false;
+	int sinr = 0;		// tenths of a dB
+	int band = 0;		// LTE band of the serving cell, 0 if unknown
+
+	virtual int parse(int type, const char *buf, int len);
+
+	// Field indexes of Lband and Lsinr in the LTE serving cell line
+	static const int BAND_FIELD = 1;
+	static const int SINR_FIELD = 12;
+};
+
+/**
+ * A set of LTE bands, as used by AT+UBANDMASK. Bit n - 1 of mask1 is band n for bands 1 to 64;
+ * mask2 holds bands 65 to 128.
+ */
+class CellularHelperBandMask {
+public:
+	uint64_t mask1 = 0;
+	uint64_t mask2 = 0;
+
+	static const int MAX_BAND = 128;
+
+	bool has(int band) const;
+	void add(int band);
+	void remove(int band);
+	bool isEmpty() const { return mask1 == 0 && mask2 == 0; }
+	int count() const;
+
+	/**
+	 * Bands in both this and other
+	 */
+	CellularHelperBandMask intersect(const CellularHelperBandMask &other) const;
+
+	bool operator==(const CellularHelperBandMask &other) const { return mask1 == other.mask1 && mask2 == other.mask2; }
+	bool operator!=(const CellularHelperBandMask &other) const { return !(*this == other); }
+
+	/**
+	 * Parses a comma separated list of band numbers such as "3,8,20". Returns false if any
+	 * band is out of range.
+	 */
+	bool parseList(const char *str);
+
+	/**
+	 * The bands as a comma separated list, for example "3,8,20"
+	 */
+	String toString() const;
+};
+
 /**
  * Class for calling the u-blox SARA modem directly
+ *
+ * The methods that return a String also have an overload that takes a caller-provided buffer
+ * and does not allocate from the heap. It returns the length of the complete result, like
+ * snprintf; if that is >= bufSize the result was truncated. The buffer is always null
+ * terminated. The String versions are wrappers around these.
  */
 class CellularHelperClass {
 public:
@@ -192,37 +497,44 @@ public:
 	 * Returns a string, typically "u-blox"
 	 */
 	String getManufacturer() const;
+	size_t getManufacturer(char *buf, size_t bufSize) const;
 
 	/**
 	 * Returns a string like "SARA-G350", "SARA-U260" or "SARA-U270"
 	 *
 	 */
 	String getModel() const;
+	size_t getModel(char *buf, size_t bufSize) const;
 
 	/**
 	 * Returns a tring like "SARA-U260-00S-00".
 	 */
 	String getOrderingCode() const;
+	size_t getOrderingCode(char *buf, size_t bufSize) const;
 
 	/**
 	 * Returns a string like "23.20"
 	 */
 	String getFirmwareVersion() const;
+	size_t getFirmwareVersion(char *buf, size_t bufSize) const;
 
 	/**
 	 * Returns the IMEI for the modem
 	 */
 	String getIMEI() const;
+	size_t getIMEI(char *buf, size_t bufSize) const;
 
 	/**
 	 * Returns the IMSI for the modem
 	 */
 	String getIMSI() const;
+	size_t getIMSI(char *buf, size_t bufSize) const;
 
 	/**
 	 * Returns the IMEI for the SIM card
 	 */
 	String getICCID() const;
+	size_t getICCID(char *buf, size_t bufSize) const;
 
 	/**
 	 * Returns true if the device is LTE (SARA-R4 at this time)
@@ -233,6 +545,7 @@ public:
 	 * Returns the operator name string, something like "AT&T" or "T-Mobile" in the United States.
 	 */
 	String getOperatorName(int operatorNameType = OPERATOR_NAME_LONG_EONS) const;
+	size_t getOperatorName(char *buf, size_t bufSize, int operatorNameType = OPERATOR_NAME_LONG_EONS) const;
 
 	/**
 	 * Get the RSSI and qual values for the receiving cell site.
@@ -241,6 +554,13 @@ public:
 	 */
 	CellularHelperRSSIQualResponse getRSSIQual() const;
 
+	/**
+	 * Get LTE RSRP and RSRQ (AT+CESQ) and, if includeSinr is true and the modem supports it,
+	 * SINR (AT+UCGED). Returns sample.valid. The AT+CSQ RSSI scale is meant for 2G/3G and says
+	 * little about LTE Cat M1 link quality; use this instead on SARA-R4.
+	 */
+	bool getSignalSample(CellularHelperSignalSample &sample, bool includeSinr = true) const;
+
 	/**
 	 * @brief Select the mobile operator (in areas where more than 1 carrier is supported by the SIM)
 	 *
@@ -259,31 +579,72 @@ public:
 	 *
 	 * Omitting the mccMnc parameter or passing NULL will reset the default automatic mode.
 	 *
+	 * act is the access technology for AT+COPS, for example 7 for LTE Cat M1 on the SARA-R4, or -1
+	 * to let the modem choose.
+	 *
 	 * This setting is stored in the modem but reset on power down, so you should reset it from setup().
 	 */
-	//bool selectOperator(const char *mccMnc = NULL) const;
+	bool selectOperator(const char *mccMnc = NULL, int act = -1) const;
+
+	static const int BANDMASK_RAT_CATM1 = 0;
+	static const int BANDMASK_RAT_NBIOT = 1;
+
+	/**
+	 * Reads the bands the modem searches for rat (BANDMASK_RAT_CATM1 or BANDMASK_RAT_NBIOT)
+	 * with AT+UBANDMASK? (SARA-R4).
+	 */
+	bool getBandMask(int rat, CellularHelperBandMask &mask) const;
+
+	/**
+	 * Sets the bands the modem searches for rat. Fewer bands make network searches faster.
+	 * Stored in the modem; takes effect after the modem restarts (AT+CFUN=15 or power cycle).
+	 */
+	bool setBandMask(int rat, const CellularHelperBandMask &mask) const;
+
+	/**
+	 * Gets the LTE band of the serving cell from AT+UCGED (SARA-R4), or 0 if unknown
+	 */
+	int getServingBand() const;
 
 	bool setRAT(int primary, int secondary) const;
 	bool setRAT(int primary) const;
 	String getRAT() const;
+	size_t getRAT(char *buf, size_t bufSize) const;
 
 	bool setMNO(int profile) const;
 	int getMNO() const;
 
 	String getLocalPSMSettings() const;
+	size_t getLocalPSMSettings(char *buf, size_t bufSize) const;
 	String getNetworkPSMSettings() const;
+	size_t getNetworkPSMSettings(char *buf, size_t bufSize) const;
 
 	bool enterPSM() const;
 	bool disablePSM() const;
 	bool exitPSM() const;
 
+	/**
+	 * Makes the wait loops in enterPSM(), exitPSM() and getLocation() return early, as if they
+	 * timed out. Can be called from any thread. Stays set until clearAbort().
+	 */
+	void requestAbort() const { abortRequested = true; }
+	void clearAbort() const { abortRequested = false; }
+	bool isAbortRequested() const { return abortRequested; }
+
 	bool configureLTE() const;
 
 	String getCOPS() const;
+	size_t getCOPS(char *buf, size_t bufSize) const;
 	String getCEREG() const;
+	size_t getCEREG(char *buf, size_t bufSize) const;
 	String getCREG() const;
+	size_t getCREG(char *buf, size_t bufSize) const;
 
-	void getCEREG(CellularHelperCEREGResponse &resp) const;
+	/**
+	 * Gets the parsed AT+CEREG? response. If fresh is true the modem is always asked instead of
+	 * reusing a cached answer, for polls that time a state change.
+	 */
+	void getCEREG(CellularHelperCEREGResponse &resp, bool fresh = false) const;
 
 	bool isModemRegistered() const;
 
@@ -325,6 +686,52 @@ public:
 	 */
 	IPAddress dnsLookup(const char *hostname) const;
 
+	/**
+	 * Used internally to send a command to the modem. Works like Cellular.command, but the
+	 * command is formatted here so it can be recorded in the transcript. resp may be NULL
+	 * if the response does not need to be parsed. A command longer than
+	 * CellularHelperCommandRequest::COMMAND_SIZE is formatted into a heap buffer instead, and
+	 * RESP_ERROR is returned if that cannot be allocated.
+	 */
+	int command(CellularHelperCommonResponse *resp, system_tick_t timeoutMs, const char *format, ...) const;
+	int vcommand(CellularHelperCommonResponse *resp, system_tick_t timeoutMs, const char *format, va_list ap) const;
+
+	/**
+	 * Like command(), but cmd is already formatted, including the \r\n, and can be longer than
+	 * MAX_COMMAND_LEN. Used for commands carrying data, such as AT+USOST. cmd must remain valid
+	 * until the call returns. Set whileReserved for the commands of the owner of a
+	 * queue.reserve().
+	 */
+	int rawCommand(CellularHelperCommonResponse *resp, system_tick_t timeoutMs, const char *cmd, bool whileReserved = false) const;
+
+	/**
+	 * Called with the part after "+PREFIX: " of each matching + line received, whether it is a
+	 * response or an unsolicited result code. Called on the modem worker thread from inside the
+	 * Cellular.command callback, so it must not send modem commands; record what is needed and
+	 * act on it later.
+	 */
+	typedef void (*URCHandler)(const char *value, size_t valueLen, void *context);
+
+	static const size_t MAX_URC_HANDLERS = 8;
+
+	/**
+	 * Adds a handler for + lines starting with prefix, for example "UUSORF". prefix must remain
+	 * valid. Returns false if the table is full.
+	 */
+	bool addURCHandler(const char *prefix, URCHandler fn, void *context = NULL) const;
+	void removeURCHandler(const char *prefix, URCHandler fn, void *context = NULL) const;
+
+	/**
+	 * URCs are only seen while a command is running. This sends an empty command so URCs that
+	 * arrived while the modem was idle are passed to the handlers.
+	 */
+	int pollURCs(system_tick_t timeoutMs = 500) const;
+
+	/**
+	 * Used internally by the modem owner (see CellularHelperCommandQueue) to run one command
+	 */
+	int execute(CellularHelperCommandRequest &req) const;
+
 	/**
 	 * Used internally to add data to a String object with buffer and length,
 	 * which is not one of the built-in overloads for String. This format is
@@ -356,10 +763,48 @@ public:
 	static const int OPERATOR_NAME_LONG_NETWORK_OPERATOR = 12;
 
 
+	// Maximum length of a formatted command, including the \r\n
+	static const size_t MAX_COMMAND_LEN = CellularHelperCommandRequest::COMMAND_SIZE;
+
+	// Size of the buffer used by the String-returning getters
+	static const size_t STRING_RESULT_SIZE = 128;
+
 	static int responseCallback(int type, const char* buf, int len, void *param);
 
 	static int rssiToBars(int rssi);
 
+	/**
+	 * Records every command sent and response received when enabled with transcript.begin()
+	 */
+	mutable CellularHelperTranscript transcript;
+
+	/**
+	 * Runs all modem commands on one worker thread, by priority, and shares recent query results
+	 * between callers. Use queue.setFreshness() to change how long query results are reused
+	 * (default 2 seconds).
+	 */
+	mutable CellularHelperCommandQueue queue;
+
+protected:
+	mutable volatile bool abortRequested = false;
+
+	// Sets AT+UCGED=5 the first time; returns false if the modem does not support it
+	bool enableUCGED() const;
+
+	// AT+UCGED=5 state: 0 not set yet, 1 set, -1 not supported by this modem
+	mutable int8_t ucgedMode = 0;
+
+	class URCHandlerEntry {
+	public:
+		const char *prefix = NULL;
+		size_t prefixLen = 0;
+		void *context = NULL;
+		URCHandler volatile fn = NULL;
+	};
+
+	void dispatchURCs(const char *buf, int len) const;
+
+	mutable URCHandlerEntry urcHandlers[MAX_URC_HANDLERS];
 
 };
 
@@ -0,0 +1,316 @@
+#include "CellularHelperBenchmark.h"
+
+#if Wiring_Cellular
+
+#include <malloc.h>
+
+// Responses as captured from a SARA-R410M-02B on Telenor Norway, plus AT+CGED output from a
+// SARA-G350 since the R410M does not support that command
+const CellularHelperCorpusEntry CellularHelperBenchmark::corpus[] = {
+	{ "cgmi", PARSER_STRING, "", TYPE_UNKNOWN, "\r\nu-blox\r\n" },
+	{ "cgmm", PARSER_STRING, "", TYPE_UNKNOWN, "\r\nSARA-R410M-02B\r\n" },
+	{ "cgmr", PARSER_STRING, "", TYPE_UNKNOWN, "\r\nL0.0.00.00.05.08 [Apr 17 2019 19:34:02]\r\n" },
+	{ "ccid", PARSER_PLUS_STRING, "CCID", TYPE_PLUS, "\r\n+CCID: 89470000000000000000\r\n" },
+	{ "urat", PARSER_PLUS_STRING, "URAT", TYPE_PLUS, "\r\n+URAT: 7\r\n" },
+	{ "umnoprof", PARSER_PLUS_STRING, "UMNOPROF", TYPE_PLUS, "\r\n+UMNOPROF: 100\r\n" },
+	{ "cops", PARSER_PLUS_STRING, "COPS", TYPE_PLUS, "\r\n+COPS: 0,0,\"Telenor\",7\r\n" },
+	{ "cpsms", PARSER_PLUS_STRING, "CPSMS", TYPE_PLUS, "\r\n+CPSMS:1,,,\"00100110\",\"00000101\"\r\n" },
+	{ "ucpsms", PARSER_PLUS_STRING, "UCPSMS", TYPE_PLUS, "\r\n+UCPSMS: 1,,,\"00100110\",\"00000101\"\r\n" },
+	{ "csq", PARSER_RSSI_QUAL, "CSQ", TYPE_PLUS, "\r\n+CSQ: 17,99\r\n" },
+	{ "csq_unknown", PARSER_RSSI_QUAL, "CSQ", TYPE_PLUS, "\r\n+CSQ: 99,99\r\n" },
+	{ "creg", PARSER_CREG, "CREG", TYPE_PLUS, "\r\n+CREG: 2,1,\"FFFE\",\"C45C010\",8\r\n" },
+	{ "cereg", PARSER_CEREG, "CEREG", TYPE_PLUS, "\r\n+CEREG: 2,1,\"3a9b\",\"0000c33d\",7\r\n" },
+	{ "cereg_n0", PARSER_CEREG, "CEREG", TYPE_PLUS, "\r\n+CEREG: 0,1\r\n" },
+	{ "cereg_psm", PARSER_CEREG, "CEREG", TYPE_PLUS, "\r\n+CEREG: 4,1,\"3a9b\",\"0000c33d\",7,,,\"00000101\",\"00100110\"\r\n" },
+	{ "uupsmr", PARSER_PSM_STATUS, "UUPSMR", TYPE_PLUS, "\r\n+UUPSMR: 1\r\n" },
+	{ "uuloc", PARSER_LOCATION, "UULOC", TYPE_PLUS, "\r\n+UULOC: 18/01/2020,10:41:02.000,63.4305149,10.3950528,0,1421\r\n" },
+	{ "udnsrn", PARSER_DOUBLE_QUOTED, "UDNSRN", TYPE_PLUS, "\r\n+UDNSRN: \"54.86.92.13\"\r\n" },
+	{ "udopn", PARSER_DOUBLE_QUOTED, "UDOPN", TYPE_PLUS, "\r\n+UDOPN: 9,\"TELENOR\"\r\n" },
+	{ "cged_2g", PARSER_ENVIRONMENT, "CGED", TYPE_PLUS,
+		"\r\n+CGED: MCC:242, MNC:01, LAC:0e2c, CI:5ab3, BSIC:3f, Arfcn:00031, Arfcn_ded:00031, RxLevSub:44, t_adv:0\r\n" },
+	{ "cged_2g_neighbors", PARSER_ENVIRONMENT, "CGED", TYPE_UNKNOWN,
+		"\r\nMCC:242, MNC:01, LAC:0e2c, CI:5ab4, BSIC:3b, Arfcn:00044, RxLev:035\r\n"
+		"MCC:242, MNC:01, LAC:0e2c, CI:5ab5, BSIC:32, Arfcn:00019, RxLev:029\r\n"
+		"MCC:242, MNC:02, LAC:1f40, CI:0c21, BSIC:11, Arfcn:00752, RxLev:021\r\n" },
+	{ "cged_3g", PARSER_ENVIRONMENT, "CGED", TYPE_PLUS,
+		"\r\n+CGED: RAT:\"UMTS\",\r\nMCC:242, MNC:02, LAC:1f40, CI:0a2b0c1, DLF:10712, ULF:9762, RSCP LEV:26, ECN0 LEV:34\r\n" },
+};
+
+const size_t CellularHelperBenchmark::corpusSize = sizeof(CellularHelperBenchmark::corpus) / sizeof(CellularHelperBenchmark::corpus[0]);
+
+// Number of neighbor cells for the AT+CGED parser
+static const size_t BENCHMARK_NEIGHBORS = 4;
+
+CellularHelperBenchmark::RecordFunction CellularHelperBenchmark::recordFn = NULL;
+
+// static
+void CellularHelperBenchmark::recordLogged() {
+	if (recordFn) {
+		recordFn();
+	}
+}
+
+// static
+void CellularHelperBenchmark::runParser(const CellularHelperCorpusEntry &entry, const char *buf, int len, bool formatResult) {
+	switch(entry.parser) {
+	case PARSER_STRING: {
+		CellularHelperStringResponse resp;
+		resp.enableDebug = false;
+		resp.parse(entry.type, buf, len);
+		break;
+	}
+
+	case PARSER_PLUS_STRING: {
+		CellularHelperPlusStringResponse resp;
+		resp.enableDebug = false;
+		resp.command = entry.command;
+		resp.parse(entry.type, buf, len);
+		break;
+	}
+
+	case PARSER_DOUBLE_QUOTED: {
+		CellularHelperPlusStringResponse resp;
+		resp.enableDebug = false;
+		resp.command = entry.command;
+		resp.parse(entry.type, buf, len);
+		resp.getDoubleQuotedPart();
+		break;
+	}
+
+	case PARSER_RSSI_QUAL: {
+		CellularHelperRSSIQualResponse resp;
+		resp.enableDebug = false;
+		resp.command = entry.command;
+		resp.parse(entry.type, buf, len);
+		resp.postProcess();
+		if (formatResult) {
+			String::format("rssi=%d, qual=%d, bars=%d", resp.rssi, resp.qual, CellularHelperClass::rssiToBars(resp.rssi));
+		}
+		break;
+	}
+
+	case PARSER_ENVIRONMENT: {
+		CellularHelperEnvironmentResponseStatic<BENCHMARK_NEIGHBORS> resp;
+		resp.enableDebug = false;
+		resp.command = entry.command;
+		resp.parse(entry.type, buf, len);
+		resp.postProcess();
+		if (formatResult) {
+			resp.service.toString();
+		}
+		break;
+	}
+
+	case PARSER_LOCATION: {
+		CellularHelperLocationResponse resp;
+		resp.enableDebug = false;
+		resp.command = entry.command;
+		resp.parse(entry.type, buf, len);
+		resp.postProcess();
+		if (formatResult) {
+			resp.toString();
+		}
+		break;
+	}
+
+	case PARSER_CREG: {
+		CellularHelperCREGResponse resp;
+		resp.enableDebug = false;
+		resp.command = entry.command;
+		resp.parse(entry.type, buf, len);
+		resp.postProcess();
+		if (formatResult) {
+			resp.toString();
+		}
+		break;
+	}
+
+	case PARSER_CEREG: {
+		CellularHelperCEREGResponse resp;
+		resp.enableDebug = false;
+		resp.command = entry.command;
+		resp.parse(entry.type, buf, len);
+		resp.postProcess();
+		if (formatResult) {
+			resp.toString();
+		}
+		break;
+	}
+
+	case PARSER_PSM_STATUS: {
+		CellularHelperPsmStatusResponse resp;
+		resp.enableDebug = false;
+		resp.command = entry.command;
+		resp.parse(entry.type, buf, len);
+		resp.postProcess();
+		if (formatResult) {
+			resp.toString();
+		}
+		break;
+	}
+	}
+}
+
+void CellularHelperHeapSample::sample() {
+	timestamp = millis();
+	inUse = mallinfo().uordblks;
+	freeTotal = System.freeMemory();
+
+	// Binary search for the largest block malloc will hand out
+	size_t low = 0;
+	size_t high = freeTotal;
+	while(low < high) {
+		size_t mid = low + (high - low + 1) / 2;
+		void *p = malloc(mid);
+		if (p) {
+			free(p);
+			low = mid;
+		}
+		else {
+			high = mid - 1;
+		}
+	}
+	largestFree = low;
+
+	fragmentation = (freeTotal > 0) ? (int)(1000 - (uint64_t)largestFree * 1000 / freeTotal) : 0;
+	if (fragmentation < 0) {
+		fragmentation = 0;
+	}
+}
+
+String CellularHelperHeapSample::toJSON() const {
+	return String::format("{\"ts\":%lu,\"in_use\":%u,\"free\":%u,\"largest_free\":%u,\"frag\":%d}",
+			(unsigned long)timestamp, (unsigned)inUse, (unsigned)freeTotal, (unsigned)largestFree, fragmentation);
+}
+
+
+// static
+void CellularHelperBenchmark::runBenchmark(size_t iterations) {
+	for(size_t ii = 0; ii < corpusSize; ii++) {
+		const CellularHelperCorpusEntry &entry = corpus[ii];
+		int len = strlen(entry.response);
+
+		// Warm up once so one-time allocations don't count as a leak
+		runParser(entry, entry.response, len);
+
+		int heapBefore = mallinfo().uordblks;
+		unsigned long start = micros();
+
+		for(size_t jj = 0; jj < iterations; jj++) {
+			runParser(entry, entry.response, len);
+		}
+
+		unsigned long elapsed = micros() - start;
+		int heapDelta = mallinfo().uordblks - heapBefore;
+
+		Log.info("{\"bench\":\"%s\",\"iterations\":%u,\"ns_per_op\":%lu,\"heap_delta\":%d}",
+				entry.name, (unsigned)iterations, (unsigned long)((unsigned long long)elapsed * 1000 / iterations), heapDelta);
+		recordLogged();
+	}
+}
+
+// static
+void CellularHelperBenchmark::runFuzz(uint32_t seed, size_t iterations) {
+	// Largest corpus entry plus room for inserted bytes
+	char buf[256];
+
+	// Small xorshift generator so a seed reproduces the same inputs on any build
+	uint32_t state = seed ? seed : 1;
+
+	for(size_t ii = 0; ii < iterations; ii++) {
+		uint32_t iterSeed = state;
+
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		const CellularHelperCorpusEntry &entry = corpus[state % corpusSize];
+
+		int len = strlen(entry.response);
+		if (len > (int)sizeof(buf)) {
+			len = sizeof(buf);
+		}
+		memcpy(buf, entry.response, len);
+
+		// Apply 1 to 4 mutations
+		int numMutations = 1 + (state >> 8) % 4;
+		for(int jj = 0; jj < numMutations && len > 0; jj++) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+
+			int pos = (state >> 4) % len;
+			switch(state % 4) {
+			case 0:
+				// Random byte
+				buf[pos] = (char)(state >> 16);
+				break;
+			case 1:
+				// Truncate
+				len = pos;
+				break;
+			case 2: {
+				// Insert a character the parsers treat specially
+				static const char special[] = "\r\n,:\"+ ";
+				if (len < (int)sizeof(buf)) {
+					memmove(&buf[pos + 1], &buf[pos], len - pos);
+					buf[pos] = special[(state >> 16) % (sizeof(special) - 1)];
+					len++;
+				}
+				break;
+			}
+			case 3:
+				// Drop a character
+				memmove(&buf[pos], &buf[pos + 1], len - pos - 1);
+				len--;
+				break;
+			}
+		}
+
+		if ((ii % 1000) == 0) {
+			Log.info("{\"fuzz\":\"progress\",\"iteration\":%u,\"seed\":%lu}", (unsigned)ii, (unsigned long)iterSeed);
+			recordLogged();
+		}
+
+		runParser(entry, buf, len);
+	}
+
+	Log.info("{\"fuzz\":\"done\",\"iterations\":%u}", (unsigned)iterations);
+	recordLogged();
+}
+
+// static
+void CellularHelperBenchmark::runSoak(size_t cycles, size_t reportEvery) {
+	CellularHelperHeapSample first, cur;
+	size_t peakInUse = 0;
+
+	first.sample();
+	Log.info("{\"soak\":\"start\",\"cycles\":%u,\"heap\":%s}", (unsigned)cycles, first.toJSON().c_str());
+	recordLogged();
+
+	for(size_t ii = 1; ii <= cycles; ii++) {
+		for(size_t jj = 0; jj < corpusSize; jj++) {
+			const CellularHelperCorpusEntry &entry = corpus[jj];
+			runParser(entry, entry.response, strlen(entry.response), true);
+
+			size_t inUse = mallinfo().uordblks;
+			if (inUse > peakInUse) {
+				peakInUse = inUse;
+			}
+		}
+
+		if ((ii % reportEvery) == 0 || ii == cycles) {
+			cur.sample();
+			Log.info("{\"soak\":\"sample\",\"cycle\":%u,\"heap\":%s}", (unsigned)ii, cur.toJSON().c_str());
+			recordLogged();
+		}
+	}
+
+	// Average change in bytes in use per cycle, in thousandths of a byte so slow leaks show up
+	long growth = (long)cur.inUse - (long)first.inUse;
+	Log.info("{\"soak\":\"done\",\"cycles\":%u,\"calls_per_cycle\":%u,\"growth_millibytes_per_cycle\":%ld,\"peak_in_use\":%u,\"frag_start\":%d,\"frag_end\":%d}",
+			(unsigned)cycles, (unsigned)corpusSize, (cycles > 0) ? (long)(growth * 1000 / (long)cycles) : 0L,
+			(unsigned)peakInUse, first.fragmentation, cur.fragmentation);
+	recordLogged();
+}
+
+#endif /* Wiring_Cellular */
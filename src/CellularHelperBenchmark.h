@@ -0,0 +1,105 @@
+#ifndef __CELLULARHELPERBENCHMARK_H
+#define __CELLULARHELPERBENCHMARK_H
+
+#include "CellularHelper.h"
+
+#if Wiring_Cellular
+
+/**
+ * One captured modem response and the parser that handles it
+ */
+class CellularHelperCorpusEntry {
+public:
+	const char *name;		// Used as the key in the benchmark output
+	int parser;				// PARSER_xxx constant
+	const char *command;	// Value for resp.command, the part between + and :
+	int type;				// TYPE_xxx passed to parse
+	const char *response;	// Exactly as passed to the Cellular.command callback
+};
+
+/**
+ * A snapshot of heap usage.
+ *
+ * largestFree is found by probing with malloc, so it includes memory the heap could still
+ * grow into. fragmentation is 0 when all free memory is one block and approaches 1000 as free
+ * memory gets split into small pieces.
+ */
+class CellularHelperHeapSample {
+public:
+	uint32_t timestamp = 0;		// millis()
+	size_t inUse = 0;			// Bytes allocated
+	size_t freeTotal = 0;		// Bytes free, System.freeMemory()
+	size_t largestFree = 0;		// Largest block that can be allocated
+	int fragmentation = 0;		// Per mille, 1000 * (1 - largestFree / freeTotal)
+
+	void sample();
+	String toJSON() const;
+};
+
+/**
+ * Runs every CellularHelper parse/postProcess method over a corpus of real SARA-R410M (and a few
+ * SARA-G350) responses.
+ *
+ * runBenchmark() logs one JSON object per corpus entry so results can be collected from the
+ * serial port and compared between firmware revisions:
+ *
+ * {"bench":"csq","iterations":1000,"ns_per_op":41000,"heap_delta":0}
+ *
+ * heap_delta is the change in heap bytes in use across all iterations; anything other than 0
+ * is a leak.
+ *
+ * runFuzz() feeds randomly mutated copies of the corpus entries (bytes changed, truncated,
+ * delimiters inserted) to the same parsers. A parser that reads out of bounds will typically
+ * fault the device, and the last logged seed identifies the input.
+ *
+ * These runs log far more than a buffered log handler holds. The function set with onRecord()
+ * is called after each record is logged, outside the timed and measured sections, so the app
+ * can flush its log output there.
+ */
+class CellularHelperBenchmark {
+public:
+	static const int PARSER_STRING = 0;
+	static const int PARSER_PLUS_STRING = 1;
+	static const int PARSER_RSSI_QUAL = 2;
+	static const int PARSER_ENVIRONMENT = 3;
+	static const int PARSER_LOCATION = 4;
+	static const int PARSER_CREG = 5;
+	static const int PARSER_CEREG = 6;
+	static const int PARSER_PSM_STATUS = 7;
+	static const int PARSER_DOUBLE_QUOTED = 8;
+
+	typedef void (*RecordFunction)();
+
+	static void onRecord(RecordFunction fn) { recordFn = fn; }
+
+	static void runBenchmark(size_t iterations = 1000);
+
+	static void runFuzz(uint32_t seed, size_t iterations = 10000);
+
+	/**
+	 * Soak test for long-running devices. Each cycle parses every corpus entry and formats the
+	 * results with toString(), the same String work the getters and the app do in the field.
+	 *
+	 * Logs a CellularHelperHeapSample as JSON every reportEvery cycles, then a summary with
+	 * the average change in heap bytes in use per cycle and the peak seen.
+	 */
+	static void runSoak(size_t cycles, size_t reportEvery = 1000);
+
+	/**
+	 * Runs the parser for one entry. buf/len can be a modified copy of entry.response.
+	 * If formatResult is true, the result is also converted using toString().
+	 */
+	static void runParser(const CellularHelperCorpusEntry &entry, const char *buf, int len, bool formatResult = false);
+
+	static const CellularHelperCorpusEntry corpus[];
+	static const size_t corpusSize;
+
+protected:
+	static void recordLogged();
+
+	static RecordFunction recordFn;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERBENCHMARK_H */
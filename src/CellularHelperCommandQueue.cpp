@@ -0,0 +1,323 @@
+#include "CellularHelperCommandQueue.h"
+#include "CellularHelper.h"
+
+// Commands that change PSM, registration or radio configuration
+static const char * const controlCommands[] = {
+	"AT+CFUN=", "AT+COPS=", "AT+CPSMS=", "AT+UPSMVER=", "AT+UPSMR=", "AT+CSCON=",
+	"AT+URAT=", "AT+UMNOPROF=", "AT+CEDRXS=", "AT+UBANDMASK="
+};
+
+// Queries without a ?, which only read state
+static const char * const diagnosticCommands[] = {
+	"AT+CSQ", "AT+CESQ", "AT+CGMI", "AT+CGMM", "AT+CGMR", "AT+CGSN", "AT+CIMI", "AT+CCID", "ATI"
+};
+
+static bool startsWith(const char *str, const char *prefix) {
+	return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+CellularHelperCommandQueue::CellularHelperCommandQueue()
+#if PLATFORM_THREADING
+	: workerState(WORKER_STOPPED), freeWaitSemaphores(0), head(&stub), tail(&stub)
+#endif
+{
+#if PLATFORM_THREADING
+	for(int ii = 0; ii < NUM_PRIORITIES; ii++) {
+		pendingFirst[ii] = pendingLast[ii] = NULL;
+	}
+#endif
+	for(size_t ii = 0; ii < NUM_CACHE_ENTRIES; ii++) {
+		cache[ii].valid = false;
+		cache[ii].command[0] = 0;
+	}
+	reserved.store(false, std::memory_order_relaxed);
+}
+
+// static
+int CellularHelperCommandQueue::classify(const char *cmd) {
+	if (strstr(cmd, "=?") != NULL) {
+		// Test commands, including the AT+COPS=? operator scan
+		return PRIORITY_NORMAL;
+	}
+	for(size_t ii = 0; ii < sizeof(controlCommands) / sizeof(controlCommands[0]); ii++) {
+		if (startsWith(cmd, controlCommands[ii])) {
+			return PRIORITY_CONTROL;
+		}
+	}
+	if (strchr(cmd, '?') != NULL) {
+		return PRIORITY_DIAGNOSTIC;
+	}
+	for(size_t ii = 0; ii < sizeof(diagnosticCommands) / sizeof(diagnosticCommands[0]); ii++) {
+		if (startsWith(cmd, diagnosticCommands[ii])) {
+			return PRIORITY_DIAGNOSTIC;
+		}
+	}
+	return PRIORITY_NORMAL;
+}
+
+// static
+bool CellularHelperCommandQueue::isCacheable(const char *cmd) {
+	return classify(cmd) == PRIORITY_DIAGNOSTIC && strlen(cmd) < CACHE_COMMAND_SIZE;
+}
+
+// static
+bool CellularHelperCommandQueue::isSetCommand(const char *cmd) {
+	const char *equals = strchr(cmd, '=');
+	return equals != NULL && equals[1] != '?';
+}
+
+int CellularHelperCommandQueue::submit(CellularHelperCommandRequest &req) {
+	req.priority = classify(req.command);
+
+#if PLATFORM_THREADING
+	if (workerState.load(std::memory_order_acquire) != WORKER_RUNNING) {
+		startWorker();
+	}
+
+	if (!os_thread_is_current(workerThread, NULL)) {
+		int waitIndex = takeWaitSemaphore();
+		if (waitIndex >= 0) {
+			req.doneSemaphore = waitSemaphores[waitIndex];
+		}
+		else
+		if (os_semaphore_create(&req.doneSemaphore, 1, 0) != 0) {
+			return RESP_ERROR;
+		}
+
+		push(&req);
+		os_semaphore_give(workerSemaphore, false);
+
+		os_semaphore_take(req.doneSemaphore, CONCURRENT_WAIT_FOREVER, false);
+
+		if (waitIndex >= 0) {
+			giveWaitSemaphore(waitIndex);
+		}
+		else {
+			os_semaphore_destroy(req.doneSemaphore);
+		}
+		return req.result;
+	}
+#endif
+
+	req.result = CellularHelper.execute(req);
+	return req.result;
+}
+
+#if PLATFORM_THREADING
+void CellularHelperCommandQueue::startWorker() {
+	uint8_t expected = WORKER_STOPPED;
+	if (workerState.compare_exchange_strong(expected, WORKER_STARTING, std::memory_order_acq_rel)) {
+		os_semaphore_create(&workerSemaphore, 0xffff, 0);
+
+		uint32_t created = 0;
+		for(size_t ii = 0; ii < NUM_WAIT_SEMAPHORES; ii++) {
+			if (os_semaphore_create(&waitSemaphores[ii], 1, 0) == 0) {
+				created |= 1 << ii;
+			}
+		}
+		freeWaitSemaphores.store(created, std::memory_order_release);
+
+		os_thread_create(&workerThread, "cellhelper", OS_THREAD_PRIORITY_DEFAULT, workerThreadFunction, this, WORKER_STACK_SIZE);
+		workerState.store(WORKER_RUNNING, std::memory_order_release);
+		return;
+	}
+
+	// Another thread is starting it
+	while(workerState.load(std::memory_order_acquire) != WORKER_RUNNING) {
+		delay(1);
+	}
+}
+
+// static
+void CellularHelperCommandQueue::workerThreadFunction(void *param) {
+	CellularHelperCommandQueue *queue = (CellularHelperCommandQueue *)param;
+
+	while(true) {
+		os_semaphore_take(queue->workerSemaphore, CONCURRENT_WAIT_FOREVER, false);
+
+		// The semaphore is given once per push, but all submitted requests are collected at
+		// once so they can be ordered by priority. Extra gives just cause an empty pass.
+		CellularHelperCommandRequest *req;
+		while((req = queue->takeHighestPriority()) != NULL) {
+			req->result = CellularHelper.execute(*req);
+
+			// The submitting thread returns and its stack frame goes away after this
+			os_semaphore_give(req->doneSemaphore, false);
+		}
+	}
+}
+
+int CellularHelperCommandQueue::takeWaitSemaphore() {
+	uint32_t free = freeWaitSemaphores.load(std::memory_order_acquire);
+	while(free != 0) {
+		int index = __builtin_ctz(free);
+		if (freeWaitSemaphores.compare_exchange_weak(free, free & ~(1UL << index), std::memory_order_acq_rel)) {
+			return index;
+		}
+	}
+	return -1;
+}
+
+void CellularHelperCommandQueue::giveWaitSemaphore(int index) {
+	freeWaitSemaphores.fetch_or(1UL << index, std::memory_order_release);
+}
+
+void CellularHelperCommandQueue::push(CellularHelperCommandRequest *req) {
+	req->next.store(NULL, std::memory_order_relaxed);
+	CellularHelperCommandRequest *prev = head.exchange(req, std::memory_order_acq_rel);
+	prev->next.store(req, std::memory_order_release);
+}
+
+CellularHelperCommandRequest *CellularHelperCommandQueue::pop() {
+	CellularHelperCommandRequest *first = tail;
+	CellularHelperCommandRequest *next = first->next.load(std::memory_order_acquire);
+
+	if (first == &stub) {
+		if (!next) {
+			return NULL;
+		}
+		tail = first = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next) {
+		tail = next;
+		return first;
+	}
+	if (first != head.load(std::memory_order_acquire)) {
+		// A producer has exchanged head but not linked its request yet; get it on the next pass
+		return NULL;
+	}
+
+	// first is the only request; put the stub behind it so it can be unlinked
+	push(&stub);
+	next = first->next.load(std::memory_order_acquire);
+	if (next) {
+		tail = next;
+		return first;
+	}
+	return NULL;
+}
+
+CellularHelperCommandRequest *CellularHelperCommandQueue::takeHighestPriority() {
+	CellularHelperCommandRequest *req;
+	while((req = pop()) != NULL) {
+		req->nextPending = NULL;
+		if (pendingLast[req->priority]) {
+			pendingLast[req->priority]->nextPending = req;
+		}
+		else {
+			pendingFirst[req->priority] = req;
+		}
+		pendingLast[req->priority] = req;
+	}
+
+	for(int ii = 0; ii < NUM_PRIORITIES; ii++) {
+		req = pendingFirst[ii];
+		if (req) {
+			pendingFirst[ii] = req->nextPending;
+			if (!pendingFirst[ii]) {
+				pendingLast[ii] = NULL;
+			}
+			return req;
+		}
+	}
+	return NULL;
+}
+#endif /* PLATFORM_THREADING */
+
+CellularHelperCommandQueue::CacheEntry *CellularHelperCommandQueue::findEntry(const char *cmd) {
+	for(size_t ii = 0; ii < NUM_CACHE_ENTRIES; ii++) {
+		if (strcmp(cache[ii].command, cmd) == 0) {
+			return &cache[ii];
+		}
+	}
+	return NULL;
+}
+
+bool CellularHelperCommandQueue::replayCached(const char *cmd, CellularHelperCommonResponse *resp, int &result) {
+	if (freshnessMs == 0) {
+		return false;
+	}
+
+	CacheEntry *entry = findEntry(cmd);
+	if (!entry || !entry->valid || millis() - entry->timestamp >= freshnessMs) {
+		return false;
+	}
+
+	if (resp) {
+		size_t offset = 0;
+		while(offset + 3 <= entry->dataLen) {
+			int type = (int)entry->data[offset] << 16;
+			size_t len = entry->data[offset + 1] | (entry->data[offset + 2] << 8);
+			offset += 3;
+			resp->parse(type, (const char *)&entry->data[offset], len);
+			offset += len;
+		}
+	}
+
+	result = entry->result;
+	cacheHits++;
+	return true;
+}
+
+void CellularHelperCommandQueue::beginCapture(const char *cmd) {
+	modemCommands++;
+
+	captureEntry = NULL;
+	if (!cmd || freshnessMs == 0) {
+		return;
+	}
+
+	captureEntry = findEntry(cmd);
+	if (!captureEntry) {
+		captureEntry = &cache[nextEntry];
+		nextEntry = (nextEntry + 1) % NUM_CACHE_ENTRIES;
+	}
+
+	captureEntry->valid = false;
+	strncpy(captureEntry->command, cmd, CACHE_COMMAND_SIZE - 1);
+	captureEntry->command[CACHE_COMMAND_SIZE - 1] = 0;
+	captureEntry->dataLen = 0;
+	captureOverflow = false;
+}
+
+void CellularHelperCommandQueue::capture(int type, const char *buf, int len) {
+	if (!captureEntry || captureOverflow) {
+		return;
+	}
+	if (captureEntry->dataLen + 3 + (size_t)len > CACHE_DATA_SIZE) {
+		// Too big to cache; this query will always go to the modem
+		captureOverflow = true;
+		return;
+	}
+
+	uint8_t *p = &captureEntry->data[captureEntry->dataLen];
+	p[0] = (uint8_t)(type >> 16);
+	p[1] = (uint8_t)len;
+	p[2] = (uint8_t)(len >> 8);
+	memcpy(&p[3], buf, len);
+	captureEntry->dataLen += 3 + len;
+}
+
+void CellularHelperCommandQueue::endCapture(int result) {
+	if (captureEntry && !captureOverflow && result == RESP_OK) {
+		captureEntry->result = result;
+		captureEntry->timestamp = millis();
+		captureEntry->valid = true;
+	}
+	captureEntry = NULL;
+}
+
+void CellularHelperCommandQueue::invalidateCache() {
+	for(size_t ii = 0; ii < NUM_CACHE_ENTRIES; ii++) {
+		cache[ii].valid = false;
+	}
+}
+
+bool CellularHelperCommandQueue::refuseWhileReserved(const CellularHelperCommandRequest &req) {
+	if (!isReserved() || req.whileReserved || req.command[0] == 0) {
+		return false;
+	}
+	refused++;
+	return true;
+}
@@ -0,0 +1,200 @@
+#ifndef __CELLULARHELPERCOMMANDQUEUE_H
+#define __CELLULARHELPERCOMMANDQUEUE_H
+
+#include "Particle.h"
+
+#include <atomic>
+
+class CellularHelperCommonResponse;
+
+/**
+ * One modem command waiting for the worker. Lives on the stack of the thread that submitted it,
+ * which blocks on doneSemaphore until the worker gives it.
+ */
+class CellularHelperCommandRequest {
+public:
+	// Maximum length of a formatted command, including the \r\n
+	static const size_t COMMAND_SIZE = 128;
+
+	char cmd[COMMAND_SIZE];
+	const char *command;		// cmd, or a longer caller-formatted command
+	CellularHelperCommonResponse *resp = NULL;
+	system_tick_t timeoutMs = 0;
+	int priority = 0;
+	int result = 0;
+	bool noCache = false;		// Always ask the modem; the answer still refreshes the cache
+	bool whileReserved = false;	// Runs even while the modem is reserved, see reserve()
+
+#if PLATFORM_THREADING
+	os_semaphore_t doneSemaphore = NULL;					// Given by the worker when result is set
+#endif
+	std::atomic<CellularHelperCommandRequest *> next;		// Submission queue link, any thread
+	CellularHelperCommandRequest *nextPending = NULL;		// Priority list link, worker only
+
+	CellularHelperCommandRequest() : command(cmd), next(NULL) {}
+};
+
+/**
+ * Single owner of the modem, with a lock-free submission queue.
+ *
+ * CellularHelperClass::vcommand() formats the command into a CellularHelperCommandRequest on the
+ * caller's stack and passes it to submit(). Requests are pushed onto an intrusive multi-producer,
+ * single-consumer queue with one atomic exchange, so application threads, software timers and
+ * the serial command handler never hold a lock while another thread is using the modem. A
+ * worker thread, started on the first command, is the only thread that calls Cellular.command.
+ * The submitting thread blocks on a semaphore, taken from a small pool, until the worker gives
+ * it, so waiting threads do not run until their command has completed.
+ *
+ * The worker moves submitted requests into per-priority lists and runs the highest priority one
+ * first, so PSM and registration control are not stuck behind diagnostic queries from other
+ * threads.
+ *
+ * Read-only queries (AT+CSQ, AT+CEREG?, AT+COPS?, ...) are cached with the raw response
+ * buffers. An identical query within the freshness window is answered by replaying the cached
+ * buffers into the new response object's parse(), without a modem transaction. Requests that
+ * were queued while the same query was in flight are answered from its result the same way.
+ * Any set command (AT+CFUN=, AT+CREG=, AT+UCGED=, ...) clears the cache, since it can change
+ * the state or the format of later answers.
+ *
+ * reserve() keeps other commands away from the modem while a command that any character would
+ * abort, such as AT+COPS=?, is running in the modem.
+ */
+class CellularHelperCommandQueue {
+public:
+	static const int PRIORITY_CONTROL = 0;		// PSM, registration, RAT/MNO changes
+	static const int PRIORITY_NORMAL = 1;
+	static const int PRIORITY_DIAGNOSTIC = 2;	// Identity, signal and status queries
+	static const int NUM_PRIORITIES = 3;
+
+	static const size_t NUM_CACHE_ENTRIES = 4;
+	static const size_t CACHE_COMMAND_SIZE = 24;
+	static const size_t CACHE_DATA_SIZE = 160;
+
+	CellularHelperCommandQueue();
+
+	/**
+	 * Returns PRIORITY_CONTROL, PRIORITY_NORMAL or PRIORITY_DIAGNOSTIC for a formatted command
+	 */
+	static int classify(const char *cmd);
+
+	/**
+	 * Returns true if the command only reads state and its result can be shared
+	 */
+	static bool isCacheable(const char *cmd);
+
+	/**
+	 * Returns true for a set command (AT+xxx= but not the AT+xxx=? test command), which
+	 * invalidates cached query results
+	 */
+	static bool isSetCommand(const char *cmd);
+
+	/**
+	 * Runs the request on the worker thread and returns when it has completed. Runs it on the
+	 * calling thread instead if there is no threading, or if called from the worker itself.
+	 */
+	int submit(CellularHelperCommandRequest &req);
+
+	/**
+	 * If a fresh result for cmd is cached, passes the cached response buffers to resp->parse(),
+	 * sets result to the original result code and returns true. Only call from the modem owner.
+	 */
+	bool replayCached(const char *cmd, CellularHelperCommonResponse *resp, int &result);
+
+	/**
+	 * Capture the responses for cmd while it runs, to add them to the cache. cmd may be NULL
+	 * if the command is not cacheable.
+	 */
+	void beginCapture(const char *cmd);
+	void capture(int type, const char *buf, int len);
+	void endCapture(int result);
+
+	void invalidateCache();
+
+	/**
+	 * Reserves the modem. Until release(), requests without whileReserved are refused with
+	 * RESP_ABORTED without being sent, unless a cached answer can be replayed. Empty commands,
+	 * which only collect URCs, still run.
+	 */
+	void reserve() { reserved.store(true, std::memory_order_release); }
+	void release() { reserved.store(false, std::memory_order_release); }
+	bool isReserved() const { return reserved.load(std::memory_order_acquire); }
+
+	/**
+	 * Returns true, and counts it, if req must be refused because the modem is reserved.
+	 * Only call from the modem owner.
+	 */
+	bool refuseWhileReserved(const CellularHelperCommandRequest &req);
+
+	/**
+	 * How long a cached query result is reused, in milliseconds. 0 disables caching.
+	 */
+	void setFreshness(system_tick_t ms) { freshnessMs = ms; }
+	system_tick_t getFreshness() const { return freshnessMs; }
+
+	uint32_t getModemCommands() const { return modemCommands; }
+	uint32_t getCacheHits() const { return cacheHits; }
+	uint32_t getRefused() const { return refused; }
+
+protected:
+	class CacheEntry {
+	public:
+		char command[CACHE_COMMAND_SIZE];
+		int result;
+		system_tick_t timestamp;
+		uint16_t dataLen;
+		bool valid;
+		uint8_t data[CACHE_DATA_SIZE];		// Records of uint8 type >> 16, uint16 len, len bytes
+	};
+
+	CacheEntry *findEntry(const char *cmd);
+
+#if PLATFORM_THREADING
+	static const size_t WORKER_STACK_SIZE = 3072;
+
+	// Threads that can wait on a pooled semaphore at once. More use a temporary one.
+	static const size_t NUM_WAIT_SEMAPHORES = 8;
+
+	static const uint8_t WORKER_STOPPED = 0;
+	static const uint8_t WORKER_STARTING = 1;
+	static const uint8_t WORKER_RUNNING = 2;
+
+	void startWorker();
+	static void workerThreadFunction(void *param);
+	void push(CellularHelperCommandRequest *req);
+	CellularHelperCommandRequest *pop();
+	CellularHelperCommandRequest *takeHighestPriority();
+	int takeWaitSemaphore();
+	void giveWaitSemaphore(int index);
+
+	std::atomic<uint8_t> workerState;
+	os_thread_t workerThread = NULL;
+	os_semaphore_t workerSemaphore = NULL;
+
+	// Completion semaphores for submitting threads, one bit per free entry
+	os_semaphore_t waitSemaphores[NUM_WAIT_SEMAPHORES];
+	std::atomic<uint32_t> freeWaitSemaphores;
+
+	// Submission queue (Vyukov intrusive MPSC). Producers only touch head, the worker owns tail.
+	std::atomic<CellularHelperCommandRequest *> head;
+	CellularHelperCommandRequest *tail;
+	CellularHelperCommandRequest stub;
+
+	// Requests taken from the submission queue, by priority, oldest first
+	CellularHelperCommandRequest *pendingFirst[NUM_PRIORITIES];
+	CellularHelperCommandRequest *pendingLast[NUM_PRIORITIES];
+#endif
+
+	CacheEntry cache[NUM_CACHE_ENTRIES];
+	CacheEntry *captureEntry = NULL;
+	bool captureOverflow = false;
+	size_t nextEntry = 0;
+	system_tick_t freshnessMs = 2000;
+
+	std::atomic<bool> reserved;
+
+	uint32_t modemCommands = 0;
+	uint32_t cacheHits = 0;
+	uint32_t refused = 0;
+};
+
+#endif /* __CELLULARHELPERCOMMANDQUEUE_H */
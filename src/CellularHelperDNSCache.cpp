@@ -0,0 +1,163 @@
+#include "CellularHelperDNSCache.h"
+
+#if Wiring_Cellular
+
+CellularHelperDNSCache::CellularHelperDNSCache(CellularHelperDNSCacheData *data) : data(data ? *data : internalData) {
+	bool valid = (data != NULL && this->data.magic == CellularHelperDNSCacheData::MAGIC);
+	for(size_t ii = 0; valid && ii < CellularHelperDNSCacheData::MAX_ENTRIES; ii++) {
+		CellularHelperDNSCacheData::Entry &entry = this->data.entries[ii];
+		if (entry.hostname[CellularHelperDNSCacheData::MAX_HOSTNAME_LEN] != 0) {
+			valid = false;
+		}
+		else
+		if (!entry.wallClock) {
+			// millis() started over, so these expiry times mean nothing now
+			entry.hostname[0] = 0;
+		}
+	}
+	if (!valid) {
+		clear();
+	}
+}
+
+// static
+uint32_t CellularHelperDNSCache::now(bool &wallClock) {
+	wallClock = Time.isValid();
+	return wallClock ? (uint32_t)Time.now() : millis() / 1000;
+}
+
+// static
+IPAddress CellularHelperDNSCache::toIPAddress(uint32_t addr) {
+	if (addr == 0) {
+		return IPAddress();
+	}
+	return IPAddress((uint8_t)(addr >> 24), (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr);
+}
+
+CellularHelperDNSCacheData::Entry *CellularHelperDNSCache::find(const char *hostname) {
+	bool wallClock;
+	uint32_t time = now(wallClock);
+
+	for(size_t ii = 0; ii < CellularHelperDNSCacheData::MAX_ENTRIES; ii++) {
+		CellularHelperDNSCacheData::Entry &entry = data.entries[ii];
+		if (entry.hostname[0] == 0 || strcmp(entry.hostname, hostname) != 0) {
+			continue;
+		}
+		if (entry.wallClock != wallClock || (int32_t)(entry.expires - time) <= 0) {
+			entry.hostname[0] = 0;
+			return NULL;
+		}
+		entry.lastUsed = ++data.useCounter;
+		return &entry;
+	}
+	return NULL;
+}
+
+void CellularHelperDNSCache::store(const char *hostname, const IPAddress &addr) {
+	if (strlen(hostname) > CellularHelperDNSCacheData::MAX_HOSTNAME_LEN) {
+		return;
+	}
+
+	// Replace an entry for the same name, an unused one, or the least recently used
+	CellularHelperDNSCacheData::Entry *slot = NULL;
+	for(size_t ii = 0; ii < CellularHelperDNSCacheData::MAX_ENTRIES; ii++) {
+		CellularHelperDNSCacheData::Entry &entry = data.entries[ii];
+		if (entry.hostname[0] == 0 || strcmp(entry.hostname, hostname) == 0) {
+			slot = &entry;
+			break;
+		}
+		if (slot == NULL || (int32_t)(entry.lastUsed - slot->lastUsed) < 0) {
+			slot = &entry;
+		}
+	}
+
+	bool wallClock;
+	uint32_t time = now(wallClock);
+
+	strcpy(slot->hostname, hostname);
+	slot->addr = addr ? ((uint32_t)addr[0] << 24) | ((uint32_t)addr[1] << 16) | ((uint32_t)addr[2] << 8) | addr[3] : 0;
+	slot->expires = time + (slot->addr ? ttl : negativeTtl);
+	slot->wallClock = wallClock;
+	slot->lastUsed = ++data.useCounter;
+}
+
+IPAddress CellularHelperDNSCache::lookupOverAir(const char *hostname) {
+	misses++;
+	IPAddress addr = CellularHelper.dnsLookup(hostname);
+	if (!addr) {
+		failures++;
+	}
+	store(hostname, addr);
+	return addr;
+}
+
+bool CellularHelperDNSCache::getCached(const char *hostname, IPAddress &addr) {
+	CellularHelperDNSCacheData::Entry *entry = find(hostname);
+	if (entry == NULL) {
+		return false;
+	}
+	if (entry->addr) {
+		hits++;
+	}
+	else {
+		negativeHits++;
+	}
+	addr = toIPAddress(entry->addr);
+	return true;
+}
+
+IPAddress CellularHelperDNSCache::lookup(const char *hostname) {
+	IPAddress addr;
+	if (getCached(hostname, addr)) {
+		return addr;
+	}
+	return lookupOverAir(hostname);
+}
+
+size_t CellularHelperDNSCache::resolve(const char * const *hostnames, IPAddress *results, size_t count) {
+	size_t resolved = 0;
+
+	// Cache hits take no modem time, so the over-the-air lookups run back to back
+	for(size_t ii = 0; ii < count; ii++) {
+		results[ii] = lookup(hostnames[ii]);
+		if (results[ii]) {
+			resolved++;
+		}
+	}
+	return resolved;
+}
+
+void CellularHelperDNSCache::invalidate(const char *hostname) {
+	for(size_t ii = 0; ii < CellularHelperDNSCacheData::MAX_ENTRIES; ii++) {
+		CellularHelperDNSCacheData::Entry &entry = data.entries[ii];
+		if (strcmp(entry.hostname, hostname) == 0) {
+			entry.hostname[0] = 0;
+		}
+	}
+}
+
+void CellularHelperDNSCache::clear() {
+	memset(&data, 0, sizeof(data));
+	data.magic = CellularHelperDNSCacheData::MAGIC;
+}
+
+void CellularHelperDNSCache::logEntries() {
+	bool wallClock;
+	uint32_t time = now(wallClock);
+
+	Log.info("dns cache hits=%lu negativeHits=%lu misses=%lu failures=%lu ttl=%lu negativeTtl=%lu",
+		(unsigned long)hits, (unsigned long)negativeHits, (unsigned long)misses, (unsigned long)failures,
+		(unsigned long)ttl, (unsigned long)negativeTtl);
+
+	for(size_t ii = 0; ii < CellularHelperDNSCacheData::MAX_ENTRIES; ii++) {
+		const CellularHelperDNSCacheData::Entry &entry = data.entries[ii];
+		if (entry.hostname[0] == 0) {
+			continue;
+		}
+		int32_t remaining = (entry.wallClock == wallClock) ? (int32_t)(entry.expires - time) : 0;
+		Log.info("dns %s=%s expires=%lds%s", entry.hostname, entry.addr ? toIPAddress(entry.addr).toString().c_str() : "failed",
+			(long)(remaining > 0 ? remaining : 0), entry.wallClock ? "" : " (uptime)");
+	}
+}
+
+#endif /* Wiring_Cellular */
@@ -0,0 +1,104 @@
+#ifndef __CELLULARHELPERDNSCACHE_H
+#define __CELLULARHELPERDNSCACHE_H
+
+#include "CellularHelper.h"
+
+#if Wiring_Cellular
+
+/**
+ * Storage for CellularHelperDNSCache. Declare it retained to keep the cache across sleep:
+ *
+ * STARTUP(System.enableFeature(FEATURE_RETAINED_MEMORY));
+ * retained CellularHelperDNSCacheData dnsCacheData;
+ * CellularHelperDNSCache dnsCache(&dnsCacheData);
+ */
+class CellularHelperDNSCacheData {
+public:
+	static const uint32_t MAGIC = 0x444e5331;		// "DNS1", bump when the layout changes
+	static const size_t MAX_ENTRIES = 8;
+	static const size_t MAX_HOSTNAME_LEN = 47;
+
+	class Entry {
+	public:
+		char hostname[MAX_HOSTNAME_LEN + 1];	// Empty if unused
+		uint32_t addr;							// 0 for a cached failure
+		uint32_t expires;						// Seconds, in the clock given by wallClock
+		uint32_t lastUsed;						// From useCounter, for LRU replacement
+		bool wallClock;							// expires is Time.now(), not millis() / 1000
+	};
+
+	uint32_t magic;
+	uint32_t useCounter;
+	Entry entries[MAX_ENTRIES];
+};
+
+/**
+ * Fixed-size cache in front of CellularHelper.dnsLookup().
+ *
+ * AT+UDNSRN does not report the record's TTL, so successful lookups are kept for a fixed ttl
+ * (default 1 hour) and failures for negativeTtl (default 1 minute), so a host that does not
+ * resolve is not retried over the air on every call.
+ *
+ * Expiry uses Time.now() when the time is valid, so retained entries survive deep sleep and
+ * reset. Entries made before the time was valid use millis() and are dropped once the clock
+ * kind changes or after a reset.
+ *
+ * Not synchronized; use from one thread, for example only from background commands.
+ */
+class CellularHelperDNSCache {
+public:
+	/**
+	 * data may be retained storage, which is kept if it is valid. NULL uses internal storage.
+	 */
+	CellularHelperDNSCache(CellularHelperDNSCacheData *data = NULL);
+
+	/**
+	 * Returns the address of hostname from the cache, or looks it up over the air. Returns
+	 * an empty IPAddress if it does not resolve. Hostnames longer than MAX_HOSTNAME_LEN are
+	 * looked up but not cached.
+	 */
+	IPAddress lookup(const char *hostname);
+
+	/**
+	 * Resolves count hostnames into results. Names that are not cached are looked up back to
+	 * back, so they share one radio connection. Returns the number that resolved.
+	 */
+	size_t resolve(const char * const *hostnames, IPAddress *results, size_t count);
+
+	/**
+	 * Returns true and sets addr (empty for a cached failure) if hostname has an unexpired entry
+	 */
+	bool getCached(const char *hostname, IPAddress &addr);
+
+	void invalidate(const char *hostname);
+
+	void clear();
+
+	void setTtl(uint32_t seconds) { ttl = seconds; }
+	void setNegativeTtl(uint32_t seconds) { negativeTtl = seconds; }
+
+	void logEntries();
+
+	uint32_t hits = 0;
+	uint32_t negativeHits = 0;
+	uint32_t misses = 0;
+	uint32_t failures = 0;
+
+protected:
+	static uint32_t now(bool &wallClock);
+	static IPAddress toIPAddress(uint32_t addr);
+
+	CellularHelperDNSCacheData::Entry *find(const char *hostname);
+	void store(const char *hostname, const IPAddress &addr);
+	IPAddress lookupOverAir(const char *hostname);
+
+	CellularHelperDNSCacheData internalData;
+	CellularHelperDNSCacheData &data;
+
+	uint32_t ttl = 3600;
+	uint32_t negativeTtl = 60;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERDNSCACHE_H */
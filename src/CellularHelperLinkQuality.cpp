@@ -0,0 +1,128 @@
+#include "CellularHelperLinkQuality.h"
+
+#if Wiring_Cellular
+
+// RSRQ below this (tenths of a dB) costs a bar, the cell is loaded or there is interference
+static const int POOR_RSRQ = -150;
+
+static String formatTenths(int value) {
+	return String::format("%s%d.%d", (value < 0) ? "-" : "", abs(value) / 10, abs(value) % 10);
+}
+
+CellularHelperLinkMetric::CellularHelperLinkMetric(int binBase, int binWidth) : dist(binBase, binWidth) {
+}
+
+void CellularHelperLinkMetric::add(int value, int smoothingShift) {
+	if (dist.count == 0) {
+		ewma = value * 256;
+	}
+	else {
+		ewma += (value * 256 - ewma) / (1 << smoothingShift);
+	}
+	dist.add(value);
+}
+
+void CellularHelperLinkMetric::clear() {
+	ewma = 0;
+	dist.clear();
+}
+
+int CellularHelperLinkMetric::getFiltered() const {
+	return (ewma >= 0) ? ((ewma + 128) / 256) : ((ewma - 128) / 256);
+}
+
+String CellularHelperLinkState::toString() const {
+	if (!valid) {
+		return "valid=false";
+	}
+	String result = String::format("rsrp=%d rsrq=", rsrp);
+	result += formatTenths(rsrq);
+	if (hasSinr) {
+		result += " sinr=";
+		result += formatTenths(sinr);
+	}
+	result += String::format(" bars=%d last=%s age=%lu samples=%lu", bars, lastValid ? "ok" : "failed",
+		(unsigned long)age, (unsigned long)samples);
+	return result;
+}
+
+CellularHelperLinkQuality::CellularHelperLinkQuality() :
+	rsrp(-140, 6), rsrq(-200, 11), sinr(-100, 25) {
+}
+
+bool CellularHelperLinkQuality::sample(bool includeSinr) {
+	CellularHelperSignalSample sample;
+
+	CellularHelper.getSignalSample(sample, includeSinr);
+	add(sample);
+
+	return sample.valid;
+}
+
+void CellularHelperLinkQuality::add(const CellularHelperSignalSample &sample) {
+	lastValid = sample.valid;
+	lastSampleTime = sample.timestamp;
+
+	if (!sample.valid) {
+		failures++;
+		return;
+	}
+
+	rsrp.add(sample.rsrp, smoothingShift);
+	rsrq.add(sample.rsrq, smoothingShift);
+	if (sample.hasSinr) {
+		sinr.add(sample.sinr, smoothingShift);
+	}
+}
+
+void CellularHelperLinkQuality::clear() {
+	rsrp.clear();
+	rsrq.clear();
+	sinr.clear();
+	failures = 0;
+	lastValid = false;
+}
+
+CellularHelperLinkState CellularHelperLinkQuality::getLinkState() const {
+	CellularHelperLinkState state;
+
+	state.valid = rsrp.hasValue();
+	state.lastValid = lastValid;
+	state.samples = rsrp.dist.count;
+	if (!state.valid) {
+		return state;
+	}
+
+	state.rsrp = rsrp.getFiltered();
+	state.rsrq = rsrq.getFiltered();
+	state.hasSinr = sinr.hasValue();
+	state.sinr = sinr.getFiltered();
+	state.age = millis() - lastSampleTime;
+
+	if (lastValid) {
+		state.bars = rsrpToBars(state.rsrp);
+		if (state.rsrq < POOR_RSRQ && state.bars > 0) {
+			state.bars--;
+		}
+	}
+	return state;
+}
+
+void CellularHelperLinkQuality::logStats() const {
+	Log.info("link %s", getLinkState().toString().c_str());
+	Log.info("rsrp dBm %s", rsrp.dist.toString().c_str());
+	Log.info("rsrq dB/10 %s", rsrq.dist.toString().c_str());
+	Log.info("sinr dB/10 %s", sinr.dist.toString().c_str());
+	Log.info("failures=%lu", (unsigned long)failures);
+}
+
+// static
+int CellularHelperLinkQuality::rsrpToBars(int rsrp) {
+	if (rsrp >= -90)       return 4;
+	else if (rsrp >= -100) return 3;
+	else if (rsrp >= -110) return 2;
+	else if (rsrp >= -120) return 1;
+	return 0;
+}
+
+#endif /* Wiring_Cellular */
@@ -0,0 +1,101 @@
+#ifndef __CELLULARHELPERLINKQUALITY_H
+#define __CELLULARHELPERLINKQUALITY_H
+
+#include "CellularHelper.h"
+#include "CellularHelperSessionStats.h"
+
+#if Wiring_Cellular
+
+/**
+ * One filtered signal metric: an exponentially weighted moving average plus a
+ * CellularHelperDistribution for min, max and percentiles. Fixed size.
+ */
+class CellularHelperLinkMetric {
+public:
+	CellularHelperLinkMetric(int binBase, int binWidth);
+
+	void add(int value, int smoothingShift);
+	void clear();
+
+	bool hasValue() const { return dist.count > 0; }
+
+	/**
+	 * Returns the moving average, rounded to the nearest unit
+	 */
+	int getFiltered() const;
+
+	CellularHelperDistribution dist;
+
+protected:
+	int32_t ewma = 0;		// Value * 256
+};
+
+/**
+ * Filtered link state, as returned by CellularHelperLinkQuality::getLinkState(). Units are the
+ * same as CellularHelperSignalSample: rsrp in dBm, rsrq and sinr in tenths of a dB.
+ */
+class CellularHelperLinkState {
+public:
+	bool valid = false;			// At least one good measurement
+	bool lastValid = false;		// The most recent measurement was good
+	int rsrp = 0;
+	int rsrq = 0;
+	bool hasSinr = false;
+	int sinr = 0;
+	int bars = 0;				// 0 (no usable link) to 4
+	system_tick_t age = 0;		// Milliseconds since the most recent measurement
+	uint32_t samples = 0;
+
+	String toString() const;
+};
+
+/**
+ * Keeps filtered LTE link quality from periodic AT+CESQ/AT+UCGED measurements.
+ *
+ * Call sample() periodically, for example from a CellularHelperScheduler job. getLinkState()
+ * only reads the stored values, so it can be called every cycle without a modem round trip.
+ *
+ * Each metric is smoothed with an EWMA with weight 1 / (1 << smoothingShift) for the newest
+ * value (default 1/4), and recorded in a fixed-size histogram for percentiles.
+ *
+ * Not synchronized; call sample() and getLinkState() from the same thread.
+ */
+class CellularHelperLinkQuality {
+public:
+	CellularHelperLinkQuality();
+
+	/**
+	 * Measures the link with CellularHelper.getSignalSample() and adds the result.
+	 * Returns true if the measurement was good.
+	 */
+	bool sample(bool includeSinr = true);
+
+	void add(const CellularHelperSignalSample &sample);
+	void clear();
+
+	CellularHelperLinkState getLinkState() const;
+
+	void setSmoothingShift(int shift) { smoothingShift = shift; }
+
+	void logStats() const;
+
+	/**
+	 * Converts a Cat M1 RSRP in dBm to 0 - 4 bars
+	 */
+	static int rsrpToBars(int rsrp);
+
+	CellularHelperLinkMetric rsrp;
+	CellularHelperLinkMetric rsrq;
+	CellularHelperLinkMetric sinr;
+
+	uint32_t failures = 0;		// Measurements with no signal or an error
+
+protected:
+	int smoothingShift = 2;
+	bool lastValid = false;
+	system_tick_t lastSampleTime = 0;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERLINKQUALITY_H */
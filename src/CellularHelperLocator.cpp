@@ -0,0 +1,137 @@
+#include "CellularHelperLocator.h"
+
+#if Wiring_Cellular
+
+String CellularHelperLocationFix::toString() const {
+	if (valid) {
+		return String::format("lat=%f lon=%f alt=%d uncertainty=%d ci=0x%x tac=0x%x age=%lus", lat, lon, alt, uncertainty,
+			ci, tac, (unsigned long)(getAgeMs() / 1000));
+	}
+	else {
+		return "valid=false";
+	}
+}
+
+CellularHelperLocator::CellularHelperLocator() : received(false) {
+	response[0] = 0;
+}
+
+CellularHelperLocator::~CellularHelperLocator() {
+	CellularHelper.removeURCHandler("UULOC", uulocHandler, this);
+}
+
+bool CellularHelperLocator::request(LocationFunction fn, void *context, unsigned long timeoutMs, bool allowCached) {
+	if (pending) {
+		return false;
+	}
+
+	CellularHelperCEREGResponse reg;
+	CellularHelper.getCEREG(reg);
+	requestCi = reg.valid ? reg.ci : -1;
+	requestTac = reg.valid ? reg.lac : -1;
+
+	if (allowCached && cachedFix.valid && requestCi >= 0 && cachedFix.ci == requestCi && cachedFix.tac == requestTac &&
+		cachedFix.getAgeMs() < maxAgeMs) {
+		cacheHits++;
+		fn(cachedFix, true, context);
+		return true;
+	}
+
+	if (CellularHelper.command(NULL, 5000, "AT+ULOCCELL=0\r\n") != RESP_OK) {
+		return false;
+	}
+
+	received = false;
+	if (!CellularHelper.addURCHandler("UULOC", uulocHandler, this)) {
+		return false;
+	}
+
+	// Note: Command is ULOC, but the response is UULOC, usually well after the OK
+	if (CellularHelper.command(NULL, CellularHelperClass::DEFAULT_TIMEOUT, "AT+ULOC=2,2,0,%lu,5000\r\n", timeoutMs / 1000) != RESP_OK) {
+		CellularHelper.removeURCHandler("UULOC", uulocHandler, this);
+		return false;
+	}
+
+	this->fn = fn;
+	this->context = context;
+	this->timeoutMs = timeoutMs;
+	startTime = lastPoll = millis();
+	requests++;
+	pending = true;
+	return true;
+}
+
+void CellularHelperLocator::loop() {
+	if (!pending) {
+		return;
+	}
+
+	if (!received && millis() - lastPoll >= POLL_INTERVAL_MS) {
+		lastPoll = millis();
+		CellularHelper.pollURCs(100);
+	}
+
+	if (received) {
+		CellularHelperLocationResponse resp;
+		resp.string = response;
+		resp.postProcess();
+
+		CellularHelperLocationFix fix;
+		if (resp.valid) {
+			fix.valid = true;
+			fix.lat = resp.lat;
+			fix.lon = resp.lon;
+			fix.alt = resp.alt;
+			fix.uncertainty = resp.uncertainty;
+			fix.ci = requestCi;
+			fix.tac = requestTac;
+			fix.time = millis();
+			cachedFix = fix;
+			lastRequestMs = fix.time - startTime;
+		}
+		complete(fix);
+	}
+	else
+	if (millis() - startTime >= timeoutMs) {
+		timeouts++;
+		complete(CellularHelperLocationFix());
+	}
+}
+
+void CellularHelperLocator::cancel() {
+	if (pending) {
+		complete(CellularHelperLocationFix());
+	}
+}
+
+void CellularHelperLocator::complete(const CellularHelperLocationFix &fix) {
+	CellularHelper.removeURCHandler("UULOC", uulocHandler, this);
+	pending = false;
+	fn(fix, false, context);
+}
+
+// static
+void CellularHelperLocator::uulocHandler(const char *value, size_t valueLen, void *context) {
+	CellularHelperLocator *locator = (CellularHelperLocator *)context;
+
+	// +UULOC: <date>,<time>,<lat>,<long>,<alt>,<uncertainty>...
+	// Keep the first one; loop() parses it
+	if (locator->received) {
+		return;
+	}
+	if (valueLen > MAX_RESPONSE_LEN) {
+		valueLen = MAX_RESPONSE_LEN;
+	}
+	memcpy(locator->response, value, valueLen);
+	locator->response[valueLen] = 0;
+	locator->received = true;
+}
+
+void CellularHelperLocator::logStats() const {
+	Log.info("locate %s cacheHits=%lu requests=%lu timeouts=%lu lastRequest=%lums maxAge=%lus", pending ? "pending" : "idle",
+		(unsigned long)cacheHits, (unsigned long)requests, (unsigned long)timeouts, (unsigned long)lastRequestMs,
+		(unsigned long)(maxAgeMs / 1000));
+	Log.info("locate cached %s", cachedFix.toString().c_str());
+}
+
+#endif /* Wiring_Cellular */
@@ -0,0 +1,108 @@
+#ifndef __CELLULARHELPERLOCATOR_H
+#define __CELLULARHELPERLOCATOR_H
+
+#include "CellularHelper.h"
+
+#include <atomic>
+
+#if Wiring_Cellular
+
+/**
+ * A CellLocate fix and the serving cell it was made on
+ */
+class CellularHelperLocationFix {
+public:
+	bool valid = false;
+	float lat = 0.0;
+	float lon = 0.0;
+	int alt = 0;
+	int uncertainty = 0;			// Meters
+	int ci = -1;					// Serving cell when the fix was made, -1 if unknown
+	int tac = -1;
+	system_tick_t time = 0;			// millis() when the fix was made
+
+	system_tick_t getAgeMs() const { return millis() - time; }
+
+	String toString() const;
+};
+
+/**
+ * Non-blocking CellLocate (AT+ULOC) with a cached last fix.
+ *
+ * request() returns right away. If the device is still on the cell where the last fix was
+ * made and the fix is younger than the maximum age, the cached fix is delivered to the
+ * callback immediately, which costs one local AT+CEREG query instead of a CellLocate round
+ * trip. Otherwise AT+ULOC is sent and loop() polls for the +UULOC URC and calls the callback
+ * with the new fix, or with an invalid fix on timeout.
+ *
+ * Call request() and loop() from the same thread.
+ */
+class CellularHelperLocator {
+public:
+	typedef void (*LocationFunction)(const CellularHelperLocationFix &fix, bool fromCache, void *context);
+
+	static const system_tick_t POLL_INTERVAL_MS = 500;
+	static const size_t MAX_RESPONSE_LEN = 127;
+
+	CellularHelperLocator();
+	~CellularHelperLocator();
+
+	/**
+	 * Requests a location. fn is called once, from request() for a cached fix or from loop().
+	 * Set allowCached to false to always ask CellLocate. Returns false if a request is already
+	 * pending or the modem rejected AT+ULOC.
+	 */
+	bool request(LocationFunction fn, void *context = NULL, unsigned long timeoutMs = CellularHelperClass::DEFAULT_TIMEOUT, bool allowCached = true);
+
+	/**
+	 * Polls a pending request. Call from loop().
+	 */
+	void loop();
+
+	/**
+	 * Gives up on a pending request. The callback is called with an invalid fix.
+	 */
+	void cancel();
+
+	bool isPending() const { return pending; }
+
+	const CellularHelperLocationFix &getCachedFix() const { return cachedFix; }
+	void clearCachedFix() { cachedFix = CellularHelperLocationFix(); }
+
+	/**
+	 * A cached fix older than this is not reused even on the same cell. Default 24 hours.
+	 */
+	void setMaxAge(system_tick_t ms) { maxAgeMs = ms; }
+
+	void logStats() const;
+
+	uint32_t cacheHits = 0;
+	uint32_t requests = 0;			// Sent to CellLocate
+	uint32_t timeouts = 0;
+	uint32_t lastRequestMs = 0;		// Time the last CellLocate fix took
+
+protected:
+	static void uulocHandler(const char *value, size_t valueLen, void *context);
+
+	void complete(const CellularHelperLocationFix &fix);
+
+	bool pending = false;
+	LocationFunction fn = NULL;
+	void *context = NULL;
+	system_tick_t startTime = 0;
+	system_tick_t lastPoll = 0;
+	unsigned long timeoutMs = 0;
+	int requestCi = -1;
+	int requestTac = -1;
+
+	// Written by uulocHandler on the modem worker thread, then received is set
+	char response[MAX_RESPONSE_LEN + 1];
+	std::atomic<bool> received;
+
+	CellularHelperLocationFix cachedFix;
+	system_tick_t maxAgeMs = 24 * 3600 * 1000;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERLOCATOR_H */
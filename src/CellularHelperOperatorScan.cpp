@@ -0,0 +1,191 @@
+#include "CellularHelperOperatorScan.h"
+
+#if Wiring_Cellular
+
+String CellularHelperOperatorInfo::toString() const {
+	static const char * const statNames[] = { "unknown", "available", "current", "forbidden" };
+	return String::format("%s \"%s\" \"%s\" act=%d %s", numeric, longName, shortName, act,
+		(stat >= 0 && stat <= STAT_FORBIDDEN) ? statNames[stat] : "unknown");
+}
+
+CellularHelperOperatorScan::CellularHelperOperatorScan() : parsed(0), received(false), dropped(0) {
+}
+
+CellularHelperOperatorScan::~CellularHelperOperatorScan() {
+	CellularHelper.removeURCHandler("COPS", copsHandler, this);
+	if (running) {
+		CellularHelper.queue.release();
+	}
+}
+
+bool CellularHelperOperatorScan::start(system_tick_t timeoutMs, bool allowCached) {
+	if (running) {
+		return false;
+	}
+
+	if (allowCached && cached.complete && cached.getAgeMs() < maxAgeMs) {
+		cacheHits++;
+		for(size_t ii = 0; ii < cached.count; ii++) {
+			if (operatorFn) {
+				operatorFn(cached.operators[ii], operatorContext);
+			}
+		}
+		if (doneFn) {
+			doneFn(*this, true, doneContext);
+		}
+		return true;
+	}
+
+	results = CellularHelperOperatorList();
+	parsed = 0;
+	received = false;
+	delivered = 0;
+	if (!CellularHelper.addURCHandler("COPS", copsHandler, this)) {
+		return false;
+	}
+
+	// Only waits long enough for the modem to reject the command. The result usually comes
+	// minutes later and is collected by copsHandler while loop() polls. Other commands are
+	// refused until then, since any character sent to the modem aborts the scan.
+	CellularHelper.queue.reserve();
+	if (CellularHelper.rawCommand(NULL, SEND_TIMEOUT_MS, "AT+COPS=?\r\n", true) == RESP_ERROR) {
+		CellularHelper.queue.release();
+		CellularHelper.removeURCHandler("COPS", copsHandler, this);
+		return false;
+	}
+
+	this->timeoutMs = timeoutMs;
+	startTime = lastPoll = millis();
+	scans++;
+	running = true;
+	return true;
+}
+
+void CellularHelperOperatorScan::loop() {
+	if (!running) {
+		return;
+	}
+
+	if (!received && millis() - lastPoll >= POLL_INTERVAL_MS) {
+		lastPoll = millis();
+		CellularHelper.pollURCs(100);
+	}
+
+	// Check received before delivering, so no operator parsed before it was set is missed
+	bool done = received.load(std::memory_order_acquire);
+	deliver();
+
+	if (done) {
+		lastScanMs = millis() - startTime;
+		finish(true);
+	}
+	else
+	if (millis() - startTime >= timeoutMs) {
+		timeouts++;
+		cancel();
+	}
+}
+
+void CellularHelperOperatorScan::cancel() {
+	if (!running) {
+		return;
+	}
+	if (!received) {
+		// Any character aborts the scan on the modem
+		CellularHelper.rawCommand(NULL, SEND_TIMEOUT_MS, "AT\r\n", true);
+		cancels++;
+	}
+	deliver();
+	finish(received);
+}
+
+void CellularHelperOperatorScan::deliver() {
+	size_t count = parsed.load(std::memory_order_acquire);
+	while(delivered < count) {
+		const CellularHelperOperatorInfo &op = results.operators[delivered++];
+		if (operatorFn) {
+			operatorFn(op, operatorContext);
+		}
+	}
+}
+
+void CellularHelperOperatorScan::finish(bool complete) {
+	CellularHelper.removeURCHandler("COPS", copsHandler, this);
+	CellularHelper.queue.release();
+	running = false;
+
+	results.count = delivered;
+	results.complete = complete;
+	results.time = millis();
+	if (complete) {
+		cached = results;
+	}
+
+	if (doneFn) {
+		doneFn(*this, false, doneContext);
+	}
+}
+
+// static
+void CellularHelperOperatorScan::copsHandler(const char *value, size_t valueLen, void *context) {
+	CellularHelperOperatorScan *scan = (CellularHelperOperatorScan *)context;
+
+	// +COPS: (<stat>,"<long>","<short>","<numeric>"[,<AcT>]),...,,(<modes>),(<formats>)
+	// The list is empty (the response starts with ,,) if no network was found. The response to
+	// AT+COPS? has the same prefix but starts with a digit, and is ignored.
+	const char *p = value;
+	const char *end = value + valueLen;
+	if (p >= end || (*p != '(' && *p != ',') || scan->received) {
+		return;
+	}
+
+	uint32_t count = scan->parsed.load(std::memory_order_relaxed);
+	while(p < end && *p == '(') {
+		const char *close = (const char *)memchr(p, ')', end - p);
+		if (!close) {
+			break;
+		}
+		p++;
+
+		CellularHelperOperatorInfo info;
+		int stat, act;
+		if (CellularHelperFields::scanInt(p, close, stat) &&
+			CellularHelperFields::scanQuoted(p, close, info.longName, sizeof(info.longName)) &&
+			CellularHelperFields::scanQuoted(p, close, info.shortName, sizeof(info.shortName)) &&
+			CellularHelperFields::scanQuoted(p, close, info.numeric, sizeof(info.numeric))) {
+			info.stat = (int8_t)stat;
+			if (CellularHelperFields::scanInt(p, close, act)) {
+				info.act = (int8_t)act;
+			}
+
+			if (count < CellularHelperOperatorList::MAX_OPERATORS) {
+				scan->results.operators[count++] = info;
+				scan->parsed.store(count, std::memory_order_release);
+			}
+			else {
+				scan->dropped++;
+			}
+		}
+
+		// The operators end at the empty field before the supported modes and formats
+		p = close + 1;
+		if (p < end && *p == ',') {
+			p++;
+		}
+	}
+	scan->received.store(true, std::memory_order_release);
+}
+
+void CellularHelperOperatorScan::logStats() const {
+	Log.info("opscan %s scans=%lu cacheHits=%lu timeouts=%lu cancels=%lu dropped=%lu lastScan=%lums maxAge=%lus",
+		running ? "running" : "idle", (unsigned long)scans, (unsigned long)cacheHits, (unsigned long)timeouts,
+		(unsigned long)cancels, (unsigned long)dropped.load(), (unsigned long)lastScanMs, (unsigned long)(maxAgeMs / 1000));
+	if (cached.count > 0 || cached.complete) {
+		Log.info("opscan cached %u operators, age %lus", (unsigned)cached.count, (unsigned long)(cached.getAgeMs() / 1000));
+		for(size_t ii = 0; ii < cached.count; ii++) {
+			Log.info("opscan %s", cached.operators[ii].toString().c_str());
+		}
+	}
+}
+
+#endif /* Wiring_Cellular */
@@ -0,0 +1,150 @@
+#ifndef __CELLULARHELPEROPERATORSCAN_H
+#define __CELLULARHELPEROPERATORSCAN_H
+
+#include "CellularHelper.h"
+
+#include <atomic>
+
+#if Wiring_Cellular
+
+/**
+ * One network from the AT+COPS=? operator list
+ */
+class CellularHelperOperatorInfo {
+public:
+	static const int STAT_UNKNOWN = 0;
+	static const int STAT_AVAILABLE = 1;
+	static const int STAT_CURRENT = 2;
+	static const int STAT_FORBIDDEN = 3;
+
+	int8_t stat = STAT_UNKNOWN;
+	int8_t act = -1;				// 7 = LTE Cat M1, 8 = NB-IoT, -1 if not reported
+	char longName[24] = {0};		// Truncated if longer
+	char shortName[16] = {0};
+	char numeric[8] = {0};			// MCC and MNC, for example "24201"
+
+	String toString() const;
+};
+
+/**
+ * The networks found by one scan
+ */
+class CellularHelperOperatorList {
+public:
+	static const size_t MAX_OPERATORS = 10;
+
+	CellularHelperOperatorInfo operators[MAX_OPERATORS];
+	size_t count = 0;
+	bool complete = false;			// The modem returned the whole list
+	system_tick_t time = 0;			// millis() when the scan finished
+
+	system_tick_t getAgeMs() const { return millis() - time; }
+};
+
+/**
+ * Non-blocking operator scan (AT+COPS=?) with a cached result.
+ *
+ * A full scan can take minutes on the SARA-R410M. start() sends AT+COPS=? with a short
+ * timeout and returns; the modem keeps scanning and the +COPS response is picked up later by
+ * a URC handler while loop() polls. The modem sends the whole list as one line when the scan
+ * ends, so there is no feedback while it runs. loop() then passes each operator to the
+ * operator callback and calls the done callback. A complete result is kept with its time, and
+ * start() can return it instead of scanning again while it is younger than the maximum age.
+ *
+ * The modem aborts the scan when it receives any character. The command queue is reserved
+ * while the scan runs, so commands from the rest of the app and other threads are refused
+ * with RESP_ABORTED instead of ending it early. cancel() sends a character on purpose.
+ *
+ * The URC handler runs on the modem worker thread and only fills the list; loop() makes the
+ * callbacks. Call everything else from one thread.
+ */
+class CellularHelperOperatorScan {
+public:
+	typedef void (*OperatorFunction)(const CellularHelperOperatorInfo &op, void *context);
+	typedef void (*DoneFunction)(CellularHelperOperatorScan &scan, bool fromCache, void *context);
+
+	static const system_tick_t DEFAULT_TIMEOUT_MS = 180000;
+	static const system_tick_t SEND_TIMEOUT_MS = 1000;
+	static const system_tick_t POLL_INTERVAL_MS = 1000;
+
+	CellularHelperOperatorScan();
+	~CellularHelperOperatorScan();
+
+	void onOperator(OperatorFunction fn, void *context = NULL) { operatorFn = fn; operatorContext = context; }
+	void onDone(DoneFunction fn, void *context = NULL) { doneFn = fn; doneContext = context; }
+
+	/**
+	 * Starts a scan. If allowCached is true and the last complete scan is younger than the
+	 * maximum age, its operators and the done callback are delivered from start() instead.
+	 * Returns false if a scan is already running or the modem rejected AT+COPS=?.
+	 */
+	bool start(system_tick_t timeoutMs = DEFAULT_TIMEOUT_MS, bool allowCached = true);
+
+	/**
+	 * Drives a running scan. Call from loop().
+	 */
+	void loop();
+
+	/**
+	 * Aborts a running scan. The operators received so far are kept in getResults() and the
+	 * done callback is called.
+	 */
+	void cancel();
+
+	bool isRunning() const { return running; }
+
+	/**
+	 * The last scan, which may be partial if it was cancelled or timed out
+	 */
+	const CellularHelperOperatorList &getResults() const { return results; }
+
+	/**
+	 * The last complete scan. count is 0 if there has not been one.
+	 */
+	const CellularHelperOperatorList &getCached() const { return cached; }
+	void clearCached() { cached = CellularHelperOperatorList(); }
+
+	/**
+	 * A cached scan older than this is not reused. Default 10 minutes.
+	 */
+	void setMaxAge(system_tick_t ms) { maxAgeMs = ms; }
+
+	void logStats() const;
+
+	uint32_t scans = 0;				// Sent to the modem
+	uint32_t cacheHits = 0;
+	uint32_t timeouts = 0;
+	uint32_t cancels = 0;
+	uint32_t lastScanMs = 0;		// Time the last complete scan took
+
+protected:
+	static void copsHandler(const char *value, size_t valueLen, void *context);
+
+	void deliver();
+	void finish(bool complete);
+
+	bool running = false;
+	system_tick_t startTime = 0;
+	system_tick_t lastPoll = 0;
+	system_tick_t timeoutMs = 0;
+	size_t delivered = 0;
+
+	// Filled by copsHandler on the modem worker thread. parsed is stored after each
+	// operator and received after the whole response.
+	CellularHelperOperatorList results;
+	std::atomic<uint32_t> parsed;
+	std::atomic<bool> received;
+	std::atomic<uint32_t> dropped;
+
+	CellularHelperOperatorList cached;
+	system_tick_t maxAgeMs = 10 * 60 * 1000;
+
+	OperatorFunction operatorFn = NULL;
+	void *operatorContext = NULL;
+	DoneFunction doneFn = NULL;
+	void *doneContext = NULL;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPEROPERATORSCAN_H */
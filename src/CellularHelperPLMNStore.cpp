@@ -0,0 +1,253 @@
+#include "CellularHelperPLMNStore.h"
+
+#if Wiring_Cellular
+
+static bool isRegistered(const CellularHelperCEREGResponse &reg) {
+	// 1 = home, 5 = roaming
+	return reg.valid && (reg.stat == 1 || reg.stat == 5);
+}
+
+// The AcT numbering differs between the commands on the SARA-R4: AT+CEREG reports NB-IoT as 9
+// (E-UTRAN NB-S1) but AT+COPS selects it with 8. Cat M1 is 7 in both.
+static int8_t ceregToCopsAct(int act) {
+	switch(act) {
+	case 7:
+		return 7;
+	case 9:
+		return 8;
+	default:
+		return -1;
+	}
+}
+
+String CellularHelperPLMNRecord::toString() const {
+	if (isValid()) {
+		return String::format("plmn=%s act=%d band=%u tac=0x%lx ci=0x%lx registerMs=%lu seq=%lu", mccMnc, act, band,
+			(unsigned long)tac, (unsigned long)ci, (unsigned long)registerMs, (unsigned long)seq);
+	}
+	else {
+		return "valid=false";
+	}
+}
+
+void CellularHelperPLMNEEPROMStorage::read(size_t offset, uint8_t *buf, size_t len) {
+	for(size_t ii = 0; ii < len; ii++) {
+		buf[ii] = EEPROM.read(baseAddress + offset + ii);
+	}
+}
+
+void CellularHelperPLMNEEPROMStorage::write(size_t offset, const uint8_t *buf, size_t len) {
+	for(size_t ii = 0; ii < len; ii++) {
+		// Unchanged bytes cost no flash write
+		if (EEPROM.read(baseAddress + offset + ii) != buf[ii]) {
+			EEPROM.write(baseAddress + offset + ii, buf[ii]);
+		}
+	}
+}
+
+// static
+uint32_t CellularHelperPLMNStore::calculateCrc(const CellularHelperPLMNRecord &record) {
+	// CRC-32 of everything before the crc field
+	const uint8_t *p = (const uint8_t *)&record;
+	uint32_t crc = 0xffffffff;
+	for(size_t ii = 0; ii < offsetof(CellularHelperPLMNRecord, crc); ii++) {
+		crc ^= p[ii];
+		for(int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+bool CellularHelperPLMNStore::readSlot(size_t slot, CellularHelperPLMNRecord &record) {
+	storage.read(slot * sizeof(CellularHelperPLMNRecord), (uint8_t *)&record, sizeof(record));
+	return record.crc == calculateCrc(record) && record.mccMnc[sizeof(record.mccMnc) - 1] == 0 && record.isValid();
+}
+
+int CellularHelperPLMNStore::findNewest(CellularHelperPLMNRecord &record) {
+	int newest = -1;
+	CellularHelperPLMNRecord slotRecord;
+	for(size_t ii = 0; ii < NUM_SLOTS; ii++) {
+		if (readSlot(ii, slotRecord) && (newest < 0 || (int32_t)(slotRecord.seq - record.seq) > 0)) {
+			record = slotRecord;
+			newest = (int)ii;
+		}
+	}
+	return newest;
+}
+
+bool CellularHelperPLMNStore::load(CellularHelperPLMNRecord &record) {
+	if (findNewest(record) < 0) {
+		record = CellularHelperPLMNRecord();
+		return false;
+	}
+	return true;
+}
+
+bool CellularHelperPLMNStore::save(const CellularHelperPLMNRecord &record) {
+	CellularHelperPLMNRecord newest;
+	int slot = findNewest(newest);
+	if (slot >= 0 && strcmp(newest.mccMnc, record.mccMnc) == 0 && newest.act == record.act &&
+		newest.band == record.band && newest.tac == record.tac && newest.ci == record.ci) {
+		return false;
+	}
+
+	CellularHelperPLMNRecord toWrite = record;
+	toWrite.seq = (slot >= 0) ? newest.seq + 1 : 1;
+	memset(toWrite.reserved, 0, sizeof(toWrite.reserved));
+	toWrite.crc = calculateCrc(toWrite);
+
+	// Overwrite the slot after the newest, which is the oldest
+	size_t next = (slot >= 0) ? (slot + 1) % NUM_SLOTS : 0;
+	storage.write(next * sizeof(CellularHelperPLMNRecord), (const uint8_t *)&toWrite, sizeof(toWrite));
+	writes++;
+	return true;
+}
+
+void CellularHelperPLMNStore::clear() {
+	CellularHelperPLMNRecord empty;
+	for(size_t ii = 0; ii < NUM_SLOTS; ii++) {
+		storage.write(ii * sizeof(CellularHelperPLMNRecord), (const uint8_t *)&empty, sizeof(empty));
+	}
+}
+
+int CellularHelperPLMNStore::getSeenBands(const char *mccMnc, CellularHelperBandMask &mask) {
+	int result = 0;
+	CellularHelperPLMNRecord record;
+	for(size_t ii = 0; ii < NUM_SLOTS; ii++) {
+		if (readSlot(ii, record) && record.band != 0 && (mccMnc == NULL || strcmp(record.mccMnc, mccMnc) == 0)) {
+			mask.add(record.band);
+			result++;
+		}
+	}
+	return result;
+}
+
+bool CellularHelperFastAttach::waitRegistered(system_tick_t startTime, system_tick_t timeoutMs) {
+	while(millis() - startTime < timeoutMs && !CellularHelper.isAbortRequested()) {
+		// A cached answer could be up to the cache freshness old and delay the registered time
+		CellularHelperCEREGResponse reg;
+		CellularHelper.getCEREG(reg, true);
+		if (isRegistered(reg)) {
+			return true;
+		}
+		delay(1000);
+	}
+	return false;
+}
+
+bool CellularHelperFastAttach::attach(system_tick_t timeoutMs, system_tick_t targetedMs) {
+	system_tick_t startTime = millis();
+	bool registered = false;
+
+	// Leave automatic selection at least half of the time if the stored network is not found
+	if (targetedMs > timeoutMs / 2) {
+		targetedMs = timeoutMs / 2;
+	}
+
+	CellularHelperPLMNRecord record;
+	lastTargeted = false;
+	previousAttachMs = 0;
+	if (store.load(record)) {
+		previousAttachMs = record.registerMs;
+		Log.info("attach trying stored %s", record.toString().c_str());
+		if (CellularHelper.selectOperator(record.mccMnc, record.act)) {
+			registered = waitRegistered(millis(), targetedMs);
+		}
+		if (registered) {
+			// AT+COPS=4 falls back to automatic selection in the modem, so check where it went
+			char numeric[32];
+			CellularHelper.getOperatorName(numeric, sizeof(numeric), CellularHelperClass::OPERATOR_NAME_NUMERIC);
+			lastTargeted = (strcmp(numeric, record.mccMnc) == 0);
+		}
+	}
+
+	if (!registered && !CellularHelper.isAbortRequested()) {
+		Log.info("attach using automatic selection");
+		if (CellularHelper.selectOperator(NULL)) {
+			system_tick_t elapsed = millis() - startTime;
+			registered = waitRegistered(millis(), (elapsed < timeoutMs) ? timeoutMs - elapsed : 0);
+		}
+	}
+
+	lastAttachMs = millis() - startTime;
+	if (!registered) {
+		failures++;
+		Log.info("attach failed after %lu ms", (unsigned long)lastAttachMs);
+		return false;
+	}
+
+	if (lastTargeted) {
+		targetedAttaches++;
+	}
+	else {
+		automaticAttaches++;
+	}
+	Log.info("attach registered %s in %lu ms", lastTargeted ? "on the stored network" : "by automatic selection",
+		(unsigned long)lastAttachMs);
+	if (previousAttachMs != 0) {
+		// Shows the effect of a band mask or network change since the record was saved
+		long change = (long)lastAttachMs - (long)previousAttachMs;
+		Log.info("attach time %+ld ms compared to %lu ms when saved", change, (unsigned long)previousAttachMs);
+	}
+
+	saveCurrent(lastAttachMs);
+	return true;
+}
+
+bool CellularHelperFastAttach::saveCurrent(uint32_t registerMs) {
+	// The buffer holds the whole +UDOPN value before the quoted part is kept
+	char numeric[32];
+	size_t len = CellularHelper.getOperatorName(numeric, sizeof(numeric), CellularHelperClass::OPERATOR_NAME_NUMERIC);
+
+	CellularHelperPLMNRecord record;
+	if (len < 5 || len >= sizeof(record.mccMnc)) {
+		return false;
+	}
+	strcpy(record.mccMnc, numeric);
+
+	CellularHelperCEREGResponse reg;
+	CellularHelper.getCEREG(reg);
+	if (!isRegistered(reg)) {
+		return false;
+	}
+	// Stored for AT+COPS, which only takes the LTE access technologies on the SARA-R4
+	record.act = ceregToCopsAct(reg.rat);
+	record.tac = (uint32_t)reg.lac;
+	record.ci = (uint32_t)reg.ci;
+	record.registerMs = registerMs;
+	int band = CellularHelper.getServingBand();
+	record.band = (band > 0 && band <= 255) ? (uint8_t)band : 0;
+
+	return store.save(record);
+}
+
+bool CellularHelperFastAttach::learnBandMask(int rat, CellularHelperBandMask &previous) {
+	CellularHelperBandMask seen;
+	if (store.getSeenBands(NULL, seen) == 0) {
+		Log.info("bands none stored yet");
+		return false;
+	}
+
+	if (!CellularHelper.getBandMask(rat, previous)) {
+		return false;
+	}
+
+	CellularHelperBandMask learned = seen.intersect(previous);
+	if (learned.isEmpty() || learned == previous) {
+		Log.info("bands already %s", previous.toString().c_str());
+		return false;
+	}
+
+	Log.info("bands %s (%d) narrowed to %s (%d)", previous.toString().c_str(), previous.count(),
+		learned.toString().c_str(), learned.count());
+	return CellularHelper.setBandMask(rat, learned);
+}
+
+void CellularHelperFastAttach::logStats() const {
+	Log.info("attach last=%lums previous=%lums %s targeted=%lu automatic=%lu failures=%lu writes=%lu", (unsigned long)lastAttachMs,
+		(unsigned long)previousAttachMs, lastTargeted ? "targeted" : "automatic", (unsigned long)targetedAttaches, (unsigned long)automaticAttaches,
+		(unsigned long)failures, (unsigned long)store.writes);
+}
+
+#endif /* Wiring_Cellular */
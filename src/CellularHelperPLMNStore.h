@@ -0,0 +1,150 @@
+#ifndef __CELLULARHELPERPLMNSTORE_H
+#define __CELLULARHELPERPLMNSTORE_H
+
+#include "CellularHelper.h"
+
+#if Wiring_Cellular
+
+/**
+ * The network the modem last registered on
+ */
+class CellularHelperPLMNRecord {
+public:
+	uint32_t seq = 0;				// Increases with each save; the highest valid slot is current
+	char mccMnc[8] = {0};			// Numeric, for example "310410"
+	int8_t act = -1;				// AT+COPS access technology (7 = Cat M1, 8 = NB-IoT), -1 if unknown
+	uint8_t band = 0;				// LTE band of the serving cell, 0 if unknown
+	uint8_t reserved[2] = {0};
+	uint32_t tac = 0;
+	uint32_t ci = 0;
+	uint32_t registerMs = 0;		// Time to register when this was saved
+	uint32_t crc = 0;
+
+	bool isValid() const { return mccMnc[0] != 0; }
+
+	String toString() const;
+};
+
+/**
+ * Byte storage for CellularHelperPLMNStore. A host build can implement this on a file.
+ */
+class CellularHelperPLMNStorage {
+public:
+	virtual ~CellularHelperPLMNStorage() {}
+
+	virtual void read(size_t offset, uint8_t *buf, size_t len) = 0;
+	virtual void write(size_t offset, const uint8_t *buf, size_t len) = 0;
+};
+
+/**
+ * CellularHelperPLMNStorage in the emulated EEPROM, starting at baseAddress
+ */
+class CellularHelperPLMNEEPROMStorage : public CellularHelperPLMNStorage {
+public:
+	CellularHelperPLMNEEPROMStorage(int baseAddress) : baseAddress(baseAddress) {}
+
+	virtual void read(size_t offset, uint8_t *buf, size_t len);
+	virtual void write(size_t offset, const uint8_t *buf, size_t len);
+
+protected:
+	int baseAddress;
+};
+
+/**
+ * Keeps the last good PLMN, RAT and serving cell across power cycles.
+ *
+ * Records are written round robin into NUM_SLOTS slots, each with a sequence number and a
+ * CRC, so a save spreads the writes and an interrupted save leaves the previous record
+ * readable. save() does not write if the network and cell are unchanged. Uses
+ * NUM_SLOTS * sizeof(CellularHelperPLMNRecord) bytes of storage.
+ */
+class CellularHelperPLMNStore {
+public:
+	static const size_t NUM_SLOTS = 4;
+
+	CellularHelperPLMNStore(CellularHelperPLMNStorage &storage) : storage(storage) {}
+
+	/**
+	 * Reads the newest valid record. Returns false if there is none.
+	 */
+	bool load(CellularHelperPLMNRecord &record);
+
+	/**
+	 * Saves record as the newest. Returns false if nothing was written because it matches
+	 * the newest record.
+	 */
+	bool save(const CellularHelperPLMNRecord &record);
+
+	/**
+	 * Invalidates all slots
+	 */
+	void clear();
+
+	/**
+	 * Adds the bands of all stored records for mccMnc (or any network if NULL) to mask.
+	 * Returns the number of records that had a band.
+	 */
+	int getSeenBands(const char *mccMnc, CellularHelperBandMask &mask);
+
+	uint32_t writes = 0;
+
+protected:
+	static uint32_t calculateCrc(const CellularHelperPLMNRecord &record);
+
+	bool readSlot(size_t slot, CellularHelperPLMNRecord &record);
+	int findNewest(CellularHelperPLMNRecord &record);
+
+	CellularHelperPLMNStorage &storage;
+};
+
+/**
+ * Registers using the stored PLMN first, falling back to automatic operator selection.
+ *
+ * A cold boot with automatic selection scans the bands for every network; selecting the
+ * network that worked last time lets the modem go straight to it.
+ */
+class CellularHelperFastAttach {
+public:
+	static const system_tick_t TARGETED_TIMEOUT_MS = 30000;
+
+	CellularHelperFastAttach(CellularHelperPLMNStore &store) : store(store) {}
+
+	/**
+	 * Waits up to timeoutMs for registration. Tries AT+COPS=4 with the stored PLMN and RAT for
+	 * up to targetedMs, but no more than half of timeoutMs, then AT+COPS=0 for the rest. On
+	 * success the current network is saved. Stops early if CellularHelper.requestAbort() is
+	 * called.
+	 */
+	bool attach(system_tick_t timeoutMs, system_tick_t targetedMs = TARGETED_TIMEOUT_MS);
+
+	/**
+	 * Saves the network the modem is registered on now
+	 */
+	bool saveCurrent(uint32_t registerMs);
+
+	/**
+	 * Narrows the AT+UBANDMASK for rat to the bands the stored networks were found on, so a
+	 * search does not scan bands that are not used here. previous is set to the mask before the
+	 * change, to restore it if the device moves. Only bands the modem already searches are
+	 * kept. Returns true if the mask was changed, which takes effect when the modem restarts.
+	 */
+	bool learnBandMask(int rat, CellularHelperBandMask &previous);
+
+	void logStats() const;
+
+	uint32_t lastAttachMs = 0;
+	uint32_t previousAttachMs = 0;	// Time to register saved with the stored record, 0 if none
+	bool lastTargeted = false;		// The last attach registered on the stored PLMN, not a fallback
+	uint32_t targetedAttaches = 0;
+	uint32_t automaticAttaches = 0;
+	uint32_t failures = 0;
+
+protected:
+	bool waitRegistered(system_tick_t startTime, system_tick_t timeoutMs);
+
+	CellularHelperPLMNStore &store;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERPLMNSTORE_H */
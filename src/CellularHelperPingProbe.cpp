@@ -0,0 +1,219 @@
+#include "CellularHelperPingProbe.h"
+
+#if Wiring_Cellular
+
+void CellularHelperPingStats::add(int32_t rttMs) {
+	if (received == 0) {
+		minMs = maxMs = rttMs;
+	}
+	else {
+		if (rttMs < minMs) {
+			minMs = rttMs;
+		}
+		if (rttMs > maxMs) {
+			maxMs = rttMs;
+		}
+		jitterSumMs += (rttMs > lastMs) ? rttMs - lastMs : lastMs - rttMs;
+	}
+	sumMs += rttMs;
+	lastMs = rttMs;
+	received++;
+}
+
+String CellularHelperPingStats::toString() const {
+	return String::format("sent=%u received=%u loss=%d%% min=%ld avg=%ld max=%ld jitter=%ld errors=%u",
+		sent, received, getLossPercent(), (long)minMs, (long)getAvgMs(), (long)maxMs, (long)getJitterMs(), errors);
+}
+
+CellularHelperPingProbe::CellularHelperPingProbe() : eventHead(0), eventTail(0), activeTarget(-1), eventsDropped(0) {
+}
+
+CellularHelperPingProbe::~CellularHelperPingProbe() {
+	CellularHelper.removeURCHandler("UUPING", uupingHandler, this);
+	CellularHelper.removeURCHandler("UUPINGER", uupingerHandler, this);
+}
+
+bool CellularHelperPingProbe::start(const char * const *hosts, size_t numHosts, int count, system_tick_t intervalMs) {
+	if (running || numHosts == 0 || numHosts > MAX_TARGETS || count < 1 || count > MAX_COUNT) {
+		return false;
+	}
+	for(size_t ii = 0; ii < numHosts; ii++) {
+		if (strlen(hosts[ii]) > MAX_HOST_LEN) {
+			return false;
+		}
+	}
+
+	for(size_t ii = 0; ii < numHosts; ii++) {
+		strcpy(targets[ii].host, hosts[ii]);
+		targets[ii].stats = CellularHelperPingStats();
+	}
+	numTargets = numHosts;
+
+	if (!CellularHelper.addURCHandler("UUPING", uupingHandler, this) ||
+		!CellularHelper.addURCHandler("UUPINGER", uupingerHandler, this)) {
+		CellularHelper.removeURCHandler("UUPING", uupingHandler, this);
+		return false;
+	}
+
+	this->count = count;
+	this->intervalMs = intervalMs;
+
+	current = 0;
+	currentStarted = false;
+	eventTail.store(eventHead.load());
+	running = true;
+	return true;
+}
+
+void CellularHelperPingProbe::stop() {
+	if (running) {
+		applyEvents();
+		finish();
+	}
+}
+
+void CellularHelperPingProbe::finish() {
+	activeTarget = -1;
+	running = false;
+	CellularHelper.removeURCHandler("UUPING", uupingHandler, this);
+	CellularHelper.removeURCHandler("UUPINGER", uupingerHandler, this);
+
+	if (doneFn) {
+		doneFn(*this, doneContext);
+	}
+}
+
+void CellularHelperPingProbe::loop() {
+	if (!running) {
+		return;
+	}
+
+	if (!currentStarted) {
+		Target &target = targets[current];
+
+		currentDone = 0;
+		currentStart = lastPoll = millis();
+		currentStarted = true;
+		activeTarget = (int)current;
+
+		// AT+UPING=<host>,<count>,<size>,<timeout>,<ttl>,<inter_packet_delay>
+		// Returns OK once accepted; one +UUPING per reply (rtt -1 on timeout) or +UUPINGER follows
+		int result = CellularHelper.command(NULL, CellularHelperClass::DEFAULT_TIMEOUT, "AT+UPING=\"%s\",%d,32,%lu,32,%lu\r\n",
+			target.host, count, (unsigned long)REPLY_TIMEOUT_MS, (unsigned long)intervalMs);
+		if (result != RESP_OK) {
+			target.stats.errors++;
+			currentDone = count;
+		}
+		else {
+			target.stats.sent = count;
+		}
+	}
+	else
+	if (millis() - lastPoll >= POLL_INTERVAL_MS) {
+		lastPoll = millis();
+		CellularHelper.pollURCs(100);
+	}
+
+	bool error = applyEvents();
+
+	system_tick_t budgetMs = (count - 1) * intervalMs + REPLY_TIMEOUT_MS + 2000;
+	if (error || currentDone >= count || millis() - currentStart >= budgetMs) {
+		Log.info("ping %s %s", targets[current].host, targets[current].stats.toString().c_str());
+
+		currentStarted = false;
+		if (++current >= numTargets) {
+			finish();
+		}
+	}
+}
+
+bool CellularHelperPingProbe::applyEvents() {
+	bool error = false;
+
+	uint32_t tail = eventTail.load(std::memory_order_relaxed);
+	uint32_t head = eventHead.load(std::memory_order_acquire);
+	for(; tail != head; tail++) {
+		const Event &event = events[tail % MAX_EVENTS];
+		if (event.target != current) {
+			// Late reply for a target that already timed out
+			continue;
+		}
+		CellularHelperPingStats &stats = targets[current].stats;
+		if (event.error) {
+			stats.errors++;
+			error = true;
+		}
+		else
+		if (event.rttMs >= 0) {
+			stats.add(event.rttMs);
+		}
+		currentDone++;
+	}
+	eventTail.store(tail, std::memory_order_release);
+
+	return error;
+}
+
+void CellularHelperPingProbe::addEvent(int target, int32_t rttMs, bool error) {
+	uint32_t head = eventHead.load(std::memory_order_relaxed);
+	if (head - eventTail.load(std::memory_order_acquire) >= MAX_EVENTS) {
+		eventsDropped++;
+		return;
+	}
+	Event &event = events[head % MAX_EVENTS];
+	event.rttMs = rttMs;
+	event.target = (uint8_t)target;
+	event.error = error;
+	eventHead.store(head + 1, std::memory_order_release);
+}
+
+// static
+void CellularHelperPingProbe::uupingHandler(const char *value, size_t valueLen, void *context) {
+	CellularHelperPingProbe *probe = (CellularHelperPingProbe *)context;
+
+	// +UUPING: <retry_num>,<p_size>,<remote_hostname>,<remote_ip>,<ttl>,<rtt>
+	const char *p = value;
+	const char *end = value + valueLen;
+	int retry, size, ttl, rtt;
+	const char *host, *ip;
+	size_t hostLen, ipLen;
+	if (!CellularHelperFields::scanInt(p, end, retry) || !CellularHelperFields::scanInt(p, end, size) ||
+		!CellularHelperFields::scanQuoted(p, end, host, hostLen) || !CellularHelperFields::scanQuoted(p, end, ip, ipLen) ||
+		!CellularHelperFields::scanInt(p, end, ttl) || !CellularHelperFields::scanInt(p, end, rtt)) {
+		return;
+	}
+
+	// Attribute the reply by the host it echoes, falling back to the target being probed
+	int target = probe->activeTarget;
+	for(size_t ii = 0; ii < probe->numTargets; ii++) {
+		const char *name = probe->targets[ii].host;
+		if ((strlen(name) == hostLen && strncmp(name, host, hostLen) == 0) ||
+			(strlen(name) == ipLen && strncmp(name, ip, ipLen) == 0)) {
+			target = (int)ii;
+			break;
+		}
+	}
+	if (target >= 0) {
+		probe->addEvent(target, rtt, false);
+	}
+}
+
+// static
+void CellularHelperPingProbe::uupingerHandler(const char *, size_t, void *context) {
+	// +UUPINGER: <error_code>
+	CellularHelperPingProbe *probe = (CellularHelperPingProbe *)context;
+	int target = probe->activeTarget;
+	if (target >= 0) {
+		probe->addEvent(target, -1, true);
+	}
+}
+
+void CellularHelperPingProbe::logStats() const {
+	Log.info("ping probe %s, target %u/%u, dropped=%lu", running ? "running" : "idle",
+		(unsigned)(running ? current + 1 : numTargets), (unsigned)numTargets, (unsigned long)eventsDropped.load());
+	for(size_t ii = 0; ii < numTargets; ii++) {
+		Log.info("ping %s %s", targets[ii].host, targets[ii].stats.toString().c_str());
+	}
+}
+
+#endif /* Wiring_Cellular */
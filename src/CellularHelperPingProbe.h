@@ -0,0 +1,141 @@
+#ifndef __CELLULARHELPERPINGPROBE_H
+#define __CELLULARHELPERPINGPROBE_H
+
+#include "CellularHelper.h"
+
+#include <atomic>
+
+#if Wiring_Cellular
+
+/**
+ * Round trip statistics for one probe target
+ */
+class CellularHelperPingStats {
+public:
+	uint16_t sent = 0;
+	uint16_t received = 0;
+	uint16_t errors = 0;			// +UUPINGER, for example the host did not resolve
+	int32_t minMs = 0;
+	int32_t maxMs = 0;
+	uint32_t sumMs = 0;
+	uint32_t jitterSumMs = 0;		// Sum of |rtt - previous rtt|
+	int32_t lastMs = -1;
+
+	void add(int32_t rttMs);
+
+	int32_t getAvgMs() const { return received ? (int32_t)(sumMs / received) : 0; }
+
+	/**
+	 * Mean difference between consecutive round trips
+	 */
+	int32_t getJitterMs() const { return (received > 1) ? (int32_t)(jitterSumMs / (received - 1)) : 0; }
+
+	/**
+	 * Percent of pings sent that got no reply
+	 */
+	int getLossPercent() const { return sent ? (sent - received) * 100 / sent : 0; }
+
+	String toString() const;
+};
+
+/**
+ * Sends a series of pings to each of several targets with AT+UPING and collects the round
+ * trip of every reply from the +UUPING URCs.
+ *
+ * start() only records the targets. loop() drives the probe from the application loop: it
+ * issues AT+UPING for one target at a time, which returns as soon as the modem accepts it,
+ * then polls for the URCs until all replies are in or the target's time runs out. Nothing
+ * blocks for longer than a short URC poll.
+ *
+ * The URC handlers run on the modem worker thread and only queue the results; loop() applies
+ * them. Call everything else from one thread.
+ */
+class CellularHelperPingProbe {
+public:
+	typedef void (*DoneFunction)(CellularHelperPingProbe &probe, void *context);
+
+	static const size_t MAX_TARGETS = 4;
+	static const size_t MAX_HOST_LEN = 63;
+	static const size_t MAX_EVENTS = 16;
+	static const int MAX_COUNT = 64;				// Modem limit per AT+UPING
+
+	static const system_tick_t REPLY_TIMEOUT_MS = 5000;
+	static const system_tick_t POLL_INTERVAL_MS = 250;
+
+	CellularHelperPingProbe();
+	~CellularHelperPingProbe();
+
+	/**
+	 * Starts probing. hosts are dotted octet strings or hostnames and are copied. Each target
+	 * gets count pings (1 to MAX_COUNT), intervalMs apart. Returns false if a probe is already
+	 * running, the arguments are out of range, or the URC handlers cannot be added.
+	 */
+	bool start(const char * const *hosts, size_t numHosts, int count = 10, system_tick_t intervalMs = 1000);
+
+	/**
+	 * Stops early. The statistics so far are kept and the done function is called.
+	 */
+	void stop();
+
+	/**
+	 * Drives a running probe. Call from loop().
+	 */
+	void loop();
+
+	bool isRunning() const { return running; }
+
+	void onDone(DoneFunction fn, void *context = NULL) { doneFn = fn; doneContext = context; }
+
+	size_t getNumTargets() const { return numTargets; }
+	const char *getHost(size_t index) const { return targets[index].host; }
+	const CellularHelperPingStats &getStats(size_t index) const { return targets[index].stats; }
+
+	void logStats() const;
+
+protected:
+	class Target {
+	public:
+		char host[MAX_HOST_LEN + 1];
+		CellularHelperPingStats stats;
+	};
+
+	class Event {
+	public:
+		int32_t rttMs;				// -1 for a ping that timed out
+		uint8_t target;
+		bool error;
+	};
+
+	static void uupingHandler(const char *value, size_t valueLen, void *context);
+	static void uupingerHandler(const char *value, size_t valueLen, void *context);
+
+	void addEvent(int target, int32_t rttMs, bool error);
+	bool applyEvents();
+	void finish();
+
+	Target targets[MAX_TARGETS];
+	size_t numTargets = 0;
+	int count = 0;
+	system_tick_t intervalMs = 0;
+
+	bool running = false;
+	size_t current = 0;
+	bool currentStarted = false;
+	uint16_t currentDone = 0;		// Replies, timeouts and errors seen for the current target
+	system_tick_t currentStart = 0;
+	system_tick_t lastPoll = 0;
+
+	// Written by the URC handlers on the modem worker thread, read by loop()
+	Event events[MAX_EVENTS];
+	std::atomic<uint32_t> eventHead;
+	std::atomic<uint32_t> eventTail;
+	std::atomic<int> activeTarget;
+	std::atomic<uint32_t> eventsDropped;
+
+	DoneFunction doneFn = NULL;
+	void *doneContext = NULL;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERPINGPROBE_H */
@@ -0,0 +1,212 @@
+#include "CellularHelperRadioState.h"
+
+#if Wiring_Cellular
+
+void CellularHelperRadioHour::add(const CellularHelperRadioHour &other) {
+	connectedMs += other.connectedMs;
+	idleMs += other.idleMs;
+	psmMs += other.psmMs;
+	unknownMs += other.unknownMs;
+	connections += other.connections;
+	psmEntries += other.psmEntries;
+}
+
+String CellularHelperRadioHour::toString() const {
+	return String::format("hour=%lu connected=%lus idle=%lus psm=%lus unknown=%lus connections=%u psmEntries=%u",
+		(unsigned long)hour, (unsigned long)(connectedMs / 1000), (unsigned long)(idleMs / 1000), (unsigned long)(psmMs / 1000),
+		(unsigned long)(unknownMs / 1000), connections, psmEntries);
+}
+
+CellularHelperRadioState::CellularHelperRadioState() : eventHead(0), eventTail(0), eventsDropped(0) {
+}
+
+bool CellularHelperRadioState::begin() {
+	if (!started) {
+		for(size_t ii = 0; ii < NUM_HOURS; ii++) {
+			hours[ii] = CellularHelperRadioHour();
+		}
+		totals = CellularHelperRadioHour();
+		state = STATE_UNKNOWN;
+		lastTime = hourStart = millis();
+		hourIndex = 0;
+		eventTail.store(eventHead.load());
+		started = true;
+	}
+
+	if (!CellularHelper.addURCHandler("CSCON", csconHandler, this) ||
+		!CellularHelper.addURCHandler("UUPSMR", uupsmrHandler, this)) {
+		end();
+		return false;
+	}
+
+	CellularHelper.command(NULL, CellularHelperClass::DEFAULT_TIMEOUT, "AT+CSCON=1\r\n");
+
+	// The +CSCON: <n>,<mode> response goes through csconHandler too
+	CellularHelper.command(NULL, CellularHelperClass::DEFAULT_TIMEOUT, "AT+CSCON?\r\n");
+	return true;
+}
+
+void CellularHelperRadioState::end() {
+	CellularHelper.removeURCHandler("CSCON", csconHandler, this);
+	CellularHelper.removeURCHandler("UUPSMR", uupsmrHandler, this);
+	if (started) {
+		update();
+		started = false;
+	}
+}
+
+// static
+const char *CellularHelperRadioState::getStateName(uint8_t state) {
+	switch(state) {
+	case STATE_IDLE:
+		return "idle";
+	case STATE_CONNECTED:
+		return "connected";
+	case STATE_PSM:
+		return "psm";
+	default:
+		return "unknown";
+	}
+}
+
+// static
+void CellularHelperRadioState::csconHandler(const char *value, size_t valueLen, void *context) {
+	// URC: +CSCON: <mode>
+	// Response to AT+CSCON?: +CSCON: <n>,<mode>
+	const char *p = value;
+	const char *end = value + valueLen;
+	int first, second;
+	if (!CellularHelperFields::scanInt(p, end, first)) {
+		return;
+	}
+	int mode = CellularHelperFields::scanInt(p, end, second) ? second : first;
+	if (mode == 0 || mode == 1) {
+		((CellularHelperRadioState *)context)->addEvent(mode ? STATE_CONNECTED : STATE_IDLE);
+	}
+}
+
+// static
+void CellularHelperRadioState::uupsmrHandler(const char *value, size_t valueLen, void *context) {
+	// +UUPSMR: <state>[,<param1>]
+	const char *p = value;
+	int stat;
+	if (CellularHelperFields::scanInt(p, value + valueLen, stat) && (stat == 0 || stat == 1)) {
+		((CellularHelperRadioState *)context)->addEvent(stat ? STATE_PSM : STATE_IDLE);
+	}
+}
+
+void CellularHelperRadioState::addEvent(uint8_t newState) {
+	uint32_t head = eventHead.load(std::memory_order_relaxed);
+	if (head - eventTail.load(std::memory_order_acquire) >= MAX_EVENTS) {
+		eventsDropped++;
+		return;
+	}
+	Event &event = events[head % MAX_EVENTS];
+	event.time = millis();
+	event.state = newState;
+	eventHead.store(head + 1, std::memory_order_release);
+}
+
+void CellularHelperRadioState::update() {
+	if (!started) {
+		return;
+	}
+
+	uint32_t tail = eventTail.load(std::memory_order_relaxed);
+	uint32_t head = eventHead.load(std::memory_order_acquire);
+	for(; tail != head; tail++) {
+		const Event &event = events[tail % MAX_EVENTS];
+
+		// Events from before begin() or out of order by a tick count as now
+		if ((int32_t)(event.time - lastTime) > 0) {
+			account(event.time);
+		}
+		if (event.state != state) {
+			if (event.state == STATE_CONNECTED) {
+				current().connections++;
+				totals.connections++;
+			}
+			else
+			if (event.state == STATE_PSM) {
+				current().psmEntries++;
+				totals.psmEntries++;
+			}
+			Log.trace("radio %s -> %s", getStateName(state), getStateName(event.state));
+			state = event.state;
+		}
+	}
+	eventTail.store(tail, std::memory_order_release);
+
+	account(millis());
+}
+
+void CellularHelperRadioState::account(system_tick_t now) {
+	while(true) {
+		system_tick_t hourEnd = hourStart + HOUR_MS;
+		bool crossesHour = (int32_t)(now - hourEnd) >= 0;
+		system_tick_t elapsed = (crossesHour ? hourEnd : now) - lastTime;
+
+		CellularHelperRadioHour &hour = current();
+		uint32_t *counter;
+		switch(state) {
+		case STATE_IDLE:
+			counter = &hour.idleMs;
+			totals.idleMs += elapsed;
+			break;
+		case STATE_CONNECTED:
+			counter = &hour.connectedMs;
+			totals.connectedMs += elapsed;
+			break;
+		case STATE_PSM:
+			counter = &hour.psmMs;
+			totals.psmMs += elapsed;
+			break;
+		default:
+			counter = &hour.unknownMs;
+			totals.unknownMs += elapsed;
+			break;
+		}
+		*counter += elapsed;
+
+		if (!crossesHour) {
+			lastTime = now;
+			break;
+		}
+
+		// Start the next hour, overwriting the oldest
+		lastTime = hourStart = hourEnd;
+		hourIndex++;
+		current() = CellularHelperRadioHour();
+		current().hour = hourIndex;
+	}
+}
+
+bool CellularHelperRadioState::getHour(size_t hoursAgo, CellularHelperRadioHour &result) {
+	update();
+	if (!started || hoursAgo >= NUM_HOURS || hoursAgo > hourIndex) {
+		return false;
+	}
+	result = hours[(hourIndex - hoursAgo) % NUM_HOURS];
+	return true;
+}
+
+void CellularHelperRadioState::logStats(size_t numHours) {
+	update();
+	if (!started) {
+		Log.info("radio state tracking not started");
+		return;
+	}
+
+	uint32_t total = totals.connectedMs + totals.idleMs + totals.psmMs + totals.unknownMs;
+	Log.info("radio state=%s connected=%lu.%lu%% dropped=%lu", getStateName(state),
+		(unsigned long)(total ? (uint64_t)totals.connectedMs * 1000 / total / 10 : 0),
+		(unsigned long)(total ? (uint64_t)totals.connectedMs * 1000 / total % 10 : 0), (unsigned long)eventsDropped.load());
+	Log.info("radio total %s", totals.toString().c_str());
+
+	CellularHelperRadioHour hour;
+	for(size_t ii = 0; ii < numHours && getHour(ii, hour); ii++) {
+		Log.info("radio %s", hour.toString().c_str());
+	}
+}
+
+#endif /* Wiring_Cellular */
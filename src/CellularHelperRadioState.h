@@ -0,0 +1,122 @@
+#ifndef __CELLULARHELPERRADIOSTATE_H
+#define __CELLULARHELPERRADIOSTATE_H
+
+#include "CellularHelper.h"
+
+#include <atomic>
+
+#if Wiring_Cellular
+
+/**
+ * Time spent in each radio state during one hour
+ */
+class CellularHelperRadioHour {
+public:
+	uint32_t hour = 0;				// Hours since begin()
+	uint32_t connectedMs = 0;		// RRC connected (+CSCON: 1)
+	uint32_t idleMs = 0;			// RRC idle (+CSCON: 0 or +UUPSMR: 0)
+	uint32_t psmMs = 0;				// In PSM (+UUPSMR: 1)
+	uint32_t unknownMs = 0;			// Before the first notification
+	uint16_t connections = 0;		// Transitions to connected
+	uint16_t psmEntries = 0;		// Transitions to PSM
+
+	void add(const CellularHelperRadioHour &other);
+
+	String toString() const;
+};
+
+/**
+ * Tracks RRC connected/idle and PSM transitions from the +CSCON and +UUPSMR URCs, and
+ * accumulates the time spent in each state per hour. Connected time is the main cost in
+ * battery terms, so this is a proxy for radio power from one firmware build to the next.
+ *
+ * The URC handlers run on the modem worker thread and only record the transition and its
+ * time in a small ring. update() applies them and accounts the time; it is called by the
+ * getters, or can be called from loop(). Call everything except the URC handlers from one
+ * thread.
+ *
+ * URCs are only seen while a command runs, so call CellularHelper.pollURCs() periodically
+ * (for example from a scheduler job) if nothing else talks to the modem. Transitions are
+ * timestamped when they are seen, so polling more often makes the times more accurate.
+ */
+class CellularHelperRadioState {
+public:
+	static const uint8_t STATE_UNKNOWN = 0;
+	static const uint8_t STATE_IDLE = 1;
+	static const uint8_t STATE_CONNECTED = 2;
+	static const uint8_t STATE_PSM = 3;
+
+	static const size_t NUM_HOURS = 24;
+	static const size_t MAX_EVENTS = 16;
+	static const system_tick_t HOUR_MS = 3600000;
+
+	CellularHelperRadioState();
+
+	/**
+	 * Enables +CSCON notifications, registers the URC handlers and queries the current state.
+	 * Returns false if the URC handler table is full.
+	 */
+	bool begin();
+
+	void end();
+
+	/**
+	 * Applies the transitions received since the last call and accounts time up to now
+	 */
+	void update();
+
+	uint8_t getState() { update(); return state; }
+
+	static const char *getStateName(uint8_t state);
+
+	/**
+	 * Gets the hour hoursAgo hours before the current one (0 is the current, partial hour).
+	 * Returns false if that hour is older than NUM_HOURS or before begin().
+	 */
+	bool getHour(size_t hoursAgo, CellularHelperRadioHour &result);
+
+	/**
+	 * Totals since begin()
+	 */
+	CellularHelperRadioHour getTotals() { update(); return totals; }
+
+	/**
+	 * Logs the current state, the totals and the last numHours hours
+	 */
+	void logStats(size_t numHours = NUM_HOURS);
+
+	uint32_t getEventsDropped() const { return eventsDropped; }
+
+protected:
+	class Event {
+	public:
+		system_tick_t time;
+		uint8_t state;
+	};
+
+	static void csconHandler(const char *value, size_t valueLen, void *context);
+	static void uupsmrHandler(const char *value, size_t valueLen, void *context);
+
+	void addEvent(uint8_t state);
+	void account(system_tick_t now);
+	CellularHelperRadioHour &current() { return hours[hourIndex % NUM_HOURS]; }
+
+	// Written by the URC handlers on the modem worker thread, read by update()
+	Event events[MAX_EVENTS];
+	std::atomic<uint32_t> eventHead;
+	std::atomic<uint32_t> eventTail;
+	std::atomic<uint32_t> eventsDropped;
+
+	bool started = false;
+	uint8_t state = STATE_UNKNOWN;
+	system_tick_t lastTime = 0;		// Time accounted up to
+	system_tick_t hourStart = 0;
+	uint32_t hourIndex = 0;
+
+	CellularHelperRadioHour hours[NUM_HOURS];
+	CellularHelperRadioHour totals;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERRADIOSTATE_H */
@@ -0,0 +1,171 @@
+#include "CellularHelperScheduler.h"
+
+CellularHelperScheduler::CellularHelperScheduler() {
+	clear();
+}
+
+void CellularHelperScheduler::clear() {
+	for(size_t ii = 0; ii < MAX_JOBS; ii++) {
+		jobs[ii].inUse = false;
+		jobs[ii].scheduled = false;
+	}
+	for(size_t ii = 0; ii < NUM_SLOTS; ii++) {
+		slots[ii] = -1;
+	}
+	maxSlackMs = 0;
+}
+
+int CellularHelperScheduler::addJob(const char *name, JobFunction fn, void *context, system_tick_t periodMs, system_tick_t slackMs, system_tick_t firstDelayMs) {
+	for(size_t ii = 0; ii < MAX_JOBS; ii++) {
+		Job &job = jobs[ii];
+		if (job.inUse) {
+			continue;
+		}
+
+		job.name = name;
+		job.fn = fn;
+		job.context = context;
+		job.periodMs = periodMs;
+		job.slackMs = slackMs;
+		job.deadline = millis() + (firstDelayMs ? firstDelayMs : periodMs);
+		job.runs = 0;
+		job.inUse = true;
+		insert(ii);
+
+		if (slackMs > maxSlackMs) {
+			maxSlackMs = slackMs;
+		}
+		return (int)ii;
+	}
+	return -1;
+}
+
+bool CellularHelperScheduler::removeJob(int id) {
+	if (id < 0 || id >= (int)MAX_JOBS || !jobs[id].inUse) {
+		return false;
+	}
+	if (jobs[id].scheduled) {
+		unlink(id);
+	}
+	jobs[id].inUse = false;
+	return true;
+}
+
+void CellularHelperScheduler::insert(int index) {
+	size_t slot = slotForDeadline(jobs[index].deadline);
+	jobs[index].next = slots[slot];
+	jobs[index].scheduled = true;
+	slots[slot] = (int8_t)index;
+}
+
+void CellularHelperScheduler::unlink(int index) {
+	int8_t *prev = &slots[slotForDeadline(jobs[index].deadline)];
+	while(*prev >= 0) {
+		if (*prev == index) {
+			*prev = jobs[index].next;
+			break;
+		}
+		prev = &jobs[*prev].next;
+	}
+	jobs[index].scheduled = false;
+}
+
+void CellularHelperScheduler::collectSlot(size_t slot, system_tick_t now, bool early, int8_t *ready, size_t &numReady) {
+	int8_t *prev = &slots[slot];
+	while(*prev >= 0) {
+		Job &job = jobs[*prev];
+		system_tick_t runAt = early ? (job.deadline - job.slackMs) : job.deadline;
+		if (isDue(runAt, now)) {
+			ready[numReady++] = *prev;
+			job.scheduled = false;
+			*prev = job.next;
+		}
+		else {
+			prev = &job.next;
+		}
+	}
+}
+
+void CellularHelperScheduler::loop() {
+	system_tick_t now = millis();
+	system_tick_t tick = now / TICK_MS;
+
+	if (!started) {
+		lastTick = tick;
+		started = true;
+	}
+
+	// Visit every slot passed since the last call, and the current one again since jobs
+	// can be added to it after it was visited. After a long gap (or millis() wrapping),
+	// visit each slot once.
+	int8_t ready[MAX_JOBS];
+	size_t numReady = 0;
+
+	system_tick_t numTicks = tick - lastTick + 1;
+	if (numTicks > NUM_SLOTS) {
+		numTicks = NUM_SLOTS;
+	}
+	for(system_tick_t ii = 0; ii < numTicks; ii++) {
+		collectSlot((tick - ii) % NUM_SLOTS, now, false, ready, numReady);
+	}
+	lastTick = tick;
+
+	if (numReady == 0) {
+		return;
+	}
+
+	// A window is open; pull in jobs that are allowed to run early
+	system_tick_t lookahead = maxSlackMs / TICK_MS + 1;
+	if (lookahead > NUM_SLOTS) {
+		lookahead = NUM_SLOTS;
+	}
+	for(system_tick_t ii = 0; ii < lookahead; ii++) {
+		collectSlot((tick + ii) % NUM_SLOTS, now, true, ready, numReady);
+	}
+
+	windows++;
+	if (windowFn) {
+		windowFn(true, windowContext);
+	}
+
+	for(size_t ii = 0; ii < numReady; ii++) {
+		Job &job = jobs[ready[ii]];
+
+		job.runs++;
+		jobRuns++;
+		job.fn(job.context);
+
+		if (!job.inUse || job.scheduled) {
+			// Removed or replaced by the job itself
+			continue;
+		}
+		if (job.periodMs == 0) {
+			job.inUse = false;
+			continue;
+		}
+
+		job.deadline += job.periodMs;
+		if (isDue(job.deadline, now)) {
+			// Fell behind by more than a period; skip the missed runs
+			job.deadline = now + job.periodMs;
+		}
+		insert(ready[ii]);
+	}
+
+	if (windowFn) {
+		windowFn(false, windowContext);
+	}
+}
+
+void CellularHelperScheduler::logJobs() const {
+	system_tick_t now = millis();
+
+	for(size_t ii = 0; ii < MAX_JOBS; ii++) {
+		const Job &job = jobs[ii];
+		if (job.inUse) {
+			Log.info("job %u %s period=%lu slack=%lu due in %ld ms runs=%lu", ii, job.name,
+				job.periodMs, job.slackMs, (long)(int32_t)(job.deadline - now), job.runs);
+		}
+	}
+	Log.info("windows=%lu job runs=%lu", windows, jobRuns);
+}
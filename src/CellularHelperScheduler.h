@@ -0,0 +1,98 @@
+#ifndef __CELLULARHELPERSCHEDULER_H
+#define __CELLULARHELPERSCHEDULER_H
+
+#include "Particle.h"
+
+/**
+ * Cooperative scheduler for periodic modem work, such as sampling AT+CSQ every 30 seconds.
+ *
+ * Call loop() from the application loop(). Jobs run on that thread, one after another.
+ *
+ * Each job has a deadline and a slack. It may run up to slack milliseconds before its
+ * deadline. When any job reaches its deadline, a wake window opens: that job runs, along
+ * with every other job whose slack already allows it to run. Several jobs that come due
+ * close together cost one modem wake instead of one each. The window handler, if set, is
+ * called at the start and end of each window, for example to wake the modem from PSM.
+ *
+ * Periodic jobs are rescheduled from their previous deadline, not from when they ran, so
+ * jobs with related periods stay aligned to the same windows.
+ *
+ * Deadlines are kept in a hashed timer wheel with NUM_SLOTS slots of TICK_MS each. All
+ * storage is fixed size and nothing is allocated.
+ */
+class CellularHelperScheduler {
+public:
+	typedef void (*JobFunction)(void *context);
+	typedef void (*WindowFunction)(bool start, void *context);
+
+	static const size_t MAX_JOBS = 8;
+	static const size_t NUM_SLOTS = 16;
+
+	// Resolution of the timer wheel. Jobs run up to this much after their deadline.
+	static const system_tick_t TICK_MS = 1000;
+
+	CellularHelperScheduler();
+
+	/**
+	 * Adds a job. periodMs of 0 makes it run once. The first run is at now + firstDelayMs, or
+	 * now + periodMs if firstDelayMs is 0. name must be a string literal.
+	 *
+	 * Returns a job id for removeJob(), or -1 if there are already MAX_JOBS jobs.
+	 */
+	int addJob(const char *name, JobFunction fn, void *context, system_tick_t periodMs, system_tick_t slackMs = 0, system_tick_t firstDelayMs = 0);
+
+	bool removeJob(int id);
+
+	/**
+	 * Removes all jobs
+	 */
+	void clear();
+
+	void setWindowHandler(WindowFunction fn, void *context) { windowFn = fn; windowContext = context; }
+
+	/**
+	 * Runs any jobs that are due. Call from loop().
+	 */
+	void loop();
+
+	void logJobs() const;
+
+	uint32_t getWindows() const { return windows; }
+	uint32_t getJobRuns() const { return jobRuns; }
+
+protected:
+	class Job {
+	public:
+		const char *name;
+		JobFunction fn;
+		void *context;
+		system_tick_t periodMs;
+		system_tick_t slackMs;
+		system_tick_t deadline;
+		uint32_t runs;
+		int8_t next;			// Next job in the same slot, -1 at the end
+		bool inUse;
+		bool scheduled;			// In the wheel; false while running
+	};
+
+	static bool isDue(system_tick_t deadline, system_tick_t now) { return (int32_t)(deadline - now) <= 0; }
+
+	size_t slotForDeadline(system_tick_t deadline) const { return (deadline / TICK_MS) % NUM_SLOTS; }
+	void insert(int index);
+	void unlink(int index);
+	void collectSlot(size_t slot, system_tick_t now, bool early, int8_t *ready, size_t &numReady);
+
+	Job jobs[MAX_JOBS];
+	int8_t slots[NUM_SLOTS];		// First job in each slot, -1 if empty
+	system_tick_t maxSlackMs = 0;
+	system_tick_t lastTick = 0;
+	bool started = false;
+
+	WindowFunction windowFn = NULL;
+	void *windowContext = NULL;
+
+	uint32_t windows = 0;
+	uint32_t jobRuns = 0;
+};
+
+#endif /* __CELLULARHELPERSCHEDULER_H */
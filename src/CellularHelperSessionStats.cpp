@@ -0,0 +1,423 @@
+#include "CellularHelperSessionStats.h"
+
+#if Wiring_Cellular
+
+CellularHelperDistribution::CellularHelperDistribution(int binBase, int binWidth) : binBase(binBase), binWidth(binWidth) {
+	clear();
+}
+
+void CellularHelperDistribution::add(int value) {
+	if (count == 0 || value < min) {
+		min = value;
+	}
+	if (count == 0 || value > max) {
+		max = value;
+	}
+	count++;
+	sum += value;
+
+	int bin = (value - binBase) / binWidth;
+	if (bin < 0) {
+		bin = 0;
+	}
+	else
+	if (bin >= (int)NUM_BINS) {
+		bin = NUM_BINS - 1;
+	}
+	if (bins[bin] < 0xffff) {
+		bins[bin]++;
+	}
+}
+
+void CellularHelperDistribution::merge(const CellularHelperDistribution &other) {
+	if (other.count == 0) {
+		return;
+	}
+	if (count == 0 || other.min < min) {
+		min = other.min;
+	}
+	if (count == 0 || other.max > max) {
+		max = other.max;
+	}
+	count += other.count;
+	sum += other.sum;
+
+	for(size_t ii = 0; ii < NUM_BINS; ii++) {
+		uint32_t total = (uint32_t)bins[ii] + other.bins[ii];
+		bins[ii] = (total < 0xffff) ? (uint16_t)total : 0xffff;
+	}
+}
+
+void CellularHelperDistribution::clear() {
+	count = 0;
+	min = max = 0;
+	sum = 0;
+	memset(bins, 0, sizeof(bins));
+}
+
+int CellularHelperDistribution::getMean() const {
+	return (count > 0) ? (int)(sum / (int32_t)count) : 0;
+}
+
+int CellularHelperDistribution::getPercentile(int pct) const {
+	uint32_t total = 0;
+	for(size_t ii = 0; ii < NUM_BINS; ii++) {
+		total += bins[ii];
+	}
+	if (total == 0) {
+		return 0;
+	}
+
+	uint32_t target = (total * pct + 99) / 100;
+	uint32_t running = 0;
+	for(size_t ii = 0; ii < NUM_BINS; ii++) {
+		running += bins[ii];
+		if (running >= target) {
+			// Upper edge of the bin, clamped to the values actually seen
+			int value = binBase + ((int)ii + 1) * binWidth;
+			if (value > max) {
+				value = max;
+			}
+			if (value < min) {
+				value = min;
+			}
+			return value;
+		}
+	}
+	return max;
+}
+
+String CellularHelperDistribution::toString() const {
+	if (count == 0) {
+		return "count=0";
+	}
+	return String::format("count=%lu min=%d mean=%d p50=%d p90=%d max=%d",
+			(unsigned long)count, min, getMean(), getPercentile(50), getPercentile(90), max);
+}
+
+
+CellularHelperSessionStatsEntry::CellularHelperSessionStatsEntry() :
+	rssi(-113, 4), timeToRegister(0, 5) {
+}
+
+void CellularHelperSessionStatsEntry::merge(const CellularHelperSessionStatsEntry &other) {
+	sessions += other.sessions;
+	psmRequested += other.psmRequested;
+	psmGranted += other.psmGranted;
+	locationFixes += other.locationFixes;
+	rssi.merge(other.rssi);
+	timeToRegister.merge(other.timeToRegister);
+}
+
+String CellularHelperSessionStatsEntry::toString() const {
+	String key;
+	if (ci >= 0) {
+		key = String::format("mcc=%d mnc=%d ci=%x", mcc, mnc, ci);
+	}
+	else {
+		key = String::format("mcc=%d mnc=%d", mcc, mnc);
+	}
+	return String::format("%s sessions=%lu psm=%lu/%lu loc=%lu rssi(%s) ttr(%s)", key.c_str(),
+			(unsigned long)sessions, (unsigned long)psmGranted, (unsigned long)psmRequested, (unsigned long)locationFixes,
+			rssi.toString().c_str(), timeToRegister.toString().c_str());
+}
+
+
+// Samples held while replaying one session; the MCC/MNC is often not known until later in the capture
+static const size_t MAX_SESSION_SAMPLES = 64;
+
+typedef struct {
+	int rssi;
+	int ci;
+} SessionSample;
+
+bool CellularHelperSessionStats::addSession(const uint8_t *data, size_t len) {
+	CellularHelperTranscriptReader reader(data, len);
+	if (!reader.isValid()) {
+		return false;
+	}
+
+	enum {
+		ACTIVE_NONE = 0,
+		ACTIVE_CEREG,
+		ACTIVE_CSQ,
+		ACTIVE_CGED,
+		ACTIVE_COPS
+	};
+	int active = ACTIVE_NONE;
+
+	CellularHelperCEREGResponse cereg;
+	CellularHelperRSSIQualResponse rssiQual;
+	CellularHelperEnvironmentResponse environment(NULL, 0);
+	CellularHelperPlusStringResponse cops;
+	CellularHelperLocationResponse location;
+	location.enableDebug = false;
+	location.command = "UULOC";
+
+	int mcc = 65535;
+	int mnc = 255;
+	int ci = -1;
+	bool haveStart = false;
+	uint32_t startTime = 0;
+	bool registered = false;
+	uint32_t registerTime = 0;
+	uint32_t psmRequested = 0;
+	uint32_t psmGranted = 0;
+	uint32_t locationFixes = 0;
+
+	SessionSample samples[MAX_SESSION_SAMPLES];
+	size_t numSamples = 0;
+
+	CellularHelperTranscriptRecord rec;
+	while(reader.next(rec)) {
+		if (!haveStart) {
+			startTime = rec.timestamp;
+			haveStart = true;
+		}
+
+		if (rec.kind == CellularHelperTranscriptRecord::KIND_COMMAND) {
+			active = ACTIVE_NONE;
+
+			if (rec.len >= 9 && strncmp(rec.data, "AT+CEREG?", 9) == 0) {
+				cereg = CellularHelperCEREGResponse();
+				cereg.enableDebug = false;
+				cereg.command = "CEREG";
+				active = ACTIVE_CEREG;
+			}
+			else
+			if (rec.len >= 6 && strncmp(rec.data, "AT+CSQ", 6) == 0) {
+				rssiQual = CellularHelperRSSIQualResponse();
+				rssiQual.enableDebug = false;
+				rssiQual.command = "CSQ";
+				active = ACTIVE_CSQ;
+			}
+			else
+			if (rec.len >= 8 && strncmp(rec.data, "AT+CGED=", 8) == 0) {
+				environment.service = CellularHelperEnvironmentCellData();
+				environment.clear();
+				environment.enableDebug = false;
+				environment.command = "CGED";
+				active = ACTIVE_CGED;
+			}
+			else
+			if (rec.len >= 8 && strncmp(rec.data, "AT+COPS?", 8) == 0) {
+				cops = CellularHelperPlusStringResponse();
+				cops.enableDebug = false;
+				cops.command = "COPS";
+				active = ACTIVE_COPS;
+			}
+			else
+			if (rec.len >= 10 && strncmp(rec.data, "AT+CPSMS=1", 10) == 0) {
+				psmRequested = 1;
+			}
+			continue;
+		}
+
+		// KIND_RESPONSE
+		if (rec.type == TYPE_PLUS) {
+			// URCs can show up in the response to any command
+			CellularHelperLineScanner scanner(rec.data, rec.len);
+			const char *line;
+			size_t lineLen;
+			while(scanner.next(line, lineLen)) {
+				if (CellularHelperLineScanner::skipPlusPrefix(line, lineLen, "UUPSMR", 6) && lineLen > 0 && line[0] == '1') {
+					psmGranted = 1;
+				}
+			}
+
+			location.parse(rec.type, rec.data, rec.len);
+			if (location.string.length() > 0) {
+				location.postProcess();
+				if (location.valid) {
+					locationFixes++;
+				}
+				location = CellularHelperLocationResponse();
+				location.enableDebug = false;
+				location.command = "UULOC";
+			}
+		}
+
+		switch(active) {
+		case ACTIVE_CEREG:
+			cereg.parse(rec.type, rec.data, rec.len);
+			break;
+		case ACTIVE_CSQ:
+			rssiQual.parse(rec.type, rec.data, rec.len);
+			break;
+		case ACTIVE_CGED:
+			environment.parse(rec.type, rec.data, rec.len);
+			break;
+		case ACTIVE_COPS:
+			cops.parse(rec.type, rec.data, rec.len);
+			break;
+		}
+
+		if (rec.type != TYPE_OK) {
+			if (rec.type == TYPE_ERROR) {
+				active = ACTIVE_NONE;
+			}
+			continue;
+		}
+
+		// Final OK for the active command
+		switch(active) {
+		case ACTIVE_CEREG:
+			cereg.resp = RESP_OK;
+			cereg.postProcess();
+			if (cereg.valid) {
+				if ((cereg.stat == 1 || cereg.stat == 5) && !registered) {
+					registered = true;
+					registerTime = rec.timestamp;
+				}
+				if (cereg.ci != (int)0xFFFFFFFF && cereg.lac != 0xFFFF) {
+					ci = cereg.ci;
+				}
+			}
+			break;
+
+		case ACTIVE_CSQ:
+			rssiQual.resp = RESP_OK;
+			rssiQual.postProcess();
+			if (rssiQual.resp == RESP_OK && rssiQual.rssi != 0 && numSamples < MAX_SESSION_SAMPLES) {
+				samples[numSamples].rssi = rssiQual.rssi;
+				samples[numSamples].ci = ci;
+				numSamples++;
+			}
+			break;
+
+		case ACTIVE_CGED:
+			if (environment.service.isValid(true /* ignoreCI */)) {
+				mcc = environment.service.mcc;
+				mnc = environment.service.mnc;
+				if (environment.service.isValid()) {
+					ci = environment.service.ci;
+				}
+			}
+			break;
+
+		case ACTIVE_COPS: {
+			// Only the numeric format (AT+COPS=3,2) identifies the PLMN: 0,2,"24201",7
+			String oper = cops.getDoubleQuotedPart();
+			if (oper.length() >= 5 && oper.length() <= 6) {
+				bool numeric = true;
+				for(size_t ii = 0; ii < oper.length(); ii++) {
+					if (!isdigit(oper.charAt(ii))) {
+						numeric = false;
+					}
+				}
+				if (numeric) {
+					mcc = atoi(oper.substring(0, 3).c_str());
+					mnc = atoi(oper.substring(3).c_str());
+				}
+			}
+			break;
+		}
+		}
+		active = ACTIVE_NONE;
+	}
+
+	sessions++;
+
+	CellularHelperSessionStatsEntry *plmn = NULL;
+	if (mcc <= 999) {
+		plmn = findEntry(plmns, numPlmns, MAX_PLMNS, mcc, mnc, -1);
+	}
+	if (!plmn) {
+		unattributed++;
+		return true;
+	}
+
+	// Session-level results go to the PLMN and the last serving cell
+	CellularHelperSessionStatsEntry *servingCell = (ci >= 0) ? findEntry(cells, numCells, MAX_CELLS, mcc, mnc, ci) : NULL;
+	CellularHelperSessionStatsEntry *sessionEntries[2] = { plmn, servingCell };
+
+	for(size_t ii = 0; ii < 2; ii++) {
+		CellularHelperSessionStatsEntry *entry = sessionEntries[ii];
+		if (!entry) {
+			continue;
+		}
+		entry->sessions++;
+		entry->psmRequested += psmRequested;
+		entry->psmGranted += psmGranted;
+		entry->locationFixes += locationFixes;
+		if (registered) {
+			entry->timeToRegister.add((registerTime - startTime) / 1000);
+		}
+	}
+
+	// Signal samples go to the PLMN and the cell that was serving when the sample was taken.
+	// Samples taken before the serving cell was known are attributed to the last serving cell.
+	for(size_t ii = 0; ii < numSamples; ii++) {
+		plmn->rssi.add(samples[ii].rssi);
+
+		int sampleCi = (samples[ii].ci >= 0) ? samples[ii].ci : ci;
+		if (sampleCi >= 0) {
+			CellularHelperSessionStatsEntry *cell = findEntry(cells, numCells, MAX_CELLS, mcc, mnc, sampleCi);
+			if (cell) {
+				cell->rssi.add(samples[ii].rssi);
+			}
+		}
+	}
+
+	return true;
+}
+
+void CellularHelperSessionStats::merge(const CellularHelperSessionStats &other) {
+	sessions += other.sessions;
+	unattributed += other.unattributed;
+
+	for(size_t ii = 0; ii < other.numPlmns; ii++) {
+		const CellularHelperSessionStatsEntry &src = other.plmns[ii];
+		CellularHelperSessionStatsEntry *dst = findEntry(plmns, numPlmns, MAX_PLMNS, src.mcc, src.mnc, -1);
+		if (dst) {
+			dst->merge(src);
+		}
+		else {
+			unattributed += src.sessions;
+		}
+	}
+	for(size_t ii = 0; ii < other.numCells; ii++) {
+		const CellularHelperSessionStatsEntry &src = other.cells[ii];
+		CellularHelperSessionStatsEntry *dst = findEntry(cells, numCells, MAX_CELLS, src.mcc, src.mnc, src.ci);
+		if (dst) {
+			dst->merge(src);
+		}
+	}
+}
+
+void CellularHelperSessionStats::clear() {
+	sessions = 0;
+	unattributed = 0;
+	numPlmns = 0;
+	numCells = 0;
+}
+
+void CellularHelperSessionStats::logStats() const {
+	Log.info("sessions=%lu unattributed=%lu", (unsigned long)sessions, (unsigned long)unattributed);
+	for(size_t ii = 0; ii < numPlmns; ii++) {
+		Log.info("plmn %s", plmns[ii].toString().c_str());
+	}
+	for(size_t ii = 0; ii < numCells; ii++) {
+		Log.info("cell %s", cells[ii].toString().c_str());
+	}
+}
+
+CellularHelperSessionStatsEntry *CellularHelperSessionStats::findEntry(CellularHelperSessionStatsEntry *table, size_t &numEntries, size_t maxEntries, int mcc, int mnc, int ci) {
+	for(size_t ii = 0; ii < numEntries; ii++) {
+		if (table[ii].mcc == mcc && table[ii].mnc == mnc && table[ii].ci == ci) {
+			return &table[ii];
+		}
+	}
+	if (numEntries >= maxEntries) {
+		return NULL;
+	}
+
+	CellularHelperSessionStatsEntry *entry = &table[numEntries++];
+	*entry = CellularHelperSessionStatsEntry();
+	entry->mcc = mcc;
+	entry->mnc = mnc;
+	entry->ci = ci;
+	return entry;
+}
+
+#endif /* Wiring_Cellular */
@@ -0,0 +1,105 @@
+#ifndef __CELLULARHELPERSESSIONSTATS_H
+#define __CELLULARHELPERSESSIONSTATS_H
+
+#include "CellularHelper.h"
+
+#if Wiring_Cellular
+
+/**
+ * Fixed-size histogram with count, min, max and mean. Values below the first bin go in the
+ * first bin and values above the last bin go in the last bin.
+ */
+class CellularHelperDistribution {
+public:
+	static const size_t NUM_BINS = 16;
+
+	CellularHelperDistribution(int binBase = 0, int binWidth = 1);
+
+	void add(int value);
+	void merge(const CellularHelperDistribution &other);
+	void clear();
+
+	int getMean() const;
+
+	/**
+	 * Returns the approximate value at percentile pct (0 - 100), from the bin boundaries
+	 */
+	int getPercentile(int pct) const;
+
+	String toString() const;
+
+	int binBase;
+	int binWidth;
+	uint32_t count = 0;
+	int min = 0;
+	int max = 0;
+	int32_t sum = 0;
+	uint16_t bins[NUM_BINS];
+};
+
+/**
+ * Statistics for one PLMN (MCC/MNC) or one cell within it
+ */
+class CellularHelperSessionStatsEntry {
+public:
+	CellularHelperSessionStatsEntry();
+
+	int mcc = 65535;
+	int mnc = 255;
+	int ci = -1;		// -1 for the PLMN-wide entry
+
+	uint32_t sessions = 0;
+	uint32_t psmRequested = 0;
+	uint32_t psmGranted = 0;
+	uint32_t locationFixes = 0;			// Valid +UULOC responses
+	CellularHelperDistribution rssi;			// dBm, from AT+CSQ
+	CellularHelperDistribution timeToRegister;	// seconds, first command to CEREG stat 1 or 5
+
+	void merge(const CellularHelperSessionStatsEntry &other);
+	String toString() const;
+};
+
+/**
+ * Replays captured transcripts (see CellularHelperTranscript) through the CellularHelper response
+ * parsers and aggregates registration, PSM and signal statistics per MCC/MNC and per cell.
+ *
+ * All storage is fixed size. Instances built from separate sets of captures can be combined
+ * with merge(), so a large set of captures can be split up and analyzed in parts.
+ */
+class CellularHelperSessionStats {
+public:
+	static const size_t MAX_PLMNS = 8;
+	static const size_t MAX_CELLS = 16;
+
+	/**
+	 * Replays one capture. Returns false if the capture header is not valid.
+	 */
+	bool addSession(const uint8_t *data, size_t len);
+
+	void merge(const CellularHelperSessionStats &other);
+	void clear();
+	void logStats() const;
+
+	size_t getNumPlmns() const { return numPlmns; }
+	const CellularHelperSessionStatsEntry &getPlmn(size_t index) const { return plmns[index]; }
+
+	size_t getNumCells() const { return numCells; }
+	const CellularHelperSessionStatsEntry &getCell(size_t index) const { return cells[index]; }
+
+	uint32_t sessions = 0;
+
+	// Sessions where the MCC/MNC never appeared in the capture, or the tables were full
+	uint32_t unattributed = 0;
+
+protected:
+	CellularHelperSessionStatsEntry *findEntry(CellularHelperSessionStatsEntry *table, size_t &numEntries, size_t maxEntries, int mcc, int mnc, int ci);
+
+	CellularHelperSessionStatsEntry plmns[MAX_PLMNS];
+	size_t numPlmns = 0;
+	CellularHelperSessionStatsEntry cells[MAX_CELLS];
+	size_t numCells = 0;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERSESSIONSTATS_H */
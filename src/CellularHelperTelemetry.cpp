@@ -0,0 +1,178 @@
+#include "CellularHelperTelemetry.h"
+
+// Worst case varint of a 32 bit value
+static const size_t MAX_VARINT_SIZE = 5;
+
+CellularHelperTelemetry::CellularHelperTelemetry(size_t numChannels, FlushFunction fn, void *context) :
+	numChannels(numChannels <= MAX_CHANNELS ? numChannels : MAX_CHANNELS), flushFn(fn), flushContext(context) {
+}
+
+// static
+size_t CellularHelperTelemetry::putVarint(uint8_t *buf, uint32_t value) {
+	size_t len = 0;
+	while(value >= 0x80) {
+		buf[len++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (uint8_t)value;
+	return len;
+}
+
+// static
+size_t CellularHelperTelemetry::putSignedVarint(uint8_t *buf, int32_t value) {
+	// Zigzag: 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...
+	return putVarint(buf, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+// static
+size_t CellularHelperTelemetry::getVarint(const uint8_t *buf, const uint8_t *end, uint32_t &value) {
+	value = 0;
+	for(size_t ii = 0; ii < MAX_VARINT_SIZE && buf + ii < end; ii++) {
+		value |= (uint32_t)(buf[ii] & 0x7f) << (7 * ii);
+		if ((buf[ii] & 0x80) == 0) {
+			return ii + 1;
+		}
+	}
+	return 0;
+}
+
+// static
+size_t CellularHelperTelemetry::getSignedVarint(const uint8_t *buf, const uint8_t *end, int32_t &value) {
+	uint32_t raw;
+	size_t len = getVarint(buf, end, raw);
+	value = (int32_t)((raw >> 1) ^ (~(raw & 1) + 1));
+	return len;
+}
+
+bool CellularHelperTelemetry::add(uint32_t time, const int32_t *values) {
+	// Encode into a scratch buffer first, since it may have to go into a new payload
+	uint8_t sample[MAX_VARINT_SIZE * (1 + MAX_CHANNELS)];
+	size_t sampleLen;
+
+	for(int attempt = 0; attempt < 2; attempt++) {
+		sampleLen = 0;
+		if (numSamples == 0) {
+			sampleLen += putSignedVarint(&sample[sampleLen], 0);
+			for(size_t ii = 0; ii < numChannels; ii++) {
+				sampleLen += putSignedVarint(&sample[sampleLen], values[ii]);
+			}
+		}
+		else {
+			sampleLen += putSignedVarint(&sample[sampleLen], (int32_t)(time - lastTime));
+			for(size_t ii = 0; ii < numChannels; ii++) {
+				sampleLen += putSignedVarint(&sample[sampleLen], (int32_t)((uint32_t)values[ii] - (uint32_t)lastValues[ii]));
+			}
+		}
+
+		size_t headerLen = 0;
+		if (numSamples == 0) {
+			payload[0] = PAYLOAD_VERSION;
+			payload[1] = (uint8_t)numChannels;
+			headerLen = 2 + putVarint(&payload[2], time);
+		}
+
+		if (length + headerLen + sampleLen <= PAYLOAD_SIZE) {
+			if (numSamples == 0) {
+				length = headerLen;
+				firstSampleMillis = millis();
+			}
+			memcpy(&payload[length], sample, sampleLen);
+			length += sampleLen;
+			numSamples++;
+			lastTime = time;
+			memcpy(lastValues, values, numChannels * sizeof(int32_t));
+			return true;
+		}
+
+		// Full; send what we have and start a new payload with this sample
+		if (attempt > 0 || !flush()) {
+			break;
+		}
+	}
+
+	samplesDropped++;
+	return false;
+}
+
+void CellularHelperTelemetry::poll() {
+	if (numSamples > 0 && millis() - firstSampleMillis >= maxAgeMs) {
+		flush();
+	}
+}
+
+bool CellularHelperTelemetry::flush() {
+	if (numSamples == 0) {
+		return true;
+	}
+	if (!flushFn(payload, length, flushContext)) {
+		return false;
+	}
+
+	size_t rawLen = numSamples * (1 + numChannels) * sizeof(int32_t);
+	lastRatio = (uint32_t)(rawLen * 100 / length);
+	Log.info("telemetry flushed %u samples, %u bytes, %u raw, ratio %lu.%02lu", (unsigned)numSamples, (unsigned)length, (unsigned)rawLen,
+		(unsigned long)(lastRatio / 100), (unsigned long)(lastRatio % 100));
+
+	flushes++;
+	samplesFlushed += numSamples;
+	bytesFlushed += length;
+	rawBytesFlushed += rawLen;
+
+	numSamples = 0;
+	length = 0;
+	return true;
+}
+
+void CellularHelperTelemetry::logStats() const {
+	uint32_t ratio = bytesFlushed ? (uint32_t)((uint64_t)rawBytesFlushed * 100 / bytesFlushed) : 0;
+
+	Log.info("telemetry pending=%u samples/%u bytes flushes=%lu samples=%lu dropped=%lu bytes=%lu raw=%lu ratio=%lu.%02lu",
+		(unsigned)numSamples, (unsigned)length, (unsigned long)flushes, (unsigned long)samplesFlushed, (unsigned long)samplesDropped,
+		(unsigned long)bytesFlushed, (unsigned long)rawBytesFlushed, (unsigned long)(ratio / 100), (unsigned long)(ratio % 100));
+}
+
+CellularHelperTelemetryReader::CellularHelperTelemetryReader(const uint8_t *payload, size_t len) : p(payload), end(payload + len) {
+	if (len < 3 || payload[0] != CellularHelperTelemetry::PAYLOAD_VERSION || payload[1] > CellularHelperTelemetry::MAX_CHANNELS) {
+		return;
+	}
+	numChannels = payload[1];
+	p += 2;
+
+	size_t used = CellularHelperTelemetry::getVarint(p, end, lastTime);
+	if (used == 0) {
+		return;
+	}
+	p += used;
+
+	memset(lastValues, 0, sizeof(lastValues));
+	valid = true;
+}
+
+bool CellularHelperTelemetryReader::next(uint32_t &time, int32_t *values) {
+	if (!valid || p >= end) {
+		return false;
+	}
+
+	int32_t delta;
+	size_t used = CellularHelperTelemetry::getSignedVarint(p, end, delta);
+	if (used == 0) {
+		valid = false;
+		return false;
+	}
+	p += used;
+	lastTime += delta;
+
+	for(size_t ii = 0; ii < numChannels; ii++) {
+		used = CellularHelperTelemetry::getSignedVarint(p, end, delta);
+		if (used == 0) {
+			valid = false;
+			return false;
+		}
+		p += used;
+		lastValues[ii] = (int32_t)((uint32_t)lastValues[ii] + (uint32_t)delta);
+		values[ii] = lastValues[ii];
+	}
+
+	time = lastTime;
+	return true;
+}
@@ -0,0 +1,118 @@
+#ifndef __CELLULARHELPERTELEMETRY_H
+#define __CELLULARHELPERTELEMETRY_H
+
+#include "Particle.h"
+
+/**
+ * Accumulates samples of up to MAX_CHANNELS integer values into one compact payload.
+ *
+ * Payload format:
+ *
+ * uint8  version		PAYLOAD_VERSION
+ * uint8  numChannels
+ * varint time			Timestamp of the first sample
+ * Then for each sample:
+ * svarint timeDelta	From the previous sample (0 for the first)
+ * svarint valueDelta	For each channel, from the previous sample's value (from 0 for the first)
+ *
+ * varint is LEB128, 7 bits per byte, least significant first. svarint is a varint of the
+ * zigzag-encoded value, so small negative deltas are also one byte. Slowly changing values
+ * such as RSRP, cell ID and registration state usually take one byte per channel per sample.
+ *
+ * The payload is handed to the flush function when the next sample would not fit, or when
+ * poll() is called after the oldest sample's deadline. Each flush records the compression
+ * ratio against the same samples as fixed-width int32 values.
+ */
+class CellularHelperTelemetry {
+public:
+	/**
+	 * Called with a complete payload. Return false to keep it and retry on the next poll().
+	 */
+	typedef bool (*FlushFunction)(const uint8_t *payload, size_t len, void *context);
+
+	static const uint8_t PAYLOAD_VERSION = 1;
+	static const size_t MAX_CHANNELS = 8;
+	static const size_t PAYLOAD_SIZE = 256;
+
+	CellularHelperTelemetry(size_t numChannels, FlushFunction fn, void *context = NULL);
+
+	/**
+	 * Adds a sample. time is in seconds (any epoch, but it must not go backwards by more than
+	 * the svarint range). values must have numChannels entries. Returns false if the sample was
+	 * dropped because the payload was full and could not be flushed.
+	 */
+	bool add(uint32_t time, const int32_t *values);
+
+	/**
+	 * Flushes if the oldest sample is older than maxAgeMs. Call from loop().
+	 */
+	void poll();
+
+	/**
+	 * Flushes now if there are any samples. Returns false if the flush function failed.
+	 */
+	bool flush();
+
+	void setMaxAge(system_tick_t ms) { maxAgeMs = ms; }
+
+	size_t getNumSamples() const { return numSamples; }
+	size_t getLength() const { return length; }
+
+	void logStats() const;
+
+	uint32_t flushes = 0;
+	uint32_t samplesFlushed = 0;
+	uint32_t samplesDropped = 0;
+	uint32_t bytesFlushed = 0;
+	uint32_t rawBytesFlushed = 0;		// Same samples as int32 time + int32 per channel
+	uint32_t lastRatio = 0;				// Raw size / encoded size * 100, for the last flush
+
+	static size_t putVarint(uint8_t *buf, uint32_t value);
+	static size_t putSignedVarint(uint8_t *buf, int32_t value);
+
+	/**
+	 * Read a varint from buf, not reading past end. Returns the bytes used, 0 if truncated.
+	 */
+	static size_t getVarint(const uint8_t *buf, const uint8_t *end, uint32_t &value);
+	static size_t getSignedVarint(const uint8_t *buf, const uint8_t *end, int32_t &value);
+
+protected:
+	size_t numChannels;
+	FlushFunction flushFn;
+	void *flushContext;
+
+	uint8_t payload[PAYLOAD_SIZE];
+	size_t length = 0;
+	size_t numSamples = 0;
+	uint32_t lastTime = 0;
+	int32_t lastValues[MAX_CHANNELS];
+	system_tick_t firstSampleMillis = 0;
+	system_tick_t maxAgeMs = 10 * 60 * 1000;
+};
+
+/**
+ * Reads back a payload from CellularHelperTelemetry, for the collector or for checking
+ */
+class CellularHelperTelemetryReader {
+public:
+	CellularHelperTelemetryReader(const uint8_t *payload, size_t len);
+
+	bool isValid() const { return valid; }
+	size_t getNumChannels() const { return numChannels; }
+
+	/**
+	 * Reads the next sample. values must have room for getNumChannels() entries. Returns false
+	 * at the end or if the payload is malformed.
+	 */
+	bool next(uint32_t &time, int32_t *values);
+
+protected:
+	const uint8_t *p;
+	const uint8_t *end;
+	bool valid = false;
+	size_t numChannels = 0;
+	uint32_t lastTime = 0;
+	int32_t lastValues[CellularHelperTelemetry::MAX_CHANNELS];
+};
+
+#endif /* __CELLULARHELPERTELEMETRY_H */
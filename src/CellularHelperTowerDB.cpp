@@ -0,0 +1,187 @@
+#include "CellularHelperTowerDB.h"
+
+#if Wiring_Cellular
+
+static uint16_t getU16(const uint8_t *p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t getU32(const uint8_t *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void putU16(uint8_t *p, uint16_t value) {
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
+
+static void putU32(uint8_t *p, uint32_t value) {
+	for(size_t ii = 0; ii < 4; ii++) {
+		p[ii] = (uint8_t)(value >> (8 * ii));
+	}
+}
+
+String CellularHelperTowerRecord::toString() const {
+	return String::format("mcc=%u mnc=%u lac=0x%lx ci=0x%lx lat=%s%ld.%06ld lon=%s%ld.%06ld range=%u%s", mcc, mnc,
+		(unsigned long)lac, (unsigned long)ci,
+		(lat < 0) ? "-" : "", labs((long)lat) / 1000000, labs((long)lat) % 1000000,
+		(lon < 0) ? "-" : "", labs((long)lon) / 1000000, labs((long)lon) % 1000000,
+		range, exact ? "" : " (lac only)");
+}
+
+bool CellularHelperTowerDBMemoryReader::read(uint32_t offset, uint8_t *buf, size_t len) {
+	if (offset > size || len > size - offset) {
+		return false;
+	}
+	memcpy(buf, data + offset, len);
+	return true;
+}
+
+CellularHelperTowerDB::CellularHelperTowerDB(CellularHelperTowerDBReader &reader) : reader(reader) {
+}
+
+bool CellularHelperTowerDB::begin() {
+	uint8_t header[HEADER_SIZE];
+
+	valid = false;
+	if (!reader.read(0, header, sizeof(header)) || memcmp(header, "CTDB", 4) != 0 ||
+		getU16(&header[4]) != FORMAT_VERSION || getU16(&header[6]) < RECORD_SIZE) {
+		return false;
+	}
+	recordSize = getU16(&header[6]);
+	count = getU32(&header[8]);
+	valid = true;
+	return true;
+}
+
+// static
+void CellularHelperTowerDB::encodeHeader(uint32_t count, uint8_t *buf) {
+	memcpy(buf, "CTDB", 4);
+	putU16(&buf[4], FORMAT_VERSION);
+	putU16(&buf[6], RECORD_SIZE);
+	putU32(&buf[8], count);
+	putU32(&buf[12], 0);
+}
+
+// static
+void CellularHelperTowerDB::encodeRecord(const CellularHelperTowerRecord &record, uint8_t *buf) {
+	putU16(&buf[0], record.mcc);
+	putU16(&buf[2], record.mnc);
+	putU32(&buf[4], record.lac);
+	putU32(&buf[8], record.ci);
+	putU32(&buf[12], (uint32_t)record.lat);
+	putU32(&buf[16], (uint32_t)record.lon);
+	putU16(&buf[20], record.range);
+	putU16(&buf[22], 0);
+}
+
+bool CellularHelperTowerDB::readRecord(uint32_t index, CellularHelperTowerRecord &record) {
+	uint8_t buf[RECORD_SIZE];
+
+	reads++;
+	if (!reader.read(HEADER_SIZE + index * recordSize, buf, sizeof(buf))) {
+		readErrors++;
+		return false;
+	}
+	record.mcc = getU16(&buf[0]);
+	record.mnc = getU16(&buf[2]);
+	record.lac = getU32(&buf[4]);
+	record.ci = getU32(&buf[8]);
+	record.lat = (int32_t)getU32(&buf[12]);
+	record.lon = (int32_t)getU32(&buf[16]);
+	record.range = getU16(&buf[20]);
+	return true;
+}
+
+// static
+int CellularHelperTowerDB::compare(const CellularHelperTowerRecord &a, uint16_t mcc, uint16_t mnc, uint32_t lac, uint32_t ci) {
+	if (a.mcc != mcc) {
+		return (a.mcc < mcc) ? -1 : 1;
+	}
+	if (a.mnc != mnc) {
+		return (a.mnc < mnc) ? -1 : 1;
+	}
+	if (a.lac != lac) {
+		return (a.lac < lac) ? -1 : 1;
+	}
+	if (a.ci != ci) {
+		return (a.ci < ci) ? -1 : 1;
+	}
+	return 0;
+}
+
+bool CellularHelperTowerDB::lookup(uint16_t mcc, uint16_t mnc, uint32_t lac, uint32_t ci, CellularHelperTowerRecord &record) {
+	if (!valid) {
+		return false;
+	}
+
+	unsigned long startTime = micros();
+	lookups++;
+
+	// Find the first record >= key
+	uint32_t low = 0;
+	uint32_t high = count;
+	while(low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		if (!readRecord(mid, record)) {
+			return false;
+		}
+		int cmp = compare(record, mcc, mnc, lac, ci);
+		if (cmp == 0) {
+			record.exact = true;
+			exactHits++;
+			lastLookupUs = micros() - startTime;
+			return true;
+		}
+		if (cmp < 0) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+
+	// No exact match; a neighbor in the same LAC/TAC still gives a position within the area
+	bool found = false;
+	if (low < count && readRecord(low, record) && record.mcc == mcc && record.mnc == mnc && record.lac == lac) {
+		found = true;
+	}
+	else
+	if (low > 0 && readRecord(low - 1, record) && record.mcc == mcc && record.mnc == mnc && record.lac == lac) {
+		found = true;
+	}
+	if (found) {
+		record.exact = false;
+		lacHits++;
+	}
+	lastLookupUs = micros() - startTime;
+	return found;
+}
+
+bool CellularHelperTowerDB::lookupServingCell(CellularHelperTowerRecord &record) {
+	char numeric[16];
+	if (CellularHelper.getOperatorName(numeric, sizeof(numeric), CellularHelperClass::OPERATOR_NAME_NUMERIC) < 5) {
+		return false;
+	}
+
+	// MCC is always 3 digits, MNC the remaining 2 or 3
+	uint16_t mnc = (uint16_t)atoi(&numeric[3]);
+	numeric[3] = 0;
+	uint16_t mcc = (uint16_t)atoi(numeric);
+
+	CellularHelperCEREGResponse reg;
+	CellularHelper.getCEREG(reg);
+	if (!reg.valid || reg.ci == (int)0xFFFFFFFF) {
+		return false;
+	}
+
+	return lookup(mcc, mnc, (uint32_t)reg.lac, (uint32_t)reg.ci, record);
+}
+
+void CellularHelperTowerDB::logStats() const {
+	Log.info("towerdb %s records=%lu lookups=%lu exact=%lu lacOnly=%lu reads=%lu readErrors=%lu lastLookup=%luus",
+		valid ? "valid" : "invalid", (unsigned long)count, (unsigned long)lookups, (unsigned long)exactHits,
+		(unsigned long)lacHits, (unsigned long)reads, (unsigned long)readErrors, (unsigned long)lastLookupUs);
+}
+
+#endif /* Wiring_Cellular */
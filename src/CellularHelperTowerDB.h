@@ -0,0 +1,148 @@
+#ifndef __CELLULARHELPERTOWERDB_H
+#define __CELLULARHELPERTOWERDB_H
+
+#include "CellularHelper.h"
+
+#if Wiring_Cellular
+
+/**
+ * One cell tower from the database
+ */
+class CellularHelperTowerRecord {
+public:
+	uint16_t mcc = 0;
+	uint16_t mnc = 0;				// As a number, so "01" and "1" are the same network
+	uint32_t lac = 0;				// LAC, or TAC on LTE
+	uint32_t ci = 0;
+	int32_t lat = 0;				// Degrees * 1000000
+	int32_t lon = 0;				// Degrees * 1000000
+	uint16_t range = 0;				// Meters
+	bool exact = false;				// Set by lookup(): false if only the LAC/TAC matched
+
+	String toString() const;
+};
+
+/**
+ * Reads bytes from wherever the database is stored
+ */
+class CellularHelperTowerDBReader {
+public:
+	virtual ~CellularHelperTowerDBReader() {}
+
+	/**
+	 * Reads len bytes at offset into buf. Returns false if they cannot be read.
+	 */
+	virtual bool read(uint32_t offset, uint8_t *buf, size_t len) = 0;
+};
+
+/**
+ * Database in memory: a const array in flash, or a memory-mapped file on a host
+ */
+class CellularHelperTowerDBMemoryReader : public CellularHelperTowerDBReader {
+public:
+	CellularHelperTowerDBMemoryReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+	virtual bool read(uint32_t offset, uint8_t *buf, size_t len);
+
+protected:
+	const uint8_t *data;
+	size_t size;
+};
+
+/**
+ * Database read through a function, for example from external SPI flash
+ */
+class CellularHelperTowerDBCallbackReader : public CellularHelperTowerDBReader {
+public:
+	typedef bool (*ReadFunction)(uint32_t offset, uint8_t *buf, size_t len, void *context);
+
+	CellularHelperTowerDBCallbackReader(ReadFunction fn, void *context = NULL) : fn(fn), context(context) {}
+
+	virtual bool read(uint32_t offset, uint8_t *buf, size_t len) { return fn(offset, buf, len, context); }
+
+protected:
+	ReadFunction fn;
+	void *context;
+};
+
+/**
+ * Offline cell ID to position lookup in a sorted binary tower database.
+ *
+ * File format, all values little endian:
+ *
+ * Header (HEADER_SIZE bytes)
+ * char[4]  magic			"CTDB"
+ * uint16   version			FORMAT_VERSION
+ * uint16   recordSize		RECORD_SIZE, or more if later versions append fields
+ * uint32   count			Number of records
+ * uint32   reserved		0
+ *
+ * Then count records, sorted by (mcc, mnc, lac, ci) with no duplicates:
+ * uint16   mcc
+ * uint16   mnc
+ * uint32   lac
+ * uint32   ci
+ * int32    lat				Degrees * 1000000
+ * int32    lon				Degrees * 1000000
+ * uint16   range			Meters
+ * uint16   reserved		0
+ *
+ * Lookup is a binary search reading one record per step, so a database of a million towers
+ * takes 20 small reads. encodeHeader() and encodeRecord() write the format, for building or
+ * testing a database.
+ */
+class CellularHelperTowerDB {
+public:
+	static const uint16_t FORMAT_VERSION = 1;
+	static const size_t HEADER_SIZE = 16;
+	static const size_t RECORD_SIZE = 24;
+
+	CellularHelperTowerDB(CellularHelperTowerDBReader &reader);
+
+	/**
+	 * Reads and checks the header. Returns false if it is not a tower database.
+	 */
+	bool begin();
+
+	bool isValid() const { return valid; }
+	uint32_t getCount() const { return count; }
+
+	/**
+	 * Finds the tower. If there is no record for ci, the nearest record in the same LAC/TAC
+	 * is returned with record.exact false, as a coarser position. Returns false if neither
+	 * is found.
+	 */
+	bool lookup(uint16_t mcc, uint16_t mnc, uint32_t lac, uint32_t ci, CellularHelperTowerRecord &record);
+
+	/**
+	 * Looks up the serving cell, using AT+UDOPN for the MCC/MNC and AT+CEREG for the TAC and
+	 * CI. These are local queries; nothing is sent over the air.
+	 */
+	bool lookupServingCell(CellularHelperTowerRecord &record);
+
+	void logStats() const;
+
+	static void encodeHeader(uint32_t count, uint8_t *buf);
+	static void encodeRecord(const CellularHelperTowerRecord &record, uint8_t *buf);
+
+	uint32_t lookups = 0;
+	uint32_t exactHits = 0;
+	uint32_t lacHits = 0;
+	uint32_t reads = 0;
+	uint32_t readErrors = 0;
+	uint32_t lastLookupUs = 0;
+
+protected:
+	static int compare(const CellularHelperTowerRecord &a, uint16_t mcc, uint16_t mnc, uint32_t lac, uint32_t ci);
+
+	bool readRecord(uint32_t index, CellularHelperTowerRecord &record);
+
+	CellularHelperTowerDBReader &reader;
+	bool valid = false;
+	uint32_t count = 0;
+	uint16_t recordSize = RECORD_SIZE;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERTOWERDB_H */
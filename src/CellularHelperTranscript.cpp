@@ -0,0 +1,169 @@
+#include "CellularHelperTranscript.h"
+
+static const uint8_t transcriptMagic[4] = { 'A', 'T', 'C', '1' };
+
+static void putUint16(uint8_t *p, uint16_t value) {
+	p[0] = (uint8_t) value;
+	p[1] = (uint8_t) (value >> 8);
+}
+
+static void putUint32(uint8_t *p, uint32_t value) {
+	p[0] = (uint8_t) value;
+	p[1] = (uint8_t) (value >> 8);
+	p[2] = (uint8_t) (value >> 16);
+	p[3] = (uint8_t) (value >> 24);
+}
+
+static uint16_t getUint16(const uint8_t *p) {
+	return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t getUint32(const uint8_t *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+CellularHelperTranscript::CellularHelperTranscript() {
+#if PLATFORM_THREADING
+	os_mutex_create(&mutex);
+#endif
+}
+
+void CellularHelperTranscript::lock() const {
+#if PLATFORM_THREADING
+	os_mutex_lock(mutex);
+#endif
+}
+
+void CellularHelperTranscript::unlock() const {
+#if PLATFORM_THREADING
+	os_mutex_unlock(mutex);
+#endif
+}
+
+void CellularHelperTranscript::begin(uint8_t *buf, size_t bufSize) {
+	if (bufSize < HEADER_SIZE) {
+		return;
+	}
+	lock();
+	this->buf = buf;
+	this->bufSize = bufSize;
+	unlock();
+	clear();
+}
+
+void CellularHelperTranscript::end() {
+	lock();
+	buf = NULL;
+	bufSize = 0;
+	unlock();
+}
+
+void CellularHelperTranscript::clear() {
+	lock();
+	used = HEADER_SIZE;
+	numRecords = 0;
+	dropped = 0;
+	if (buf) {
+		memcpy(buf, transcriptMagic, sizeof(transcriptMagic));
+		updateHeader();
+	}
+	unlock();
+}
+
+size_t CellularHelperTranscript::getLength() const {
+	lock();
+	size_t result = used;
+	unlock();
+	return result;
+}
+
+size_t CellularHelperTranscript::getNumRecords() const {
+	lock();
+	size_t result = numRecords;
+	unlock();
+	return result;
+}
+
+size_t CellularHelperTranscript::getDropped() const {
+	lock();
+	size_t result = dropped;
+	unlock();
+	return result;
+}
+
+void CellularHelperTranscript::addCommand(const char *data, size_t len) {
+	add(CellularHelperTranscriptRecord::KIND_COMMAND, 0, data, len);
+}
+
+void CellularHelperTranscript::addResponse(int type, const char *data, size_t len) {
+	add(CellularHelperTranscriptRecord::KIND_RESPONSE, (uint8_t)(type >> 16), data, len);
+}
+
+void CellularHelperTranscript::add(uint8_t kind, uint8_t type, const char *data, size_t len) {
+	lock();
+	if (!buf) {
+		unlock();
+		return;
+	}
+	if (len > 0xffff || used + RECORD_HEADER_SIZE + len > bufSize) {
+		dropped++;
+		unlock();
+		return;
+	}
+
+	uint8_t *p = &buf[used];
+	putUint16(p, (uint16_t)len);
+	p[2] = kind;
+	p[3] = type;
+	putUint32(&p[4], millis());
+	memcpy(&p[RECORD_HEADER_SIZE], data, len);
+
+	used += RECORD_HEADER_SIZE + len;
+	numRecords++;
+	updateHeader();
+	unlock();
+}
+
+void CellularHelperTranscript::updateHeader() {
+	putUint32(&buf[4], (uint32_t)(used - HEADER_SIZE));
+}
+
+
+CellularHelperTranscriptReader::CellularHelperTranscriptReader(const uint8_t *data, size_t len) : data(NULL), cur(NULL), end(NULL) {
+	if (len >= CellularHelperTranscript::HEADER_SIZE && memcmp(data, transcriptMagic, sizeof(transcriptMagic)) == 0) {
+		size_t recordBytes = getUint32(&data[4]);
+		if (recordBytes > len - CellularHelperTranscript::HEADER_SIZE) {
+			// Truncated capture; read as much as is there
+			recordBytes = len - CellularHelperTranscript::HEADER_SIZE;
+		}
+		this->data = data;
+		end = &data[CellularHelperTranscript::HEADER_SIZE + recordBytes];
+		rewind();
+	}
+}
+
+bool CellularHelperTranscriptReader::next(CellularHelperTranscriptRecord &rec) {
+	if (!cur || (size_t)(end - cur) < CellularHelperTranscript::RECORD_HEADER_SIZE) {
+		return false;
+	}
+
+	size_t len = getUint16(cur);
+	if ((size_t)(end - cur) < CellularHelperTranscript::RECORD_HEADER_SIZE + len) {
+		return false;
+	}
+
+	rec.kind = cur[2];
+	rec.type = (int)cur[3] << 16;
+	rec.timestamp = getUint32(&cur[4]);
+	rec.data = (const char *)&cur[CellularHelperTranscript::RECORD_HEADER_SIZE];
+	rec.len = len;
+
+	cur += CellularHelperTranscript::RECORD_HEADER_SIZE + len;
+	return true;
+}
+
+void CellularHelperTranscriptReader::rewind() {
+	if (data) {
+		cur = &data[CellularHelperTranscript::HEADER_SIZE];
+	}
+}
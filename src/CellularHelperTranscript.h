@@ -0,0 +1,123 @@
+#ifndef __CELLULARHELPERTRANSCRIPT_H
+#define __CELLULARHELPERTRANSCRIPT_H
+
+#include "Particle.h"
+
+/**
+ * One entry in a transcript: either a command sent to the modem or a response buffer passed
+ * to a Cellular.command callback.
+ */
+class CellularHelperTranscriptRecord {
+public:
+	static const uint8_t KIND_COMMAND = 1;
+	static const uint8_t KIND_RESPONSE = 2;
+
+	uint8_t kind = 0;
+	int type = 0;				// TYPE_xxx constant, only for KIND_RESPONSE
+	uint32_t timestamp = 0;		// millis() when recorded
+	const char *data = NULL;	// Not null terminated; points into the transcript buffer
+	size_t len = 0;
+};
+
+/**
+ * Records AT commands and responses into a caller-provided buffer in a compact binary format.
+ *
+ * The buffer starts with an 8 byte header: the magic "ATC1" and the number of record bytes
+ * that follow (uint32, little endian). Each record is:
+ *
+ * uint16 len		payload length, little endian
+ * uint8  kind		KIND_COMMAND or KIND_RESPONSE
+ * uint8  type		TYPE_xxx >> 16 for responses, 0 for commands
+ * uint32 timestamp	millis(), little endian
+ * len bytes		payload, exactly as sent or received
+ *
+ * Recording stops when the buffer is full; later records are counted in getDropped().
+ * The buffer can be copied off the device and read back with CellularHelperTranscriptReader.
+ *
+ * Records are added on the modem worker thread while begin(), end(), clear() and the getters
+ * are called from the application, so all of them take a mutex. Recording only appends, so
+ * the first getLength() bytes can be read without the lock until the next begin() or clear().
+ */
+class CellularHelperTranscript {
+public:
+	CellularHelperTranscript();
+
+	/**
+	 * Starts recording into buf. The buffer must remain valid until end() is called.
+	 */
+	void begin(uint8_t *buf, size_t bufSize);
+
+	/**
+	 * Stops recording. The data recorded so far remains in the buffer.
+	 */
+	void end();
+
+	/**
+	 * Discards all recorded data but keeps recording.
+	 */
+	void clear();
+
+	bool isEnabled() const { return buf != NULL; }
+
+	void addCommand(const char *data, size_t len);
+	void addResponse(int type, const char *data, size_t len);
+
+	/**
+	 * Returns the recorded data, including the 8 byte header
+	 */
+	const uint8_t *getData() const { return buf; }
+	size_t getLength() const;
+
+	size_t getNumRecords() const;
+	size_t getDropped() const;
+
+	static const size_t HEADER_SIZE = 8;
+	static const size_t RECORD_HEADER_SIZE = 8;
+
+protected:
+	void add(uint8_t kind, uint8_t type, const char *data, size_t len);
+	void updateHeader();
+
+	void lock() const;
+	void unlock() const;
+
+#if PLATFORM_THREADING
+	os_mutex_t mutex = NULL;
+#endif
+	uint8_t *buf = NULL;
+	size_t bufSize = 0;
+	size_t used = 0;
+	size_t numRecords = 0;
+	size_t dropped = 0;
+};
+
+/**
+ * Reads records back out of a transcript captured by CellularHelperTranscript. Only uses the
+ * pointer it is given, so it works equally on a RAM buffer or a memory-mapped capture file.
+ */
+class CellularHelperTranscriptReader {
+public:
+	CellularHelperTranscriptReader(const uint8_t *data, size_t len);
+
+	/**
+	 * Returns true if the header is valid
+	 */
+	bool isValid() const { return cur != NULL; }
+
+	/**
+	 * Returns the next record, or false at the end of the data or if a record is truncated
+	 */
+	bool next(CellularHelperTranscriptRecord &rec);
+
+	/**
+	 * Starts over at the first record
+	 */
+	void rewind();
+
+protected:
+	const uint8_t *data;
+	const uint8_t *cur;
+	const uint8_t *end;
+};
+
+#endif /* __CELLULARHELPERTRANSCRIPT_H */
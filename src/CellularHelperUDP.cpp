@@ -0,0 +1,294 @@
+#include "CellularHelperUDP.h"
+
+#if Wiring_Cellular
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+static int hexValue(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+int CellularHelperUSORFResponse::parse(int type, const char *buf, int len) {
+	if (enableDebug) {
+		logCellularDebug(type, buf, len);
+	}
+	if (type != TYPE_PLUS) {
+		return WAIT;
+	}
+
+	CellularHelperLineScanner scanner(buf, len);
+	const char *line;
+	size_t lineLen;
+
+	while(scanner.next(line, lineLen)) {
+		if (!CellularHelperLineScanner::skipPlusPrefix(line, lineLen, "USORF", 5)) {
+			continue;
+		}
+
+		const char *p = line;
+		const char *end = line + lineLen;
+		int dataLen;
+
+		if (!CellularHelperFields::scanInt(p, end, socket) || p >= end) {
+			continue;
+		}
+		if (*p != '"') {
+			// +USORF: <socket>,<length> from AT+USORF=<socket>,0
+			int waiting;
+			if (CellularHelperFields::scanInt(p, end, waiting)) {
+				available = waiting;
+				valid = true;
+			}
+			continue;
+		}
+		p++;
+		const char *addrEnd = (const char *)memchr(p, '"', end - p);
+		if (!addrEnd || (size_t)(addrEnd - p) >= sizeof(addr)) {
+			continue;
+		}
+		memcpy(addr, p, addrEnd - p);
+		addr[addrEnd - p] = 0;
+		p = addrEnd + 1;
+		if (p < end && *p == ',') {
+			p++;
+		}
+		if (!CellularHelperFields::scanInt(p, end, port) || !CellularHelperFields::scanInt(p, end, dataLen) ||
+			p >= end || *p++ != '"') {
+			continue;
+		}
+
+		length = 0;
+		while(p + 1 < end && *p != '"' && length < bufSize && (int)length < dataLen) {
+			int hi = hexValue(p[0]);
+			int lo = hexValue(p[1]);
+			if (hi < 0 || lo < 0) {
+				break;
+			}
+			this->buf[length++] = (uint8_t)((hi << 4) | lo);
+			p += 2;
+		}
+		valid = true;
+	}
+	return WAIT;
+}
+
+CellularHelperUDP::CellularHelperUDP() {
+}
+
+CellularHelperUDP::~CellularHelperUDP() {
+	stop();
+}
+
+bool CellularHelperUDP::begin(uint16_t localPort) {
+	if (socket >= 0) {
+		return true;
+	}
+
+	// Hex mode for AT+USOST/AT+USORF data, Device OS normally has this set already
+	if (CellularHelper.command(NULL, CellularHelperClass::DEFAULT_TIMEOUT, "AT+UDCONF=1,1\r\n") != RESP_OK) {
+		errors++;
+		return false;
+	}
+
+	CellularHelperPlusFixedResponse<16> resp("USOCR");
+	int result;
+	if (localPort) {
+		result = CellularHelper.command(&resp, CellularHelperClass::DEFAULT_TIMEOUT, "AT+USOCR=17,%u\r\n", localPort);
+	}
+	else {
+		result = CellularHelper.command(&resp, CellularHelperClass::DEFAULT_TIMEOUT, "AT+USOCR=17\r\n");
+	}
+
+	int id;
+	if (result != RESP_OK || resp.scan(CellularHelperIntField(id)) != 1 || id < 0 || id >= (int)MAX_SOCKETS) {
+		errors++;
+		return false;
+	}
+
+	socket = id;
+	pending = 0;
+	CellularHelper.addURCHandler("UUSORF", uusorfHandler, this);
+	return true;
+}
+
+void CellularHelperUDP::stop() {
+	if (socket < 0) {
+		return;
+	}
+	CellularHelper.removeURCHandler("UUSORF", uusorfHandler, this);
+	CellularHelper.command(NULL, CellularHelperClass::DEFAULT_TIMEOUT, "AT+USOCL=%d\r\n", socket);
+	socket = -1;
+	pending = 0;
+}
+
+// static
+void CellularHelperUDP::uusorfHandler(const char *value, size_t valueLen, void *context) {
+	CellularHelperUDP *udp = (CellularHelperUDP *)context;
+
+	// +UUSORF: <socket>,<length>
+	const char *p = value;
+	const char *end = value + valueLen;
+	int id, length;
+	if (CellularHelperFields::scanInt(p, end, id) && CellularHelperFields::scanInt(p, end, length) &&
+		id == udp->socket) {
+		udp->pending = length;
+		udp->urcCount++;
+	}
+}
+
+bool CellularHelperUDP::sendTo(const IPAddress &addr, uint16_t port, const uint8_t *data, size_t len) {
+	uint8_t addrBytes[4] = { addr[0], addr[1], addr[2], addr[3] };
+	return sendNow(addrBytes, port, data, len);
+}
+
+bool CellularHelperUDP::sendNow(const uint8_t *addr, uint16_t port, const uint8_t *data, size_t len) {
+	if (socket < 0 || len > MAX_DATAGRAM_SIZE) {
+		errors++;
+		return false;
+	}
+
+	int offset = snprintf(commandBuf, sizeof(commandBuf), "AT+USOST=%d,\"%u.%u.%u.%u\",%u,%u,\"",
+		socket, addr[0], addr[1], addr[2], addr[3], port, (unsigned)len);
+	for(size_t ii = 0; ii < len; ii++) {
+		commandBuf[offset++] = hexDigits[data[ii] >> 4];
+		commandBuf[offset++] = hexDigits[data[ii] & 0xf];
+	}
+	strcpy(&commandBuf[offset], "\"\r\n");
+
+	system_tick_t start = millis();
+
+	// +USOST: <socket>,<length>
+	CellularHelperPlusFixedResponse<16> resp("USOST");
+	int result = CellularHelper.rawCommand(&resp, CellularHelperClass::DEFAULT_TIMEOUT, commandBuf);
+
+	sendTimeMs += millis() - start;
+
+	int id, sent;
+	if (result != RESP_OK || resp.scan(CellularHelperIntField(id), CellularHelperIntField(sent)) != 2 || sent != (int)len) {
+		errors++;
+		return false;
+	}
+
+	datagramsSent++;
+	bytesSent += len;
+	return true;
+}
+
+bool CellularHelperUDP::queue(const IPAddress &addr, uint16_t port, const uint8_t *data, size_t len) {
+	if (len > MAX_DATAGRAM_SIZE || queueUsed + 8 + len > SEND_QUEUE_SIZE) {
+		return false;
+	}
+
+	uint8_t *p = &sendQueue[queueUsed];
+	for(int ii = 0; ii < 4; ii++) {
+		p[ii] = addr[ii];
+	}
+	p[4] = (uint8_t)port;
+	p[5] = (uint8_t)(port >> 8);
+	p[6] = (uint8_t)len;
+	p[7] = (uint8_t)(len >> 8);
+	memcpy(&p[8], data, len);
+	queueUsed += 8 + len;
+
+	return true;
+}
+
+size_t CellularHelperUDP::flush() {
+	size_t offset = 0;
+	size_t count = 0;
+
+	while(offset < queueUsed) {
+		const uint8_t *p = &sendQueue[offset];
+		uint16_t port = p[4] | (p[5] << 8);
+		uint16_t len = p[6] | (p[7] << 8);
+
+		if (!sendNow(p, port, &p[8], len)) {
+			break;
+		}
+		offset += 8 + len;
+		count++;
+	}
+
+	// Keep anything that was not sent
+	memmove(sendQueue, &sendQueue[offset], queueUsed - offset);
+	queueUsed -= offset;
+
+	if (count) {
+		flushes++;
+	}
+	return count;
+}
+
+int CellularHelperUDP::receiveFrom(uint8_t *buf, size_t bufSize, char *addr, uint16_t *port) {
+	if (socket < 0) {
+		return -1;
+	}
+	if (pending == 0) {
+		return 0;
+	}
+	uint32_t seq = urcCount;
+
+	size_t len = bufSize;
+	if (len > MAX_DATAGRAM_SIZE) {
+		len = MAX_DATAGRAM_SIZE;
+	}
+
+	CellularHelperUSORFResponse resp(buf, bufSize);
+	int result = CellularHelper.command(&resp, CellularHelperClass::DEFAULT_TIMEOUT, "AT+USORF=%d,%u\r\n", socket, (unsigned)len);
+	if (result != RESP_OK || !resp.valid) {
+		// Wait for the next +UUSORF rather than retrying on every call
+		errors++;
+		setPending(0, seq);
+		return -1;
+	}
+
+	// Counting down from +UUSORF is not reliable: the rest of a datagram longer than the read
+	// is discarded, and a read can return nothing. Ask the modem what is still waiting.
+	setPending(queryAvailable(), seq);
+	if (resp.length == 0) {
+		return 0;
+	}
+
+	if (addr) {
+		strcpy(addr, resp.addr);
+	}
+	if (port) {
+		*port = (uint16_t)resp.port;
+	}
+
+	datagramsReceived++;
+	bytesReceived += resp.length;
+	return (int)resp.length;
+}
+
+size_t CellularHelperUDP::queryAvailable() {
+	CellularHelperUSORFResponse resp(NULL, 0);
+	int result = CellularHelper.command(&resp, CellularHelperClass::DEFAULT_TIMEOUT, "AT+USORF=%d,0\r\n", socket);
+	if (result != RESP_OK || !resp.valid || resp.available < 0) {
+		errors++;
+		return 0;
+	}
+	return (size_t)resp.available;
+}
+
+void CellularHelperUDP::setPending(size_t value, uint32_t seq) {
+	// A +UUSORF that arrived since seq was read is newer than value
+	if (urcCount == seq) {
+		pending = value;
+	}
+}
+
+void CellularHelperUDP::logStats() const {
+	Log.info("udp socket=%d sent=%lu/%lu bytes received=%lu/%lu bytes pending=%u queued=%u errors=%lu",
+		socket, (unsigned long)datagramsSent, (unsigned long)bytesSent, (unsigned long)datagramsReceived,
+		(unsigned long)bytesReceived, (unsigned)pending, (unsigned)queueUsed, (unsigned long)errors);
+	if (sendTimeMs > 0) {
+		Log.info("udp send time=%lu ms flushes=%lu throughput=%lu bytes/s", (unsigned long)sendTimeMs,
+			(unsigned long)flushes, (unsigned long)((uint64_t)bytesSent * 1000 / sendTimeMs));
+	}
+}
+
+#endif /* Wiring_Cellular */
@@ -0,0 +1,122 @@
+#ifndef __CELLULARHELPERUDP_H
+#define __CELLULARHELPERUDP_H
+
+#include "CellularHelper.h"
+
+#if Wiring_Cellular
+
+/**
+ * Parses +USORF: <socket>,"<addr>",<port>,<length>,"<hex data>" into a caller-provided buffer,
+ * or +USORF: <socket>,<length> from AT+USORF=<socket>,0 into available
+ */
+class CellularHelperUSORFResponse : public CellularHelperCommonResponse {
+public:
+	CellularHelperUSORFResponse(uint8_t *buf, size_t bufSize) : buf(buf), bufSize(bufSize) { addr[0] = 0; }
+
+	uint8_t *buf;
+	size_t bufSize;
+
+	bool valid = false;
+	int socket = -1;
+	char addr[16];
+	int port = 0;
+	size_t length = 0;		// Bytes decoded into buf
+	int available = -1;		// Bytes waiting, only for AT+USORF=<socket>,0
+
+	virtual int parse(int type, const char *buf, int len);
+};
+
+/**
+ * UDP socket using the u-blox socket commands directly (AT+USOCR, AT+USOST, AT+USORF), so
+ * application data can go to a collector without the Particle cloud.
+ *
+ * Data is exchanged in hex mode (AT+UDCONF=1,1). Datagrams are up to MAX_DATAGRAM_SIZE bytes.
+ * Commands are formatted into a buffer inside the object, so sending does not allocate.
+ *
+ * Sending: sendTo() sends one datagram now. queue() adds a datagram to a preallocated send
+ * queue, and flush() sends everything queued back to back, so several datagrams share one
+ * wake window. Call flush() from the scheduler's window handler.
+ *
+ * Receiving is driven by the +UUSORF URC, which the modem sends when data arrives. The URC is
+ * seen during any modem command, so available() can be checked without a modem round trip.
+ * Call CellularHelper.pollURCs() to pick up URCs while no other commands are running. After
+ * each read, the bytes still waiting are asked from the modem (AT+USORF=<socket>,0); if a read
+ * fails, nothing is read again until the next +UUSORF.
+ */
+class CellularHelperUDP {
+public:
+	static const size_t MAX_DATAGRAM_SIZE = 256;
+	static const size_t SEND_QUEUE_SIZE = 1024;
+	static const size_t MAX_SOCKETS = 7;		// Modem limit, including sockets used by Device OS
+
+	CellularHelperUDP();
+	~CellularHelperUDP();
+
+	/**
+	 * Creates the socket, bound to localPort if not 0. Returns false on error.
+	 */
+	bool begin(uint16_t localPort = 0);
+	void stop();
+
+	bool isOpen() const { return socket >= 0; }
+
+	/**
+	 * Sends one datagram now. Returns false on error.
+	 */
+	bool sendTo(const IPAddress &addr, uint16_t port, const uint8_t *data, size_t len);
+
+	/**
+	 * Adds a datagram to the send queue. Returns false if it does not fit.
+	 */
+	bool queue(const IPAddress &addr, uint16_t port, const uint8_t *data, size_t len);
+
+	/**
+	 * Sends all queued datagrams. Returns the number sent; on error the rest stay queued.
+	 */
+	size_t flush();
+
+	size_t getQueuedBytes() const { return queueUsed; }
+
+	/**
+	 * Bytes the modem reported as received and not read yet, from +UUSORF
+	 */
+	size_t available() const { return pending; }
+
+	/**
+	 * Reads one datagram into buf. addr (16 bytes) and port are optional. Returns the number of
+	 * bytes read, 0 if nothing is available, or -1 on error.
+	 */
+	int receiveFrom(uint8_t *buf, size_t bufSize, char *addr = NULL, uint16_t *port = NULL);
+
+	void logStats() const;
+
+	uint32_t datagramsSent = 0;
+	uint32_t bytesSent = 0;
+	uint32_t datagramsReceived = 0;
+	uint32_t bytesReceived = 0;
+	uint32_t errors = 0;
+	uint32_t flushes = 0;
+	uint32_t sendTimeMs = 0;		// Total time in AT+USOST, approximates radio-on time for sending
+
+protected:
+	static void uusorfHandler(const char *value, size_t valueLen, void *context);
+
+	bool sendNow(const uint8_t *addr, uint16_t port, const uint8_t *data, size_t len);
+	void setPending(size_t value, uint32_t seq);
+	size_t queryAvailable();
+
+	int socket = -1;
+	volatile size_t pending = 0;
+	volatile uint32_t urcCount = 0;		// Incremented by each +UUSORF for this socket
+
+	// Send queue entries: 4 byte address, uint16 port, uint16 len, len bytes
+	uint8_t sendQueue[SEND_QUEUE_SIZE];
+	size_t queueUsed = 0;
+
+	// AT+USOST=<socket>,"<addr>",<port>,<len>,"<hex>"\r\n
+	char commandBuf[48 + 2 * MAX_DATAGRAM_SIZE];
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERUDP_H */
@@ -0,0 +1,122 @@
+#include "CellularHelperUplink.h"
+
+#if Wiring_Cellular
+
+CellularHelperUplink::CellularHelperUplink(SendFunction fn, void *context) : sendFn(fn), sendContext(context) {
+	memset(batchesByTrigger, 0, sizeof(batchesByTrigger));
+	memset(bytesByBars, 0, sizeof(bytesByBars));
+}
+
+bool CellularHelperUplink::enqueue(const char *data, size_t len, system_tick_t budgetMs) {
+	if (len > RECORD_SIZE || numRecords >= MAX_RECORDS) {
+		recordsDropped++;
+		return false;
+	}
+
+	Record &rec = records[(firstRecord + numRecords) % MAX_RECORDS];
+	rec.deadline = millis() + (budgetMs ? budgetMs : defaultBudgetMs);
+	rec.len = (uint16_t)len;
+	memcpy(rec.data, data, len);
+	numRecords++;
+
+	return true;
+}
+
+bool CellularHelperUplink::poll(const CellularHelperLinkState &link, bool windowOpen) {
+	if (numRecords == 0) {
+		return false;
+	}
+
+	system_tick_t now = millis();
+	if (retryDelayMs != 0 && now - lastFailure < retryDelayMs) {
+		// Backing off after a failed send
+		return false;
+	}
+
+	int bars = (link.valid && link.lastValid && link.age <= maxLinkAgeMs) ? link.bars : 0;
+	lastBars = bars;
+
+	// Records can have different budgets, so check all of them
+	for(size_t ii = 0; ii < numRecords; ii++) {
+		if ((int32_t)(records[(firstRecord + ii) % MAX_RECORDS].deadline - now) <= 0) {
+			return sendAll(SEND_BUDGET, bars);
+		}
+	}
+
+	// Between windows, only decide again when the queue or the link changed
+	if (!windowOpen) {
+		if ((int)numRecords == decidedRecords && bars == decidedBars) {
+			return false;
+		}
+		decidedRecords = (int)numRecords;
+		decidedBars = bars;
+	}
+
+	if (bars >= minBars) {
+		int trigger = SEND_NONE;
+		if (windowOpen) {
+			trigger = SEND_GOOD_LINK;
+		}
+		else
+		if (numRecords >= MAX_RECORDS - 1) {
+			trigger = SEND_QUEUE_FULL;
+		}
+
+		// Filtered signal can be good while registration was just lost
+		if (trigger != SEND_NONE && CellularHelper.isModemRegistered()) {
+			return sendAll(trigger, bars);
+		}
+	}
+
+	deferred++;
+	return false;
+}
+
+bool CellularHelperUplink::flush() {
+	return sendAll(SEND_FLUSH, lastBars);
+}
+
+bool CellularHelperUplink::sendAll(int trigger, int bars) {
+	bool sent = false;
+
+	while(numRecords > 0) {
+		Record &rec = records[firstRecord];
+		if (!sendFn(rec.data, rec.len, sendContext)) {
+			sendFailures++;
+			retryDelayMs = (retryDelayMs == 0) ? RETRY_MIN_MS : retryDelayMs * 2;
+			if (retryDelayMs > RETRY_MAX_MS) {
+				retryDelayMs = RETRY_MAX_MS;
+			}
+			lastFailure = millis();
+			break;
+		}
+		bytesByBars[bars] += rec.len;
+		recordsSent++;
+		firstRecord = (firstRecord + 1) % MAX_RECORDS;
+		numRecords--;
+		sent = true;
+	}
+
+	if (numRecords == 0) {
+		retryDelayMs = 0;
+	}
+	if (sent) {
+		batches++;
+		batchesByTrigger[trigger]++;
+	}
+	return sent;
+}
+
+void CellularHelperUplink::logStats() const {
+	Log.info("uplink queued=%u batches=%lu sent=%lu dropped=%lu failures=%lu deferred=%lu retryDelay=%lums",
+		numRecords, (unsigned long)batches, (unsigned long)recordsSent, (unsigned long)recordsDropped,
+		(unsigned long)sendFailures, (unsigned long)deferred, (unsigned long)retryDelayMs);
+	Log.info("batches budget=%lu goodLink=%lu queueFull=%lu flush=%lu",
+		(unsigned long)batchesByTrigger[SEND_BUDGET], (unsigned long)batchesByTrigger[SEND_GOOD_LINK],
+		(unsigned long)batchesByTrigger[SEND_QUEUE_FULL], (unsigned long)batchesByTrigger[SEND_FLUSH]);
+	Log.info("bytes by bars 0=%lu 1=%lu 2=%lu 3=%lu 4=%lu",
+		(unsigned long)bytesByBars[0], (unsigned long)bytesByBars[1], (unsigned long)bytesByBars[2],
+		(unsigned long)bytesByBars[3], (unsigned long)bytesByBars[4]);
+}
+
+#endif /* Wiring_Cellular */
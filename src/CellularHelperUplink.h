@@ -0,0 +1,116 @@
+#ifndef __CELLULARHELPERUPLINK_H
+#define __CELLULARHELPERUPLINK_H
+
+#include "CellularHelperLinkQuality.h"
+
+#if Wiring_Cellular
+
+/**
+ * Queues telemetry and sends it when the link is good, to reduce the energy spent per byte.
+ *
+ * Uplink at the cell edge can cost an order of magnitude more energy than the same bytes in
+ * good coverage, because the modem transmits at high power and retransmits. Each queued record
+ * has a latency budget. poll() sends all queued records together when:
+ *
+ * - the oldest record's budget is used up (whatever the link quality), or
+ * - the filtered link state has at least minBars, the measurement is fresh and good, and a wake
+ *   window is already open (see CellularHelperScheduler), or
+ * - the link is good and the queue is nearly full.
+ *
+ * Otherwise sending is deferred. Before a link-driven send, the EPS registration is checked
+ * with AT+CEREG?. Between windows the link-driven decision is only made again when the queue
+ * length or the link bars change, so polling from loop() does not query the modem each pass.
+ *
+ * After a failed send, poll() waits RETRY_MIN_MS before trying again, doubling up to
+ * RETRY_MAX_MS while sends keep failing.
+ *
+ * Call poll() with windowOpen true from the scheduler's window handler at the end of a window,
+ * after the link has been sampled, and with windowOpen false from loop() so budgets are met.
+ */
+class CellularHelperUplink {
+public:
+	/**
+	 * Sends one record. Returns false if it could not be sent; it stays queued and is retried.
+	 */
+	typedef bool (*SendFunction)(const char *data, size_t len, void *context);
+
+	static const size_t MAX_RECORDS = 8;
+	static const size_t RECORD_SIZE = 128;
+
+	static const system_tick_t RETRY_MIN_MS = 5000;
+	static const system_tick_t RETRY_MAX_MS = 5 * 60 * 1000;
+
+	CellularHelperUplink(SendFunction fn, void *context = NULL);
+
+	/**
+	 * Queues a record. budgetMs of 0 uses the default latency budget. Returns false if the
+	 * record is too long or the queue is full.
+	 */
+	bool enqueue(const char *data, size_t len, system_tick_t budgetMs = 0);
+
+	/**
+	 * Sends queued records if the link and timing allow it. Returns true if anything was sent.
+	 */
+	bool poll(const CellularHelperLinkState &link, bool windowOpen);
+
+	/**
+	 * Sends all queued records now
+	 */
+	bool flush();
+
+	void setLatencyBudget(system_tick_t ms) { defaultBudgetMs = ms; }
+	void setMinBars(int bars) { minBars = bars; }
+	void setMaxLinkAge(system_tick_t ms) { maxLinkAgeMs = ms; }
+
+	size_t getQueued() const { return numRecords; }
+
+	void logStats() const;
+
+	// Send triggers
+	static const int SEND_NONE = 0;
+	static const int SEND_BUDGET = 1;
+	static const int SEND_GOOD_LINK = 2;
+	static const int SEND_QUEUE_FULL = 3;
+	static const int SEND_FLUSH = 4;
+
+	uint32_t batches = 0;
+	uint32_t recordsSent = 0;
+	uint32_t recordsDropped = 0;
+	uint32_t sendFailures = 0;
+	uint32_t deferred = 0;			// Send decisions (window, or queue/link change) that did not send
+	uint32_t batchesByTrigger[5];
+	uint32_t bytesByBars[5];		// bytes sent, by link bars at the time
+
+protected:
+	class Record {
+	public:
+		system_tick_t deadline;
+		uint16_t len;
+		char data[RECORD_SIZE];
+	};
+
+	bool sendAll(int trigger, int bars);
+
+	SendFunction sendFn;
+	void *sendContext;
+
+	Record records[MAX_RECORDS];	// Ring, oldest at firstRecord
+	size_t firstRecord = 0;
+	size_t numRecords = 0;
+
+	system_tick_t defaultBudgetMs = 15 * 60 * 1000;
+	int minBars = 3;
+	system_tick_t maxLinkAgeMs = 60 * 1000;
+	int lastBars = 0;				// From the most recent poll()
+
+	// Queue length and bars the last link-driven decision was made with, -1 for none
+	int decidedRecords = -1;
+	int decidedBars = -1;
+
+	system_tick_t retryDelayMs = 0;	// 0 if the last send worked
+	system_tick_t lastFailure = 0;
+};
+
+#endif /* Wiring_Cellular */
+
+#endif /* __CELLULARHELPERUPLINK_H */
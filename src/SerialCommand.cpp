@@ -15,9 +15,19 @@ SerialCommand::SerialCommand()
     commandCount(0),
     defaultHandler(NULL),
     term('\n'),           // default terminator for commands, newline character
-    last(NULL)
+    last(NULL),
+    nextJobId(1),
+    jobCallback(NULL),
+    abortRequested(false),
+    abortHandler(NULL),
+    jobLast(NULL)
+#if PLATFORM_THREADING
+    , workerThread(NULL),
+    workerSemaphore(NULL)
+#endif
 {
   strcpy(delim, " "); // strtok_r needs a null-terminated string
+  memset(jobs, 0, sizeof(jobs));
   clearBuffer();
 }
 
@@ -27,6 +37,19 @@ SerialCommand::SerialCommand()
  * to the handler function to deal with it.
  */
 void SerialCommand::addCommand(const char *command, void (*function)()) {
+  addCommand(command, function, false);
+}
+
+/**
+ * Adds a command whose handler runs on a worker thread, so readSerial() keeps processing
+ * commands such as status and abort while it runs. The handler gets its arguments with next()
+ * as usual.
+ */
+void SerialCommand::addBackgroundCommand(const char *command, void (*function)()) {
+  addCommand(command, function, true);
+}
+
+void SerialCommand::addCommand(const char *command, void (*function)(), bool background) {
   #ifdef SERIALCOMMAND_DEBUG
     serialCLI.print("Adding command (");
     serialCLI.print(commandCount);
@@ -36,7 +59,9 @@ void SerialCommand::addCommand(const char *command, void (*function)()) {
 
   commandList = (SerialCommandCallback *) realloc(commandList, (commandCount + 1) * sizeof(SerialCommandCallback));
   strncpy(commandList[commandCount].command, command, SERIALCOMMAND_MAXCOMMANDLENGTH);
+  commandList[commandCount].command[SERIALCOMMAND_MAXCOMMANDLENGTH] = '\0';
   commandList[commandCount].function = function;
+  commandList[commandCount].background = background;
   commandCount++;
 }
 
@@ -54,6 +79,14 @@ void SerialCommand::setDefaultHandler(void (*function)(const char *)) {
   defaultHandler = function;
 }
 
+/**
+ * This sets up a handler to pass aborts on to code that does not know about SerialCommand,
+ * such as a library with its own abort flag.
+ */
+void SerialCommand::setAbortHandler(void (*function)(bool abort)) {
+  abortHandler = function;
+}
+
 
 /**
  * This checks the Serial stream for characters, and assembles them into a buffer.
@@ -93,7 +126,12 @@ void SerialCommand::readSerial() {
             #endif
 
             // Execute the stored handler function for the command
-            (*commandList[i].function)();
+            if (commandList[i].background) {
+              startJob(&commandList[i]);
+            }
+            else {
+              (*commandList[i].function)();
+            }
             matched = true;
             break;
           }
@@ -130,5 +168,127 @@ void SerialCommand::clearBuffer() {
  * Returns NULL if no more tokens exist.
  */
 char *SerialCommand::next() {
+#if PLATFORM_THREADING
+  if (workerThread != NULL && os_thread_is_current(workerThread, NULL)) {
+    return strtok_r(NULL, delim, &jobLast);
+  }
+#endif
   return strtok_r(NULL, delim, &last);
 }
+
+bool SerialCommand::isJobRunning() {
+  return jobCallback != NULL;
+}
+
+bool SerialCommand::isAbortRequested() {
+  return abortRequested;
+}
+
+void SerialCommand::setProgress(const char *step) {
+  if (jobCallback != NULL) {
+    jobs[(nextJobId - 1) % SERIALCOMMAND_MAX_JOBS].progress = step;
+  }
+}
+
+bool SerialCommand::abortJob() {
+  if (jobCallback == NULL) {
+    return false;
+  }
+  abortRequested = true;
+  if (abortHandler != NULL) {
+    (*abortHandler)(true);
+  }
+  return true;
+}
+
+void SerialCommand::logStatus() {
+  if (jobCallback == NULL) {
+    Log.info("no job running");
+    return;
+  }
+  logJob(jobs[(nextJobId - 1) % SERIALCOMMAND_MAX_JOBS]);
+}
+
+void SerialCommand::logJobs() {
+  // Oldest first
+  for (uint32_t id = (nextJobId > SERIALCOMMAND_MAX_JOBS) ? (nextJobId - SERIALCOMMAND_MAX_JOBS) : 1; id < nextJobId; id++) {
+    logJob(jobs[id % SERIALCOMMAND_MAX_JOBS]);
+  }
+}
+
+void SerialCommand::logJob(const SerialCommandJob &job) {
+  static const char * const stateNames[] = { "", "running", "done", "aborted" };
+  uint8_t state = job.state;
+  const char *progress = job.progress;
+  unsigned long elapsed = (state == JOB_RUNNING) ? (millis() - job.startTime) : job.elapsed;
+
+  Log.info("job %lu %s %s %lu ms%s%s", (unsigned long)job.id, job.command, stateNames[state], elapsed,
+    progress ? ": " : "", progress ? progress : "");
+}
+
+/**
+ * Starts a background job for a matched command, copying the rest of the command line so
+ * the input buffer can be reused while it runs.
+ */
+void SerialCommand::startJob(SerialCommandCallback *callback) {
+  if (jobCallback != NULL) {
+    const SerialCommandJob &running = jobs[(nextJobId - 1) % SERIALCOMMAND_MAX_JOBS];
+    Log.info("busy, job %lu %s is running (use abort)", (unsigned long)running.id, running.command);
+    return;
+  }
+
+  strncpy(jobArgs, last ? last : "", SERIALCOMMAND_BUFFER);
+  jobArgs[SERIALCOMMAND_BUFFER] = '\0';
+  jobLast = jobArgs;
+
+  SerialCommandJob &job = jobs[nextJobId % SERIALCOMMAND_MAX_JOBS];
+  job.id = nextJobId;
+  strcpy(job.command, callback->command);
+  job.startTime = millis();
+  job.elapsed = 0;
+  job.progress = NULL;
+  job.state = JOB_RUNNING;
+
+  abortRequested = false;
+  if (abortHandler != NULL) {
+    (*abortHandler)(false);
+  }
+
+  nextJobId++;
+  jobCallback = callback;
+
+  Log.info("job %lu %s started", (unsigned long)job.id, job.command);
+
+#if PLATFORM_THREADING
+  if (workerThread == NULL) {
+    os_semaphore_create(&workerSemaphore, 1, 0);
+    os_thread_create(&workerThread, "cli", OS_THREAD_PRIORITY_DEFAULT, workerThreadFunction, this, SERIALCOMMAND_WORKER_STACK_SIZE);
+  }
+  os_semaphore_give(workerSemaphore, false);
+#else
+  runJob();
+#endif
+}
+
+void SerialCommand::runJob() {
+  SerialCommandJob &job = jobs[(nextJobId - 1) % SERIALCOMMAND_MAX_JOBS];
+
+  (*jobCallback->function)();
+
+  job.elapsed = millis() - job.startTime;
+  job.state = abortRequested ? JOB_ABORTED : JOB_DONE;
+  Log.info("job %lu %s %s in %lu ms", (unsigned long)job.id, job.command,
+    (job.state == JOB_ABORTED) ? "aborted" : "done", job.elapsed);
+
+  // readSerial() can start the next job after this
+  jobCallback = NULL;
+}
+
+void SerialCommand::workerThreadFunction(void *param) {
+  SerialCommand *sc = (SerialCommand *)param;
+
+  while (true) {
+    os_semaphore_take(sc->workerSemaphore, CONCURRENT_WAIT_FOREVER, false);
+    sc->runJob();
+  }
+}
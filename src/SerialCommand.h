@@ -18,6 +18,11 @@
 
 #define serialCLI Serial1  // Serial port to use
 
+// Number of finished background jobs kept for logJobs()
+#define SERIALCOMMAND_MAX_JOBS 8
+// Stack size of the thread that runs background commands
+#define SERIALCOMMAND_WORKER_STACK_SIZE 6144
+
 // Uncomment the next line to run the library in debug mode (verbose messages)
 //#define SERIALCOMMAND_DEBUG
 
@@ -25,21 +30,53 @@ class SerialCommand {
   public:
     SerialCommand();      // Constructor
     void addCommand(const char *command, void(*function)());  // Add a command to the processing dictionary.
+    void addBackgroundCommand(const char *command, void(*function)());  // Add a command that runs as a background job.
     void listCommands();   // Lists all commands to serial.
 
     void setDefaultHandler(void (*function)(const char *));   // A handler to call when no valid command received.
+    void setAbortHandler(void (*function)(bool abort));       // Called with true by abortJob(), and false when the next job starts.
 
     void readSerial();    // Main entry point.
     void clearBuffer();   // Clears the input buffer.
 
     char *next();         // Returns pointer to next token found in command buffer (for getting arguments to commands).
 
+    // Background jobs. Only one runs at a time; readSerial() rejects another while it runs.
+    bool isJobRunning();           // True while a background command is running.
+    bool isAbortRequested();       // Polled by background commands in their wait loops.
+    void setProgress(const char *step);  // Set by background commands, shown by logStatus(). Must be a string literal.
+    bool abortJob();               // Asks the running job to stop. Returns false if no job is running.
+    void logStatus();              // Logs the running job, its elapsed time and progress.
+    void logJobs();                // Logs the running job and the most recent finished jobs.
+
+    static const uint8_t JOB_RUNNING = 1;
+    static const uint8_t JOB_DONE = 2;
+    static const uint8_t JOB_ABORTED = 3;
+
   private:
     // Command/handler dictionary
     struct SerialCommandCallback {
       char command[SERIALCOMMAND_MAXCOMMANDLENGTH + 1];
       void (*function)();
+      bool background;
     };                                    // Data structure to hold Command/Handler function key-value pairs
+
+    // One background job, running or finished
+    struct SerialCommandJob {
+      uint32_t id;
+      char command[SERIALCOMMAND_MAXCOMMANDLENGTH + 1];
+      volatile uint8_t state;
+      unsigned long startTime;
+      unsigned long elapsed;               // Set when the job finishes
+      const char * volatile progress;
+    };
+
+    void addCommand(const char *command, void(*function)(), bool background);
+    void startJob(SerialCommandCallback *callback);
+    void runJob();
+    void logJob(const SerialCommandJob &job);
+    static void workerThreadFunction(void *param);
+
     SerialCommandCallback *commandList;   // Actual definition for command/handler array
     uint8_t commandCount;
 
@@ -52,6 +89,19 @@ class SerialCommand {
     char buffer[SERIALCOMMAND_BUFFER + 1]; // Buffer of stored characters while waiting for terminator character
     uint8_t bufPos;                        // Current position in the buffer
     char *last;                         // State variable used by strtok_r during processing
+
+    SerialCommandJob jobs[SERIALCOMMAND_MAX_JOBS];  // Ring, indexed by job id
+    uint32_t nextJobId;
+    SerialCommandCallback * volatile jobCallback;   // Set while a job is running
+    volatile bool abortRequested;
+    void (*abortHandler)(bool abort);
+
+    char jobArgs[SERIALCOMMAND_BUFFER + 1];  // Arguments of the running job, tokenized by next() on the worker thread
+    char *jobLast;
+#if PLATFORM_THREADING
+    os_thread_t workerThread;
+    os_semaphore_t workerSemaphore;
+#endif
 };
 
 #endif //SerialCommand_h
@@ -8,7 +8,22 @@
 // includes
 #include "Particle.h"
 #include "SerialCommand.h"
+#include "AsyncSerialLogHandler.h"
 #include "CellularHelper.h"
+#include "CellularHelperSessionStats.h"
+#include "CellularHelperBenchmark.h"
+#include "CellularHelperScheduler.h"
+#include "CellularHelperLinkQuality.h"
+#include "CellularHelperUplink.h"
+#include "CellularHelperUDP.h"
+#include "CellularHelperTelemetry.h"
+#include "CellularHelperRadioState.h"
+#include "CellularHelperDNSCache.h"
+#include "CellularHelperPingProbe.h"
+#include "CellularHelperLocator.h"
+#include "CellularHelperTowerDB.h"
+#include "CellularHelperPLMNStore.h"
+#include "CellularHelperOperatorScan.h"
 
 // put in your 3rd party apn info here
 STARTUP(cellular_credentials_set("public", "", "", NULL));
@@ -16,12 +31,62 @@ STARTUP(cellular_credentials_set("public", "", "", NULL));
 SYSTEM_MODE(MANUAL);
 SYSTEM_THREAD(ENABLED);
 
+// Keeps the DNS cache across sleep and reset
+STARTUP(System.enableFeature(FEATURE_RETAINED_MEMORY));
+
 // 'Serial1' usage allows power measurements
 #define SerialCLI Serial1
 //#define SerialCLI Serial
 
-Serial1LogHandler logHandler(19200,LOG_LEVEL_TRACE);
+// Buffers log output and sends it from loop(), so logging does not add UART time to the timings we report
+AsyncSerialLogHandler logHandler(Serial1, 19200, LOG_LEVEL_TRACE);
 SerialCommand sCmd;
+CellularHelperScheduler scheduler;
+CellularHelperLinkQuality linkQuality;
+
+bool uplink_send(const char *data, size_t len, void *context);
+CellularHelperUplink uplink(uplink_send);
+
+CellularHelperUDP udp;
+
+// Telemetry samples: rsrp, rsrq, sinr, bars, registration stat, cell id, free memory
+const size_t TELEMETRY_CHANNELS = 7;
+bool telemetry_flush(const uint8_t *payload, size_t len, void *context);
+CellularHelperTelemetry telemetry(TELEMETRY_CHANNELS, telemetry_flush);
+IPAddress telemetryAddr;
+uint16_t telemetryPort = 0;
+
+// Connected, idle and PSM time per hour from +CSCON/+UUPSMR
+CellularHelperRadioState radioState;
+
+// Resolved hostnames, so reconnects do not repeat AT+UDNSRN over the air
+retained CellularHelperDNSCacheData dnsCacheData;
+CellularHelperDNSCache dnsCache(&dnsCacheData);
+
+// Round trip statistics for site qualification
+CellularHelperPingProbe pingProbe;
+
+// CellLocate without blocking loop(), reusing the last fix while the serving cell is the same
+CellularHelperLocator locator;
+
+// Offline cell ID positions. Replace with a database generated in the format described in
+// CellularHelperTowerDB.h, for example from OpenCelliD data for the deployment area. This
+// placeholder is a valid database with no records.
+const uint8_t towerData[CellularHelperTowerDB::HEADER_SIZE] = { 'C', 'T', 'D', 'B', 1, 0, CellularHelperTowerDB::RECORD_SIZE, 0 };
+CellularHelperTowerDBMemoryReader towerReader(towerData, sizeof(towerData));
+CellularHelperTowerDB towerDB(towerReader);
+
+// Last network registered on, kept in EEPROM so a cold boot can go straight back to it
+const int PLMN_EEPROM_ADDRESS = 0;
+CellularHelperPLMNEEPROMStorage plmnStorage(PLMN_EEPROM_ADDRESS);
+CellularHelperPLMNStore plmnStore(plmnStorage);
+CellularHelperFastAttach fastAttach(plmnStore);
+
+// Cat M1 band mask before the last bands command changed it, for bands restore
+CellularHelperBandMask previousBands;
+
+// AT+COPS=? in the background, reporting each network as it is parsed
+CellularHelperOperatorScan opScan;
 
 bool cellularOn = false;
 bool cellularPsmOn = false;
@@ -30,6 +95,10 @@ const unsigned long MODEM_ON_WAIT_TIME_MS = 4000;
 const unsigned long CONNECT_WAIT_TIME_MS = 40000;
 const unsigned long AT_COMMAND_WAIT_TIME_MS = 10000;
 
+// Buffer for the binary AT transcript, see CellularHelperTranscript.h
+const size_t TRANSCRIPT_BUFFER_SIZE = 8192;
+uint8_t transcriptBuffer[TRANSCRIPT_BUFFER_SIZE];
+
 void unrecognized();
 void modem_register();
 void modem_unregister();
@@ -53,6 +122,44 @@ void get_cereg();
 void get_creg();
 
 void verify_lte_settings();
+bool wait_unless_aborted(unsigned long ms);
+bool restart_modem();
+
+void job_status();
+void list_jobs();
+void abort_job();
+void abort_handler(bool abort);
+
+void sample();
+void link_state();
+void uplink_command();
+void udp_command();
+void telemetry_command();
+void radio_state();
+void dns_command();
+void ping_probe();
+void ping_probe_done(CellularHelperPingProbe &probe, void *context);
+void locate();
+void locate_done(const CellularHelperLocationFix &fix, bool fromCache, void *context);
+void tower_lookup();
+void attach();
+void plmn_command();
+void bands_command();
+void operator_scan();
+void operator_found(const CellularHelperOperatorInfo &op, void *context);
+void operator_scan_done(CellularHelperOperatorScan &scan, bool fromCache, void *context);
+void window_handler(bool start, void *context);
+
+void transcript();
+void analyze_transcript();
+
+void parser_benchmark();
+void parser_fuzz();
+void heap_soak();
+void flush_benchmark_record();
+void command_stats();
+void log_stats();
+void udp_receive();
 
 // setup() runs once, when the device is first turned on.
 void setup() {
@@ -63,9 +170,10 @@ void setup() {
   SerialCLI.begin(19200);
 
   // Setup callbacks for SerialCommand commands
-  sCmd.addCommand("modemreg", modem_register);
+  // Long-running commands run as background jobs so status and abort keep working
+  sCmd.addBackgroundCommand("modemreg", modem_register);
   sCmd.addCommand("modemunreg", modem_unregister);
-  sCmd.addCommand("networkconn", network_connect);
+  sCmd.addBackgroundCommand("networkconn", network_connect);
   sCmd.addCommand("networkdisconn", network_disconnect);
 
   sCmd.addCommand("particleconn", particle_connect);
@@ -77,15 +185,52 @@ void setup() {
   sCmd.addCommand("getmno", get_mno);
   sCmd.addCommand("setmno", set_mno);
 
-  sCmd.addCommand("enterpsm", enter_psm);
-  sCmd.addCommand("exitpsm", exit_psm);
+  sCmd.addBackgroundCommand("enterpsm", enter_psm);
+  sCmd.addBackgroundCommand("exitpsm", exit_psm);
   sCmd.addCommand("getpsm", get_psm_settings);
 
   sCmd.addCommand("getcops", get_cops);
   sCmd.addCommand("getcereg", get_cereg);
   sCmd.addCommand("getcreg", get_creg);
 
-  sCmd.addCommand("setuplte", verify_lte_settings);
+  sCmd.addBackgroundCommand("setuplte", verify_lte_settings);
+
+  sCmd.addCommand("status", job_status);
+  sCmd.addCommand("jobs", list_jobs);
+  sCmd.addCommand("abort", abort_job);
+  sCmd.setAbortHandler(abort_handler);
+
+  sCmd.addCommand("sample", sample);
+  sCmd.addCommand("link", link_state);
+  sCmd.addCommand("uplink", uplink_command);
+  sCmd.addCommand("udp", udp_command);
+  sCmd.addCommand("telem", telemetry_command);
+  sCmd.addCommand("radio", radio_state);
+  sCmd.addBackgroundCommand("dns", dns_command);  // Same thread as networkconn, which also uses the cache
+  sCmd.addCommand("probe", ping_probe);
+  pingProbe.onDone(ping_probe_done);
+  sCmd.addCommand("locate", locate);
+  sCmd.addCommand("tower", tower_lookup);
+  sCmd.addBackgroundCommand("attach", attach);
+  sCmd.addCommand("plmn", plmn_command);
+  sCmd.addBackgroundCommand("bands", bands_command);
+  sCmd.addCommand("opscan", operator_scan);
+  opScan.onOperator(operator_found);
+  opScan.onDone(operator_scan_done);
+  towerDB.begin();
+
+  // Queued telemetry goes out at the end of a sampling window, after the link was measured
+  scheduler.setWindowHandler(window_handler, NULL);
+
+  sCmd.addCommand("transcript", transcript);
+  sCmd.addCommand("analyze", analyze_transcript);
+
+  sCmd.addCommand("parsebench", parser_benchmark);
+  sCmd.addCommand("parsefuzz", parser_fuzz);
+  sCmd.addCommand("heapsoak", heap_soak);
+  CellularHelperBenchmark::onRecord(flush_benchmark_record);
+  sCmd.addCommand("cmdstats", command_stats);
+  sCmd.addCommand("logstats", log_stats);
 
   sCmd.setDefaultHandler(unrecognized);      // Handler for command that isn't matched
 
@@ -93,19 +238,35 @@ void setup() {
 
   Log.info("ready");
 
+  // listCommands writes to the port directly
+  logHandler.flush();
   sCmd.listCommands();
 }
 
 // loop() runs over and over again, as quickly as it can execute.
 void loop() {
   // The core of your code will likely live here.
-  sCmd.readSerial();     // We don't do much, just process serial commands
+  sCmd.readSerial();     // Process serial commands
+  if (!opScan.isRunning()) {
+    scheduler.loop();    // Run periodic modem sampling jobs, which are refused during an operator scan
+  }
+  uplink.poll(linkQuality.getLinkState(), false);  // Send telemetry whose latency budget is used up
+  telemetry.poll();      // Flush telemetry samples older than the maximum age
+  radioState.update();   // Account radio connected/idle/PSM time
+  pingProbe.loop();      // Send pings and collect +UUPING round trips
+  locator.loop();        // Wait for +UULOC from a pending CellLocate request
+  opScan.loop();         // Wait for +COPS from a running operator scan
+  if (!opScan.isRunning()) {
+    udp_receive();       // Read datagrams announced by +UUSORF, kept waiting during an operator scan
+  }
+  logHandler.drain();    // Send buffered log output
 }
 
 // This gets set as the default handler, and gets called when no other command matches.
 void unrecognized(const char *) {
   Log.info("Unsupported command");
   Log.info("Supported commands are:");
+  logHandler.flush();
   sCmd.listCommands();
 }
 
@@ -116,14 +277,18 @@ void modem_register()
   stateTime = millis();
 
   Log.info("registering modem onto the cellular network...");
+  sCmd.setProgress("powering on modem");
   Cellular.on();
 
-  while (millis() - stateTime <= MODEM_ON_WAIT_TIME_MS) {}
+  if (!wait_unless_aborted(MODEM_ON_WAIT_TIME_MS)) {
+    return;
+  }
 
   unsigned long elapsed = millis() - stateTime;
   Log.info("registered on the cellular network in %lu milliseconds", elapsed);
 
   Log.info("modem initialized");
+  sCmd.setProgress("reading modem identity");
   Log.info("manufacturer=%s", CellularHelper.getManufacturer().c_str());
   Log.info("model=%s", CellularHelper.getModel().c_str());
   Log.info("firmware version=%s", CellularHelper.getFirmwareVersion().c_str());
@@ -157,11 +322,15 @@ void network_connect() {
 
   Log.info("requesting a data connection on the cellular network...");
 
+  sCmd.setProgress("waiting for data connection");
   Cellular.connect();
 
-  while ((millis() - stateTime <= CONNECT_WAIT_TIME_MS) && !(Cellular.ready())) {}
+  while ((millis() - stateTime <= CONNECT_WAIT_TIME_MS) && !(Cellular.ready()) && !sCmd.isAbortRequested()) {
+    delay(10);
+  }
 
-  if (Cellular.ready()) {
+  if (Cellular.ready() && !sCmd.isAbortRequested()) {
+    sCmd.setProgress("querying network");
     unsigned long elapsed = millis() - stateTime;
 
     Log.info("obtained a data connection in %lu milliseconds", elapsed);
@@ -177,7 +346,7 @@ void network_connect() {
 
   	Log.info("ping 8.8.8.8=%d", CellularHelper.ping("8.8.8.8"));
 
-  	Log.info("dns device.spark.io=%s", CellularHelper.dnsLookup("device.spark.io").toString().c_str());
+  	Log.info("dns device.spark.io=%s", dnsCache.lookup("device.spark.io").toString().c_str());
   }
   else
   if (Cellular.listening()) {
@@ -257,6 +426,33 @@ void set_mno() {
 
 }
 
+// Waits up to ms, returning false early if the running job is aborted
+bool wait_unless_aborted(unsigned long ms) {
+  unsigned long start = millis();
+
+  while (millis() - start < ms) {
+    if (sCmd.isAbortRequested()) {
+      return false;
+    }
+    delay(10);
+  }
+  return true;
+}
+
+// Power cycles the modem so MNO and RAT changes take effect
+bool restart_modem() {
+  sCmd.setProgress("restarting modem");
+  if (!wait_unless_aborted(MODEM_ON_WAIT_TIME_MS)) {
+    return false;
+  }
+  Cellular.off();
+  if (!wait_unless_aborted(MODEM_ON_WAIT_TIME_MS)) {
+    return false;
+  }
+  Cellular.on();
+  return wait_unless_aborted(MODEM_ON_WAIT_TIME_MS);
+}
+
 void verify_lte_settings() {
 	int args[2];
   String ratResult;
@@ -277,15 +473,14 @@ void verify_lte_settings() {
     // Particle OS may set this to 1 if it sees the 0
     // For EU, must be set to 100
 
+    sCmd.setProgress("checking MNO");
     if(CellularHelper.getMNO() != 100)
     {
       Log.error("MNO is NOT ok - correcting");
       CellularHelper.setMNO(100);
-      delay(MODEM_ON_WAIT_TIME_MS);
-      Cellular.off();
-      delay(MODEM_ON_WAIT_TIME_MS);
-      Cellular.on();
-      delay(MODEM_ON_WAIT_TIME_MS);
+      if (!restart_modem()) {
+        return;
+      }
     }
 
     Log.info("MNO is ok");
@@ -293,17 +488,16 @@ void verify_lte_settings() {
     // check RAT
     // Factory default is 7,8 (7=cat M1, 8=NB-IoT)
     // For our application, must be set to 7
+    sCmd.setProgress("checking RAT");
     ratResult = CellularHelper.getRAT();
     tokens = sscanf((ratResult.c_str()), "%u,%u", &args[0], &args[1]);
 
     if (tokens != 1 || args[0] != 7) {
       Log.error("RAT is NOT ok - correcting");
       CellularHelper.setRAT(7);
-      delay(MODEM_ON_WAIT_TIME_MS);
-      Cellular.off();
-      delay(MODEM_ON_WAIT_TIME_MS);
-      Cellular.on();
-      delay(MODEM_ON_WAIT_TIME_MS);
+      if (!restart_modem()) {
+        return;
+      }
     }
 
     Log.info("RAT is ok");
@@ -314,6 +508,7 @@ void verify_lte_settings() {
 void enter_psm()
 {
   Log.info("Entering PSM mode of modem");
+  sCmd.setProgress("configuring PSM and waiting for +UUPSMR");
   if (CellularHelper.enterPSM())
   {
     Log.info("PSM mode successfully enabled!");
@@ -328,7 +523,8 @@ void enter_psm()
 void exit_psm()
 {
   Log.info("Exiting PSM mode of modem");
-  
+  sCmd.setProgress("waking modem and waiting for +UUPSMR");
+
   if(!CellularHelper.exitPSM())
   {
     Log.warn("Exiting PSM mode failed!");
@@ -360,4 +556,794 @@ void get_cereg()
 void get_creg()
 {
   Log.info("CREG = %s", CellularHelper.getCREG().c_str());
-}
\ No newline at end of file
+}
+
+// Shows the running background job, and the modem state as this app tracks it
+void job_status()
+{
+  sCmd.logStatus();
+  Log.info("cellularOn=%d cellularPsmOn=%d", cellularOn, cellularPsmOn);
+}
+
+void list_jobs()
+{
+  sCmd.logJobs();
+}
+
+void abort_job()
+{
+  if (!sCmd.abortJob()) {
+    Log.info("no job running");
+    return;
+  }
+  Log.info("abort requested");
+}
+
+// Passes aborts on to the CellularHelper wait loops, and clears them when the next job starts
+void abort_handler(bool abort)
+{
+  if (abort) {
+    CellularHelper.requestAbort();
+  }
+  else {
+    CellularHelper.clearAbort();
+  }
+}
+
+// Periodic sampling jobs, run from loop() by the scheduler
+void sample_csq(void *)
+{
+  CellularHelperRSSIQualResponse rssiQual = CellularHelper.getRSSIQual();
+  Log.info("sample rssi=%d qual=%d", rssiQual.rssi, rssiQual.qual);
+}
+
+void sample_cereg(void *)
+{
+  // Only log registration changes
+  static int lastStat = -1;
+  static int lastCi = -1;
+
+  CellularHelperCEREGResponse reg;
+  CellularHelper.getCEREG(reg);
+  if (reg.valid && (reg.stat != lastStat || reg.ci != lastCi)) {
+    Log.info("sample %s", reg.toString().c_str());
+    lastStat = reg.stat;
+    lastCi = reg.ci;
+  }
+}
+
+void sample_link(void *)
+{
+  linkQuality.sample();
+}
+
+void sample_psm(void *)
+{
+  Log.info("sample psm=%s", CellularHelper.getNetworkPSMSettings().c_str());
+}
+
+void sample_urc(void *)
+{
+  // Picks up +CSCON/+UUPSMR and other URCs that arrived while the modem was otherwise unused
+  CellularHelper.pollURCs();
+}
+
+void sample_telemetry(void *)
+{
+  CellularHelperSignalSample signal;
+  CellularHelper.getSignalSample(signal);
+  linkQuality.add(signal);
+  CellularHelperLinkState link = linkQuality.getLinkState();
+
+  CellularHelperCEREGResponse reg;
+  CellularHelper.getCEREG(reg);
+
+  int32_t values[TELEMETRY_CHANNELS] = {
+    link.rsrp, link.rsrq, link.hasSinr ? link.sinr : 0, link.bars,
+    reg.valid ? reg.stat : -1, reg.valid ? reg.ci : -1, (int32_t)System.freeMemory()
+  };
+  uint32_t time = Time.isValid() ? (uint32_t)Time.now() : millis() / 1000;
+  if (!telemetry.add(time, values)) {
+    Log.info("telemetry sample dropped");
+  }
+}
+
+// sample [csq|cereg|psm|link|telem|urc periodSec [slackSec]] | [off]
+// Jobs may run up to slackSec early (default a quarter of the period) so they share wake windows
+void sample()
+{
+  char *arg = sCmd.next();
+
+  if (arg == NULL) {
+    scheduler.logJobs();
+    return;
+  }
+  if (strcmp(arg, "off") == 0) {
+    scheduler.clear();
+    Log.info("sampling stopped");
+    return;
+  }
+
+  CellularHelperScheduler::JobFunction fn = NULL;
+  const char *name = NULL;
+  if (strcmp(arg, "csq") == 0) {
+    fn = sample_csq;
+    name = "csq";
+  }
+  else
+  if (strcmp(arg, "cereg") == 0) {
+    fn = sample_cereg;
+    name = "cereg";
+  }
+  else
+  if (strcmp(arg, "psm") == 0) {
+    fn = sample_psm;
+    name = "psm";
+  }
+  else
+  if (strcmp(arg, "link") == 0) {
+    fn = sample_link;
+    name = "link";
+  }
+  else
+  if (strcmp(arg, "telem") == 0) {
+    fn = sample_telemetry;
+    name = "telem";
+  }
+  else
+  if (strcmp(arg, "urc") == 0) {
+    fn = sample_urc;
+    name = "urc";
+  }
+
+  char *period = sCmd.next();
+  if (fn == NULL || period == NULL || atoi(period) <= 0) {
+    Log.info("usage: sample [csq|cereg|psm|link|telem|urc periodSec [slackSec]] | [off]");
+    return;
+  }
+
+  system_tick_t periodMs = atoi(period) * 1000;
+  system_tick_t slackMs = periodMs / 4;
+  char *slack = sCmd.next();
+  if (slack != NULL) {
+    slackMs = atoi(slack) * 1000;
+  }
+
+  if (scheduler.addJob(name, fn, NULL, periodMs, slackMs) < 0) {
+    Log.info("too many sampling jobs");
+  }
+}
+
+// link [now|clear]
+// Shows the filtered LTE link state and RSRP/RSRQ/SINR statistics from "sample link" or "link now"
+void link_state()
+{
+  char *arg = sCmd.next();
+
+  if (arg != NULL && strcmp(arg, "clear") == 0) {
+    linkQuality.clear();
+    return;
+  }
+  if (arg != NULL && strcmp(arg, "now") == 0) {
+    CellularHelperSignalSample sample;
+    CellularHelper.getSignalSample(sample);
+    Log.info("signal %s", sample.toString().c_str());
+    linkQuality.add(sample);
+  }
+  linkQuality.logStats();
+}
+
+void window_handler(bool start, void *)
+{
+  if (!start) {
+    uplink.poll(linkQuality.getLinkState(), true);
+    if (udp.getQueuedBytes() > 0) {
+      udp.flush();
+    }
+  }
+}
+
+bool uplink_send(const char *data, size_t len, void *)
+{
+  if (!Particle.connected()) {
+    return false;
+  }
+
+  // Records are queued as text, so they are null terminated within len
+  char event[CellularHelperUplink::RECORD_SIZE + 1];
+  memcpy(event, data, len);
+  event[len] = 0;
+
+  return Particle.publish("telemetry", event, PRIVATE);
+}
+
+// uplink [queue text] | [budget sec] | [bars n] | [flush]
+void uplink_command()
+{
+  char *arg = sCmd.next();
+
+  if (arg == NULL) {
+    uplink.logStats();
+    return;
+  }
+
+  char *value = sCmd.next();
+  if (strcmp(arg, "queue") == 0 && value != NULL) {
+    if (!uplink.enqueue(value, strlen(value))) {
+      Log.info("uplink queue full");
+    }
+  }
+  else
+  if (strcmp(arg, "budget") == 0 && value != NULL) {
+    uplink.setLatencyBudget(atoi(value) * 1000);
+  }
+  else
+  if (strcmp(arg, "bars") == 0 && value != NULL) {
+    uplink.setMinBars(atoi(value));
+  }
+  else
+  if (strcmp(arg, "flush") == 0) {
+    uplink.flush();
+  }
+  else {
+    Log.info("usage: uplink [queue text] | [budget sec] | [bars n] | [flush]");
+  }
+}
+
+void udp_receive()
+{
+  if (udp.available() == 0) {
+    return;
+  }
+
+  uint8_t buf[CellularHelperUDP::MAX_DATAGRAM_SIZE + 1];
+  char addr[16];
+  uint16_t port;
+  int len = udp.receiveFrom(buf, sizeof(buf) - 1, addr, &port);
+  if (len > 0) {
+    buf[len] = 0;
+    Log.info("udp from %s:%u len=%d: %s", addr, port, len, (const char *)buf);
+  }
+}
+
+// udp [open [port]] | [send|queue a.b.c.d port text] | [flush] | [close]
+// queued datagrams also go out at the end of each sampling window
+void udp_command()
+{
+  char *arg = sCmd.next();
+
+  if (arg == NULL) {
+    udp.logStats();
+    return;
+  }
+  if (strcmp(arg, "open") == 0) {
+    char *port = sCmd.next();
+    Log.info("udp open %s", udp.begin((port != NULL) ? atoi(port) : 0) ? "ok" : "failed");
+    return;
+  }
+  if (strcmp(arg, "close") == 0) {
+    udp.stop();
+    return;
+  }
+  if (strcmp(arg, "flush") == 0) {
+    Log.info("udp sent %u datagrams", udp.flush());
+    return;
+  }
+
+  bool send = (strcmp(arg, "send") == 0);
+  if (send || strcmp(arg, "queue") == 0) {
+    char *addr = sCmd.next();
+    char *port = sCmd.next();
+    char *text = sCmd.next();
+    int a, b, c, d;
+    if (addr != NULL && port != NULL && text != NULL && sscanf(addr, "%d.%d.%d.%d", &a, &b, &c, &d) == 4) {
+      IPAddress ip(a, b, c, d);
+      bool result = send ? udp.sendTo(ip, atoi(port), (const uint8_t *)text, strlen(text)) :
+        udp.queue(ip, atoi(port), (const uint8_t *)text, strlen(text));
+      Log.info("udp %s %s", arg, result ? "ok" : "failed");
+      return;
+    }
+  }
+  Log.info("usage: udp [open [port]] | [send|queue a.b.c.d port text] | [flush] | [close]");
+}
+
+// radio [on|off] | [hours n]
+// Shows RRC connected, idle and PSM time per hour. Use "sample urc periodSec" so transitions
+// are seen while nothing else is talking to the modem.
+void radio_state()
+{
+  char *arg = sCmd.next();
+
+  if (arg == NULL) {
+    radioState.logStats();
+    return;
+  }
+  if (strcmp(arg, "on") == 0) {
+    Log.info("radio state tracking %s", radioState.begin() ? "started" : "failed");
+    return;
+  }
+  if (strcmp(arg, "off") == 0) {
+    radioState.end();
+    return;
+  }
+  char *value = sCmd.next();
+  if (strcmp(arg, "hours") == 0 && value != NULL) {
+    radioState.logStats(atoi(value));
+    return;
+  }
+  Log.info("usage: radio [on|off] | [hours n]");
+}
+
+// dns [host...] | [ttl sec [negativeSec]] | [clear]
+// Resolves up to four hosts through the cache; with no arguments lists the cache
+void dns_command()
+{
+  char *arg = sCmd.next();
+
+  if (arg == NULL) {
+    dnsCache.logEntries();
+    return;
+  }
+  if (strcmp(arg, "clear") == 0) {
+    dnsCache.clear();
+    return;
+  }
+  if (strcmp(arg, "ttl") == 0) {
+    char *ttl = sCmd.next();
+    char *negative = sCmd.next();
+    if (ttl != NULL) {
+      dnsCache.setTtl(atoi(ttl));
+    }
+    if (negative != NULL) {
+      dnsCache.setNegativeTtl(atoi(negative));
+    }
+    return;
+  }
+
+  const size_t MAX_HOSTS = 4;
+  const char *hosts[MAX_HOSTS];
+  IPAddress addrs[MAX_HOSTS];
+  size_t count = 0;
+  for(; arg != NULL && count < MAX_HOSTS; arg = sCmd.next()) {
+    hosts[count++] = arg;
+  }
+
+  uint32_t misses = dnsCache.misses;
+  unsigned long startTime = millis();
+  size_t resolved = dnsCache.resolve(hosts, addrs, count);
+  Log.info("dns resolved %u/%u in %lums, %lu over the air", (unsigned)resolved, (unsigned)count,
+    millis() - startTime, (unsigned long)(dnsCache.misses - misses));
+
+  for(size_t ii = 0; ii < count; ii++) {
+    Log.info("dns %s=%s", hosts[ii], addrs[ii] ? addrs[ii].toString().c_str() : "failed");
+  }
+}
+
+// probe [count host...] | [stop]
+// Pings up to four hosts count times each, one second apart, in the background. With no
+// arguments shows the progress or the results of the last probe.
+void ping_probe()
+{
+  char *arg = sCmd.next();
+
+  if (arg == NULL) {
+    pingProbe.logStats();
+    return;
+  }
+  if (strcmp(arg, "stop") == 0) {
+    pingProbe.stop();
+    return;
+  }
+
+  const char *hosts[CellularHelperPingProbe::MAX_TARGETS];
+  size_t numHosts = 0;
+  for(char *host = sCmd.next(); host != NULL && numHosts < CellularHelperPingProbe::MAX_TARGETS; host = sCmd.next()) {
+    hosts[numHosts++] = host;
+  }
+
+  if (!pingProbe.start(hosts, numHosts, atoi(arg))) {
+    Log.info("usage: probe [count host...] | [stop]");
+  }
+}
+
+void ping_probe_done(CellularHelperPingProbe &probe, void *)
+{
+  Log.info("ping probe done");
+  probe.logStats();
+}
+
+// locate [fresh] | [stats] | [clear] | [maxage sec]
+// Requests a location, answered from the cached fix when still on the same cell unless fresh
+void locate()
+{
+  char *arg = sCmd.next();
+
+  if (arg != NULL && strcmp(arg, "stats") == 0) {
+    locator.logStats();
+    return;
+  }
+  if (arg != NULL && strcmp(arg, "clear") == 0) {
+    locator.clearCachedFix();
+    return;
+  }
+  if (arg != NULL && strcmp(arg, "maxage") == 0) {
+    char *value = sCmd.next();
+    if (value != NULL) {
+      locator.setMaxAge(atoi(value) * 1000);
+      return;
+    }
+  }
+  else
+  if (arg == NULL || strcmp(arg, "fresh") == 0) {
+    bool allowCached = (arg == NULL);
+    if (!locator.request(locate_done, NULL, CellularHelperClass::DEFAULT_TIMEOUT, allowCached)) {
+      Log.info("locate failed to start");
+    }
+    return;
+  }
+  Log.info("usage: locate [fresh] | [stats] | [clear] | [maxage sec]");
+}
+
+void locate_done(const CellularHelperLocationFix &fix, bool fromCache, void *)
+{
+  Log.info("locate %s%s", fix.toString().c_str(), fromCache ? " (cached)" : "");
+}
+
+// tower [mcc mnc lac ci] | [stats]
+// Looks up the serving cell, or the given cell (lac and ci in hex), in the offline database
+void tower_lookup()
+{
+  char *arg = sCmd.next();
+
+  if (arg != NULL && strcmp(arg, "stats") == 0) {
+    towerDB.logStats();
+    return;
+  }
+
+  CellularHelperTowerRecord record;
+  bool found;
+  if (arg == NULL) {
+    found = towerDB.lookupServingCell(record);
+  }
+  else {
+    char *mnc = sCmd.next();
+    char *lac = sCmd.next();
+    char *ci = sCmd.next();
+    if (mnc == NULL || lac == NULL || ci == NULL) {
+      Log.info("usage: tower [mcc mnc lac ci] | [stats]");
+      return;
+    }
+    found = towerDB.lookup(atoi(arg), atoi(mnc), strtoul(lac, NULL, 16), strtoul(ci, NULL, 16), record);
+  }
+
+  if (found) {
+    Log.info("tower %s in %luus", record.toString().c_str(), (unsigned long)towerDB.lastLookupUs);
+  }
+  else {
+    Log.info("tower not found");
+  }
+}
+
+// attach
+// Registers on the network stored by the last successful attach, falling back to automatic
+// selection, and logs the time it took. Run after modemreg.
+void attach()
+{
+  sCmd.setProgress("registering");
+  fastAttach.attach(CONNECT_WAIT_TIME_MS);
+}
+
+// plmn [clear] | [stats]
+// Shows the stored network
+void plmn_command()
+{
+  char *arg = sCmd.next();
+
+  if (arg != NULL && strcmp(arg, "clear") == 0) {
+    plmnStore.clear();
+    return;
+  }
+  if (arg != NULL && strcmp(arg, "stats") == 0) {
+    fastAttach.logStats();
+    return;
+  }
+
+  CellularHelperPLMNRecord record;
+  plmnStore.load(record);
+  Log.info("plmn %s", record.toString().c_str());
+}
+
+// bands [learn] | [restore] | [set <list>]
+// Shows the Cat M1 band mask, the serving band and the bands stored networks were found on.
+// learn narrows the mask to the stored bands, set takes a list like 3,8,20 and restore goes
+// back to the mask before the last change. A change restarts the modem; run attach after it
+// and compare the time to register.
+void bands_command()
+{
+  const int rat = CellularHelperClass::BANDMASK_RAT_CATM1;
+  char *arg = sCmd.next();
+  CellularHelperBandMask current;
+
+  if (arg == NULL) {
+    CellularHelperBandMask seen;
+    plmnStore.getSeenBands(NULL, seen);
+    if (CellularHelper.getBandMask(rat, current)) {
+      Log.info("bands mask=%s (%d)", current.toString().c_str(), current.count());
+    }
+    Log.info("bands serving=%d seen=%s", CellularHelper.getServingBand(), seen.toString().c_str());
+    return;
+  }
+
+  bool changed = false;
+  if (strcmp(arg, "learn") == 0) {
+    changed = fastAttach.learnBandMask(rat, current);
+  }
+  else
+  if (strcmp(arg, "restore") == 0) {
+    if (previousBands.isEmpty() || !CellularHelper.getBandMask(rat, current)) {
+      Log.info("bands nothing to restore");
+      return;
+    }
+    changed = (current != previousBands) && CellularHelper.setBandMask(rat, previousBands);
+  }
+  else
+  if (strcmp(arg, "set") == 0) {
+    CellularHelperBandMask mask;
+    arg = sCmd.next();
+    if (arg == NULL || !mask.parseList(arg) || mask.isEmpty()) {
+      Log.info("bands set needs a list of bands like 3,8,20");
+      return;
+    }
+    changed = CellularHelper.getBandMask(rat, current) && current != mask && CellularHelper.setBandMask(rat, mask);
+  }
+  else {
+    Log.info("unknown bands option %s", arg);
+    return;
+  }
+
+  if (changed) {
+    previousBands = current;
+    Log.info("bands changed, restarting modem");
+    restart_modem();
+  }
+}
+
+// opscan [fresh] | [stop] | [stats] | [clear] | [maxage sec]
+// Lists the networks in range with AT+COPS=?, which can take minutes. Each network is logged as
+// soon as it is parsed. Without fresh, a scan younger than the maximum age is reused.
+void operator_scan()
+{
+  char *arg = sCmd.next();
+
+  if (arg != NULL && strcmp(arg, "stop") == 0) {
+    opScan.cancel();
+    return;
+  }
+  if (arg != NULL && strcmp(arg, "stats") == 0) {
+    opScan.logStats();
+    return;
+  }
+  if (arg != NULL && strcmp(arg, "clear") == 0) {
+    opScan.clearCached();
+    return;
+  }
+  if (arg != NULL && strcmp(arg, "maxage") == 0) {
+    char *value = sCmd.next();
+    if (value != NULL) {
+      opScan.setMaxAge(atoi(value) * 1000);
+      return;
+    }
+  }
+  else
+  if (arg == NULL || strcmp(arg, "fresh") == 0) {
+    bool allowCached = (arg == NULL);
+    if (!opScan.start(CellularHelperOperatorScan::DEFAULT_TIMEOUT_MS, allowCached)) {
+      Log.info("opscan failed to start");
+    }
+    return;
+  }
+  Log.info("usage: opscan [fresh] | [stop] | [stats] | [clear] | [maxage sec]");
+}
+
+void operator_found(const CellularHelperOperatorInfo &op, void *)
+{
+  Log.info("opscan found %s", op.toString().c_str());
+}
+
+void operator_scan_done(CellularHelperOperatorScan &scan, bool fromCache, void *)
+{
+  const CellularHelperOperatorList &list = fromCache ? scan.getCached() : scan.getResults();
+  Log.info("opscan %s: %u operators%s, age %lus", list.complete ? "complete" : "incomplete", (unsigned)list.count,
+    fromCache ? " (cached)" : "", (unsigned long)(list.getAgeMs() / 1000));
+}
+
+bool telemetry_flush(const uint8_t *payload, size_t len, void *)
+{
+  // Kept in the telemetry buffer until a destination is set and the socket is open.
+  // Queued payloads go out with the other datagrams at the end of the sampling window.
+  if (telemetryPort == 0 || !udp.isOpen()) {
+    return false;
+  }
+  return udp.queue(telemetryAddr, telemetryPort, payload, len);
+}
+
+// telem [dest a.b.c.d port] | [age sec] | [flush]
+// Samples are added by "sample telem periodSec" and sent as one datagram when the buffer is
+// full or the oldest sample reaches the maximum age
+void telemetry_command()
+{
+  char *arg = sCmd.next();
+
+  if (arg == NULL) {
+    telemetry.logStats();
+    return;
+  }
+
+  char *value = sCmd.next();
+  if (strcmp(arg, "dest") == 0 && value != NULL) {
+    char *port = sCmd.next();
+    int a, b, c, d;
+    if (port != NULL && sscanf(value, "%d.%d.%d.%d", &a, &b, &c, &d) == 4) {
+      telemetryAddr = IPAddress(a, b, c, d);
+      telemetryPort = atoi(port);
+      return;
+    }
+  }
+  else
+  if (strcmp(arg, "age") == 0 && value != NULL) {
+    telemetry.setMaxAge(atoi(value) * 1000);
+    return;
+  }
+  else
+  if (strcmp(arg, "flush") == 0) {
+    Log.info("telemetry flush %s", telemetry.flush() ? "ok" : "failed");
+    return;
+  }
+  Log.info("usage: telem [dest a.b.c.d port] | [age sec] | [flush]");
+}
+
+// transcript on|off|clear|dump
+// dump prints the binary capture as hex, 32 bytes per line, so it can be pasted into a file
+// and converted back to binary on the host
+void transcript()
+{
+  char *arg = sCmd.next();
+
+  if (arg == NULL) {
+    Log.info("transcript enabled=%d records=%u bytes=%u dropped=%u",
+      CellularHelper.transcript.isEnabled(), CellularHelper.transcript.getNumRecords(),
+      CellularHelper.transcript.getLength(), CellularHelper.transcript.getDropped());
+  }
+  else
+  if (strcmp(arg, "on") == 0) {
+    CellularHelper.transcript.begin(transcriptBuffer, sizeof(transcriptBuffer));
+    Log.info("transcript started");
+  }
+  else
+  if (strcmp(arg, "off") == 0) {
+    CellularHelper.transcript.end();
+    Log.info("transcript stopped");
+  }
+  else
+  if (strcmp(arg, "clear") == 0) {
+    CellularHelper.transcript.clear();
+  }
+  else
+  if (strcmp(arg, "dump") == 0) {
+    // The data stays in transcriptBuffer after "off", so dump works either way. While recording
+    // continues, records are only appended after the length read here.
+    logHandler.flush();
+    const uint8_t *data = transcriptBuffer;
+    size_t len = CellularHelper.transcript.getLength();
+
+    for(size_t ii = 0; ii < len; ii++) {
+      SerialCLI.printf("%02x", data[ii]);
+      if ((ii % 32) == 31) {
+        SerialCLI.println();
+      }
+    }
+    SerialCLI.println();
+  }
+  else {
+    Log.info("usage: transcript [on|off|clear|dump]");
+  }
+}
+
+// Runs the recorded transcript through the CellularHelper parsers and logs the
+// registration, PSM and signal statistics per MCC/MNC and cell
+void analyze_transcript()
+{
+  // Static so the tables don't need to fit on the application thread stack
+  static CellularHelperSessionStats stats;
+
+  stats.clear();
+  if (!stats.addSession(transcriptBuffer, CellularHelper.transcript.getLength())) {
+    Log.info("no transcript recorded");
+    return;
+  }
+  stats.logStats();
+}
+
+// The benchmark, fuzz and soak commands run inline on the loop thread, so drain() does not run
+// until they finish. Flush each record as it is logged so the log ring does not overflow.
+void flush_benchmark_record()
+{
+  logHandler.flush();
+}
+
+// parsebench [iterations]
+void parser_benchmark()
+{
+  char *arg = sCmd.next();
+  size_t iterations = 1000;
+
+  if (arg != NULL) {
+    iterations = atoi(arg);
+  }
+  if (iterations == 0) {
+    Log.info("usage: parsebench [iterations]");
+    return;
+  }
+
+  CellularHelperBenchmark::runBenchmark(iterations);
+}
+
+// parsefuzz [seed] [iterations]
+void parser_fuzz()
+{
+  char *arg = sCmd.next();
+  uint32_t seed = millis();
+  size_t iterations = 10000;
+
+  if (arg != NULL) {
+    seed = strtoul(arg, NULL, 10);
+    arg = sCmd.next();
+    if (arg != NULL) {
+      iterations = atoi(arg);
+    }
+  }
+
+  CellularHelperBenchmark::runFuzz(seed, iterations);
+}
+
+// heapsoak [cycles] [reportEvery]
+void heap_soak()
+{
+  char *arg = sCmd.next();
+  size_t cycles = 100000;
+  size_t reportEvery = 1000;
+
+  if (arg != NULL) {
+    cycles = atoi(arg);
+    arg = sCmd.next();
+    if (arg != NULL) {
+      reportEvery = atoi(arg);
+    }
+  }
+  if (cycles == 0 || reportEvery == 0) {
+    Log.info("usage: heapsoak [cycles] [reportEvery]");
+    return;
+  }
+
+  CellularHelperBenchmark::runSoak(cycles, reportEvery);
+}
+
+// cmdstats [freshnessMs]
+void command_stats()
+{
+  char *arg = sCmd.next();
+
+  if (arg != NULL) {
+    CellularHelper.queue.setFreshness(atoi(arg));
+  }
+
+  Log.info("modem commands=%lu cache hits=%lu refused=%lu freshness=%lu ms",
+    CellularHelper.queue.getModemCommands(), CellularHelper.queue.getCacheHits(), CellularHelper.queue.getRefused(),
+    CellularHelper.queue.getFreshness());
+}
+
+void log_stats()
+{
+  Log.info("log dropped=%lu truncated=%lu highWaterMark=%u",
+    logHandler.getDropped(), logHandler.getTruncated(), logHandler.getHighWaterMark());
+}